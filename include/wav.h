@@ -4,6 +4,10 @@
  *
  * The API is designed to be similar to stdio.
  *
+ * Files larger than 4 GiB are stored as RF64 (BW64 files can be read too). New
+ * files reserve a JUNK chunk in front of the format chunk, which is turned into
+ * a ds64 chunk in place once the data outgrows the 32-bit RIFF sizes.
+ *
  * This library does not support:
  *
  *   - formats other than PCM, IEEE float and log-PCM
@@ -36,8 +40,13 @@ typedef long long           WavI64;
 typedef unsigned long long  WavU64;
 typedef long long           WavIntPtr;
 typedef unsigned long long  WavUIntPtr;
+#elif defined(_WIN64)
+typedef long long           WavI64;
+typedef unsigned long long  WavU64;
+typedef long long           WavIntPtr;
+typedef unsigned long long  WavUIntPtr;
 #else
-#if defined(_WIN64) || defined(__x86_64) || defined(__amd64) || defined(__arm__)
+#if defined(__x86_64) || defined(__amd64) || defined(__aarch64__) || defined(__LP64__)
 typedef long                WavI64;
 typedef unsigned long       WavU64;
 typedef long                WavIntPtr;
@@ -86,6 +95,8 @@ typedef enum {
     WAV_ERR_FORMAT, /** not a wave file or unsupported wave format */
     WAV_ERR_MODE,   /** incorrect mode when opening the wave file or calling mode-specific API */
     WAV_ERR_PARAM,  /** incorrect parameter passed to the API function */
+    WAV_ERR_TIMEOUT,/** the operation did not complete in time */
+    WAV_ERR_BUSY,   /** too many requests in flight, wait for some of them to complete */
 } WavErrCode;
 
 typedef struct {
@@ -116,8 +127,37 @@ void wav_err_clear(void);
 
 #define WAV_OPEN_READ       1
 #define WAV_OPEN_WRITE      2
+
+/* Continue an existing file. Only the header is read, the file is positioned
+ * at the end of the data chunk and {wav_write} adds frames there. A file that
+ * does not exist or is empty is created. The data chunk must be the last
+ * chunk. */
 #define WAV_OPEN_APPEND     4
 
+/* Use a file descriptor with an internal write buffer instead of stdio (POSIX
+ * only). Sample data is written sequentially with pwrite() and the header is
+ * patched in place with pwrite(), so neither moves the stream position. */
+#define WAV_OPEN_FD         8
+
+/* Map the whole file read-only after the header is parsed (POSIX only). The
+ * samples can then be accessed in place with {wav_map_frames}. */
+#define WAV_OPEN_MMAP       16
+
+/* Repair the sizes in the header if they disagree with the length of the file,
+ * as left behind by a writer that died before updating them. The data chunk is
+ * trimmed to whole frames and the header is patched in place, which needs
+ * write access. Used with {WAV_OPEN_READ} or {WAV_OPEN_APPEND}, see
+ * {wav_get_recovered_frames}. Not available through {wav_open_io}. */
+#define WAV_OPEN_RECOVER    32
+
+/* Like {WAV_OPEN_FD}, but the samples bypass the page cache (O_DIRECT, or
+ * F_NOCACHE on macOS). Frames are staged in an internal buffer aligned to
+ * 4 KiB and whole blocks are transferred directly. The partial blocks holding
+ * the header and the end of the written data go through the page cache, so
+ * {wav_write} and {wav_read} still take any number of frames. Fails to open
+ * on file systems without direct I/O. Not available with {WAV_OPEN_MMAP}. */
+#define WAV_OPEN_DIRECT     64
+
 typedef struct _WavFile WavFile;
 
 /** Open a wav file
@@ -130,34 +170,216 @@ WavFile* wav_open(WAV_CONST char* filename, WavU32 mode);
 void     wav_close(WavFile* self);
 WavFile* wav_reopen(WavFile* self, WAV_CONST char* filename, WavU32 mode);
 
+/** Callbacks to read and write a wav file in any kind of storage
+ *
+ *  Every callback gets the {context} passed to {wav_open_io}. {seek} and {tell}
+ *  are always required, {read} is required for reading and appending, {write}
+ *  for writing and appending. The other callbacks may be NULL.
+ */
+typedef struct {
+    /** Read up to {size} bytes. Returns the number of bytes read, which is less than {size} only at the end of the data, or -1 on error. */
+    WavI64  (*read)(void *context, void *buffer, size_t size);
+    /** Write {size} bytes. Returns the number of bytes written, or -1 on error. */
+    WavI64  (*write)(void *context, WAV_CONST void *buffer, size_t size);
+    /** Move to the byte {offset} from the beginning. Returns 0 on success. */
+    int     (*seek)(void *context, WavU64 offset);
+    /** Returns the current byte offset, or -1 on error. */
+    WavI64  (*tell)(void *context);
+    /** Pass buffered data on to the storage. Returns 0 on success. */
+    int     (*flush)(void *context);
+    /** Force the data written so far to stable storage. If {data_only}, metadata that is not needed to read the data back may be left behind. Returns 0 on success. Used by {wav_set_durability}, which skips the sync if NULL. */
+    int     (*sync)(void *context, WavBool data_only);
+    /** Write {size} bytes at {offset} without moving the current position. Returns 0 on success. Used to patch the header, which is done with {seek} and {write} if NULL. */
+    int     (*pwrite)(void *context, WAV_CONST void *buffer, size_t size, WavU64 offset);
+    /** Read up to {size} bytes at {offset} without moving the current position. Returns the number of bytes read, or -1 on error. Must be safe to call from several threads at once. Used by {wav_pread}, which fails if NULL. */
+    WavI64  (*pread)(void *context, void *buffer, size_t size, WavU64 offset);
+    /** Called by {wav_close}. Returns 0 on success. */
+    int     (*close)(void *context);
+} WavIO;
+
+/** Open a wav file through I/O callbacks
+ *
+ *  @param io           The callbacks, which are copied
+ *  @param context      Passed to every callback
+ *  @param mode         {WAV_OPEN_READ}, {WAV_OPEN_WRITE} or {WAV_OPEN_APPEND}
+ *  @return             NULL if the memory allocation for the {WavFile} object failed. Other errors can be obtained using {wav_err}.
+ */
+WavFile* wav_open_io(WAV_CONST WavIO* io, void *context, WavU32 mode);
+
+/** Callbacks for a {FILE*} context. The stream is not closed by {wav_close}. */
+WAV_CONST WavIO* wav_io_stdio(void);
+
+/** Callbacks for a POSIX file descriptor passed as the context with (void*)(WavIntPtr)fd. I/O is not buffered and the descriptor is not closed by {wav_close}. NULL on other platforms. */
+WAV_CONST WavIO* wav_io_fd(void);
+
+/** A memory buffer for {wav_io_memory} */
+typedef struct {
+    void*   data;
+    size_t  size;       /** the number of bytes of wav data in {data} */
+    size_t  capacity;   /** the number of bytes allocated for {data} */
+    size_t  pos;        /** the current position */
+    WavBool growable;   /** if {data} can be reallocated with {wav_realloc} when a write does not fit, writes beyond {capacity} fail otherwise */
+} WavMemoryBuffer;
+
+/** Callbacks for a {WavMemoryBuffer*} context */
+WAV_CONST WavIO* wav_io_memory(void);
+
 /** Read a block of samples from the wav file
  *
  *  @param buffer       A pointer to a buffer where the data will be placed
  *  @param count        The number of frames (block size)
  *  @param self         The pointer to the {WavFile} structure
  *  @return             The number of frames read. If returned value is less than {count}, either EOF reached or an error occured
- *  @remarks            This API does not support extensible format. For extensible format, use {wave_read_raw} instead.
+ *  @remarks            Extensible files are read as samples of their sub-format.
  */
 size_t wav_read(WavFile* self, void *buffer, size_t count);
 
+/** Read bytes of the data chunk as they are stored
+ *
+ *  @param self         The pointer to the {WavFile} structure
+ *  @param buffer       A pointer to a buffer where the data will be placed
+ *  @param size         The number of bytes
+ *  @return             The number of bytes read. If returned value is less than {size}, either the end of the data chunk was reached or an error occured
+ *  @remarks            Works with any format, including extensible. The position is shared with {wav_read}, and {wav_tell} rounds it down to a whole frame.
+ */
+size_t wav_read_raw(WavFile* self, void *buffer, size_t size);
+
+/** Read a block of samples at a given position, without moving the current position
+ *
+ *  @param self         The pointer to the {WavFile} structure
+ *  @param buffer       A pointer to a buffer where the data will be placed
+ *  @param frame_offset The index of the first frame to read
+ *  @param count        The number of frames
+ *  @return             The number of frames read. If returned value is less than {count}, either the end of the data was reached or an error occured
+ *  @remarks            Any number of threads may call this on the same {WavFile} at once, as long as no other function is called on it meanwhile. It leaves {wav_err} untouched on success. The file must be opened with {WAV_OPEN_READ}, and through {wav_open_io} only if the callbacks provide {pread}. Frames written but not yet flushed with {wav_flush} may not be seen.
+ */
+size_t wav_pread(WAV_CONST WavFile* self, void *buffer, WavU64 frame_offset, size_t count);
+
+/** Read a block of samples and convert them to 32-bit float
+ *
+ *  @param self         The pointer to the {WavFile} structure
+ *  @param buffer       A pointer to a buffer of at least {count} * {num_channels} floats
+ *  @param count        The number of frames (block size)
+ *  @return             The number of frames read. If returned value is less than {count}, either EOF reached or an error occured
+ *  @remarks            Integer PCM is scaled to [-1, 1). 8, 16, 24 and 32-bit PCM, 32 and 64-bit IEEE float and 8-bit A-law and mu-law are supported, as well as extensible files with such a sub-format. A-law and mu-law are expanded to 16-bit PCM first. Bits below the valid bits per sample are dropped.
+ */
+size_t wav_read_f32(WavFile* self, float *buffer, size_t count);
+
+/** Read a block of samples and convert them to 16-bit PCM
+ *
+ *  @param self         The pointer to the {WavFile} structure
+ *  @param buffer       A pointer to a buffer of at least {count} * {num_channels} samples
+ *  @param count        The number of frames (block size)
+ *  @return             The number of frames read. If returned value is less than {count}, either EOF reached or an error occured
+ *  @remarks            Wider integer samples are truncated to their upper 16 bits. Float samples are rounded and saturated. A-law and mu-law samples are expanded as by G.711.
+ */
+size_t wav_read_i16(WavFile* self, WavI16 *buffer, size_t count);
+
+/** Read a block of frames into one buffer per channel
+ *
+ *  @param self         The pointer to the {WavFile} structure
+ *  @param channels     An array of {num_channels} pointers to buffers of at least {count} samples each
+ *  @param count        The number of frames (block size)
+ *  @return             The number of frames read. If returned value is less than {count}, either EOF reached or an error occured
+ *  @remarks            The samples keep the format of the file, see {wav_get_sample_size}.
+ */
+size_t wav_read_planar(WavFile* self, void **channels, size_t count);
+
 /** Write a block of samples to the wav file
  *
  *  @param buffer   A pointer to the buffer of data
  *  @param count    The number of frames (block size)
  *  @param self     The pointer to the {WavFile} structure
  *  @return         The number of frames written. If returned value is less than {count}, either EOF reached or an error occured.
- *  @remarks        This API does not support extensible format. For extensible format, use {wave_read_raw} instead.
+ *  @remarks        Extensible files are written as samples of their sub-format.
  */
 size_t wav_write(WavFile* self, WAV_CONST void *buffer, size_t count);
 
+/** Append bytes to the data chunk as they are
+ *
+ *  @param self     The pointer to the {WavFile} structure
+ *  @param buffer   A pointer to the buffer of data
+ *  @param size     The number of bytes, which need not be whole frames
+ *  @return         The number of bytes written. If returned value is less than {size}, an error occured.
+ *  @remarks        Works with any format, including extensible. The header is updated as set by {wav_set_header_update}, and the length counts whole frames only.
+ */
+size_t wav_write_raw(WavFile* self, WAV_CONST void *buffer, size_t size);
+
+/** A run of frames in the format of the file, see {wav_writev} and {wav_readv} */
+typedef struct {
+    void*   data;
+    size_t  count;      /** in frames */
+} WavFrameSpan;
+
+/** Write several blocks of frames, one after another, as a single write
+ *
+ *  @param self     The pointer to the {WavFile} structure
+ *  @param spans    The blocks, in the order they are written
+ *  @param n        The number of blocks
+ *  @return         The total number of frames written. If returned value is less than the sum of the counts, an error occured.
+ *  @remarks        The position and the header are checked and updated once for all blocks. With {WAV_OPEN_FD}, large writes go to the kernel with one pwritev().
+ */
+size_t wav_writev(WavFile* self, WAV_CONST WavFrameSpan *spans, size_t n);
+
+/** Read consecutive frames into several buffers
+ *
+ *  @param self     The pointer to the {WavFile} structure
+ *  @param spans    The buffers, filled in order
+ *  @param n        The number of buffers
+ *  @return         The total number of frames read. If returned value is less than the sum of the counts, either EOF reached or an error occured
+ *  @remarks        With {WAV_OPEN_FD}, large reads are served by one preadv().
+ */
+size_t wav_readv(WavFile* self, WAV_CONST WavFrameSpan *spans, size_t n);
+
+/** Write a block of frames taken from one buffer per channel
+ *
+ *  @param self         The pointer to the {WavFile} structure
+ *  @param channels     An array of {num_channels} pointers to buffers of at least {count} samples each
+ *  @param count        The number of frames (block size)
+ *  @return             The number of frames written. If returned value is less than {count}, an error occured.
+ *  @remarks            The samples must already be in the format of the file, see {wav_get_sample_size}.
+ */
+size_t wav_write_planar(WavFile* self, WAV_CONST void* WAV_CONST* channels, size_t count);
+
+/** Convert a block of 32-bit float samples to the format of the wav file and write them
+ *
+ *  @param self     The pointer to the {WavFile} structure
+ *  @param buffer   A pointer to {count} * {num_channels} floats in [-1, 1)
+ *  @param count    The number of frames (block size)
+ *  @return         The number of frames written. If returned value is less than {count}, an error occured.
+ *  @remarks        Samples outside the range of an integer PCM format are saturated, see {wav_get_clip_count}. A-law and mu-law samples are rounded to 16-bit PCM and compressed as by G.711. Dither is added if enabled with {wav_set_dither}. Samples are rounded to the valid bits per sample, leaving the lower bits zero. Frames of more than 16384 samples do not fit the conversion buffer and are rejected with {WAV_ERR_PARAM}.
+ */
+size_t wav_write_f32(WavFile* self, WAV_CONST float *buffer, size_t count);
+
+/** Enable or disable TPDF dither in {wav_write_f32}
+ *
+ *  @param self     The {WavFile} object
+ *  @param enable   Non-zero to add triangular PDF dither of +/-1 LSB before rounding to integer PCM
+ */
+void wav_set_dither(WavFile* self, WavBool enable);
+
+/** Get the number of samples clipped by the last call to {wav_write_f32}
+ *
+ *  @param self     The {WavFile} object
+ *  @return         The number of samples that exceeded the full scale of the file format and were saturated.
+ */
+size_t wav_get_clip_count(WAV_CONST WavFile* self);
+
+/** Get the number of frames found by {WAV_OPEN_RECOVER}
+ *
+ *  @param self     The pointer to the {WavFile} structure
+ *  @return         The number of frames beyond the size that was in the header, negative if the file was shorter than the header said, 0 if nothing was repaired
+ */
+WavI64 wav_get_recovered_frames(WAV_CONST WavFile* self);
+
 /** Tell the current position in the wav file.
  *
  *  @param self     The pointer to the WavFile structure.
- *  @return         The current frame index.
+ *  @return         The current frame index, or -1 if an error occured.
  */
-long int wav_tell(WAV_CONST WavFile* self);
+WavI64 wav_tell(WAV_CONST WavFile* self);
 
-int  wav_seek(WavFile* self, long int offset, int origin);
+int  wav_seek(WavFile* self, WavI64 offset, int origin);
 void wav_rewind(WavFile* self);
 
 /** Tell if the end of the wav file is reached.
@@ -169,6 +391,80 @@ int wav_eof(WAV_CONST WavFile* self);
 
 int wav_flush(WavFile* self);
 
+typedef enum {
+    WAV_MAP_NORMAL,     /** no special access pattern */
+    WAV_MAP_SEQUENTIAL, /** frames will be accessed in order, read ahead aggressively */
+    WAV_MAP_RANDOM,     /** frames will be accessed in random order, do not read ahead */
+    WAV_MAP_WILLNEED,   /** the whole file will be accessed soon, start reading it in */
+} WavMapAdvice;
+
+/** Get a pointer to frames of a file opened with {WAV_OPEN_MMAP}
+ *
+ *  @param self     The {WavFile} object
+ *  @param start    The index of the first frame
+ *  @param count    The number of frames
+ *  @return         A pointer into the mapped data chunk, which stays valid until the file is closed. NULL if the frames are out of range or the file is not mapped.
+ */
+WAV_CONST void* wav_map_frames(WAV_CONST WavFile* self, size_t start, size_t count);
+
+/** Give the kernel a hint about how the mapping will be accessed
+ *
+ *  @param self     The {WavFile} object opened with {WAV_OPEN_MMAP}
+ *  @param advice   One of `WAV_MAP_*`
+ *  @return         0 on success, otherwise an error code.
+ */
+int wav_map_advise(WavFile* self, WavMapAdvice advice);
+
+typedef enum {
+    WAV_HEADER_UPDATE_ALWAYS,   /** patch the size fields after every write (default) */
+    WAV_HEADER_UPDATE_ON_FLUSH, /** patch the size fields only in {wav_flush} and {wav_close} */
+    WAV_HEADER_UPDATE_BYTES,    /** patch the size fields once at least {interval} bytes have been written since the last patch */
+    WAV_HEADER_UPDATE_MS,       /** patch the size fields once at least {interval} milliseconds have passed since the last patch */
+} WavHeaderUpdate;
+
+/** Set when the RIFF/fact/data size fields are written back to the file
+ *
+ *  @param self         The {WavFile} object
+ *  @param policy       One of `WAV_HEADER_UPDATE_*`
+ *  @param interval     The number of bytes or milliseconds between two patches. Ignored for {WAV_HEADER_UPDATE_ALWAYS} and {WAV_HEADER_UPDATE_ON_FLUSH}.
+ *  @remarks            With any policy other than {WAV_HEADER_UPDATE_ALWAYS}, the sizes are tracked in memory only, so the file on disk is not a valid wav file between patches. {wav_flush} and {wav_close} always bring the header up to date.
+ */
+void wav_set_header_update(WavFile* self, WavHeaderUpdate policy, WavU64 interval);
+
+typedef enum {
+    WAV_DURABILITY_NONE,        /** leave it to the OS when the data reaches storage (default) */
+    WAV_DURABILITY_ON_CLOSE,    /** sync in {wav_flush} and {wav_close} */
+    WAV_DURABILITY_BYTES,       /** sync once at least {interval} bytes have been written since the last sync */
+    WAV_DURABILITY_MS,          /** sync once at least {interval} milliseconds have passed since the last sync */
+} WavDurability;
+
+/** Set when the written data is forced to stable storage
+ *
+ *  @param self         The {WavFile} object
+ *  @param policy       One of `WAV_DURABILITY_*`
+ *  @param interval     The number of bytes or milliseconds between two syncs. Ignored for {WAV_DURABILITY_NONE} and {WAV_DURABILITY_ON_CLOSE}.
+ *  @param data_only    Sync with fdatasync() instead of fsync(), which skips metadata such as the modification time
+ *  @remarks            A sync first makes the samples durable, and only then patches the size fields and syncs again, so the header never describes samples that could be lost. With {WAV_DURABILITY_BYTES} and {WAV_DURABILITY_MS} the size fields are therefore only patched at syncs, whatever the policy set with {wav_set_header_update}.
+ */
+void wav_set_durability(WavFile* self, WavDurability policy, WavU64 interval, WavBool data_only);
+
+/** Allocate storage for the data chunk in advance
+ *
+ *  @param self         The {WavFile} object
+ *  @param frames       The number of frames the data chunk should have room for, counting the frames already written
+ *  @return             0 on success, otherwise an error code, and {wav_err} tells the details
+ *  @remarks            The space is allocated with fallocate(FALLOC_FL_KEEP_SIZE), so the file keeps its size and stays a valid wav file. {wav_close} releases whatever was not written. Does nothing on platforms other than Linux and for files opened with {wav_open_io} on anything but a file.
+ */
+int wav_reserve(WavFile* self, WavU64 frames);
+
+/** Let {wav_write} reserve storage in large steps
+ *
+ *  @param self         The {WavFile} object
+ *  @param frames       Whenever a write goes beyond the reserved space, room for this many more frames is reserved with {wav_reserve}. 0 turns this off, which is the default.
+ *  @remarks            If the file system does not support reservations, {wav_write} stops trying.
+ */
+void wav_set_reserve_step(WavFile* self, WavU64 frames);
+
 /** Set the format code
  *
  *  @param self     The {WavFile} object
@@ -209,15 +505,272 @@ void wav_set_valid_bits_per_sample(WavFile* self, WavU16 bits);
  */
 void wav_set_sample_size(WavFile* self, size_t sample_size);
 
+/** Set the speaker positions of the channels
+ *
+ *  @param self             The {WavFile} object
+ *  @param channel_mask     A bit per speaker position, as defined by `WAVEFORMATEXTENSIBLE`
+ *  @remarks                The format must be {WAV_FORMAT_EXTENSIBLE}. {wav_errno} can be used to get the error code if there is an error.
+ */
+void wav_set_channel_mask(WavFile* self, WavU32 channel_mask);
+
+/** Set the format of the samples of an extensible file
+ *
+ *  @param self             The {WavFile} object
+ *  @param sub_format       The format code of the samples, which should be one of `WAV_FORMAT_*`
+ *  @remarks                The format must be {WAV_FORMAT_EXTENSIBLE}. Switching to {WAV_FORMAT_EXTENSIBLE} with {wav_set_format} keeps the previous format as the sub-format. {wav_errno} can be used to get the error code if there is an error.
+ */
+void wav_set_sub_format(WavFile* self, WavU16 sub_format);
+
 WavU16 wav_get_format(WAV_CONST WavFile* self);
 WavU16 wav_get_num_channels(WAV_CONST WavFile* self);
 WavU32 wav_get_sample_rate(WAV_CONST WavFile* self);
 WavU16 wav_get_valid_bits_per_sample(WAV_CONST WavFile* self);
 size_t wav_get_sample_size(WAV_CONST WavFile* self);
-size_t wav_get_length(WAV_CONST WavFile* self);
+WavU64 wav_get_length(WAV_CONST WavFile* self);
 WavU32 wav_get_channel_mask(WAV_CONST WavFile* self);
 WavU16 wav_get_sub_format(WAV_CONST WavFile* self);
 
+/** A complete sample format */
+typedef struct {
+    WavU16  format;                 /** the format tag, see {wav_set_format} */
+    WavU16  num_channels;
+    WavU32  sample_rate;
+    size_t  sample_size;            /** in bytes */
+    WavU16  valid_bits_per_sample;  /** 0 for all the bits of {sample_size} */
+    WavU32  channel_mask;           /** only used with {WAV_FORMAT_EXTENSIBLE} */
+    WavU16  sub_format;             /** only used with {WAV_FORMAT_EXTENSIBLE} */
+} WavFormatSpec;
+
+/** Open a wav file with its format
+ *
+ *  @param filename     The name of the wav file
+ *  @param mode         The mode for open, as for {wav_open}
+ *  @param format       The sample format, or NULL to open like {wav_open}. Fields that are 0 take the defaults of {wav_open}: PCM, 2 channels, 44.1 kHz, 2-byte samples (1 byte for A-law and mu-law, 4 for IEEE float) and all bits valid. {sub_format} defaults to PCM.
+ *  @return             NULL if {format} is invalid or the memory allocation failed, with the details in {wav_err}. Otherwise as {wav_open}.
+ *  @remarks            A new file is created with the header for {format} written once, instead of once by {wav_open} and once more per {wav_set_*} call. If the file already has a header, i.e. when reading or appending to an existing file, the non-zero fields of {format} are checked against it, and a mismatch is a {WAV_ERR_FORMAT} error.
+ */
+WavFile* wav_open_ex(WAV_CONST char* filename, WavU32 mode, WAV_CONST WavFormatSpec* format);
+
+/** Convert a wav file to another sample format with a pool of threads
+ *
+ *  @param src          The name of the file to convert
+ *  @param dst          The name of the file to create
+ *  @param format       The sample format of {dst}. Fields that are 0 are taken from {src}.
+ *  @param n_threads    The number of threads, including the calling one, 0 for one per processor
+ *  @return             0 on success, otherwise an error code, and {wav_err} tells the details
+ *  @remarks            {dst} is preallocated and its header written before the frames are converted tile by tile, each tile with one positioned read and one positioned write. The number of channels and the sample rate cannot change. Samples are converted through 32-bit float unless the sample type stays the same, in which case they are copied. Threads are only used on POSIX systems.
+ */
+int wav_transcode_parallel(WAV_CONST char* src, WAV_CONST char* dst, WAV_CONST WavFormatSpec* format, size_t n_threads);
+
+#define WAV_INFO_MAX_CHUNKS 16
+
+/** A chunk found by {wav_probe} */
+typedef struct {
+    char    id[4];                  /** the chunk ID, e.g. "fmt " */
+    WavU64  offset;                 /** the byte offset of the chunk header in the file */
+    WavU64  size;                   /** the size of the chunk body in bytes, taken from the ds64 chunk if needed */
+} WavChunkInfo;
+
+/** The format of a wav file, as returned by {wav_probe} */
+typedef struct {
+    WavU16  format;                 /** the format tag, see {wav_get_format} */
+    WavU16  num_channels;
+    WavU32  sample_rate;
+    WavU16  valid_bits_per_sample;
+    size_t  sample_size;            /** in bytes */
+    WavU32  channel_mask;           /** 0 unless the format is {WAV_FORMAT_EXTENSIBLE} */
+    WavU16  sub_format;             /** 0 unless the format is {WAV_FORMAT_EXTENSIBLE} */
+    WavU64  length;                 /** the number of frames */
+    WavU64  data_offset;            /** the byte offset of the first sample in the file */
+    WavBool rf64;                   /** the sizes are stored in a ds64 chunk */
+
+    /** the chunks from the first one up to and including the data chunk, only the first {WAV_INFO_MAX_CHUNKS} are listed */
+    WavChunkInfo    chunks[WAV_INFO_MAX_CHUNKS];
+    size_t          num_chunks;
+} WavInfo;
+
+/** Read the format of a wav file without opening it
+ *
+ *  @param filename     The name of the wav file
+ *  @param info         Receives the format
+ *  @return             0 on success, otherwise an error code, and {wav_err} tells the details
+ *  @remarks            The header is parsed from a single read of the first few KiB of the file. Chunks beyond that are reached with one small read each. Nothing is allocated unless an error occurs.
+ */
+int wav_probe(WAV_CONST char* filename, WavInfo* info);
+
+/** Read a whole wav file into memory
+ *
+ *  @param filename     The name of the wav file
+ *  @param info         Receives the format, as from {wav_probe}
+ *  @param data         Receives the {info->length} frames in the format of the file, to be released with {wav_free}. NULL if the file has no frames or on error.
+ *  @return             0 on success, otherwise an error code, and {wav_err} tells the details
+ *  @remarks            The header is parsed from one read, the size checked against the file with one fstat(), and the frames read into a single allocation with one more read. Bytes after the data chunk are ignored.
+ */
+int wav_load(WAV_CONST char* filename, WavInfo* info, void** data);
+
+/** Write a whole wav file from memory
+ *
+ *  @param filename     The name of the file to create, replaced if it exists
+ *  @param info         The format of {data}. {format}, {num_channels}, {sample_rate}, {sample_size} and {length} are used, as well as {valid_bits_per_sample}, {channel_mask} and {sub_format} for {WAV_FORMAT_EXTENSIBLE}. A {valid_bits_per_sample} of 0 stands for 8*{sample_size}.
+ *  @param data         {info->length} frames in the format of {info}
+ *  @return             0 on success, otherwise an error code, and {wav_err} tells the details
+ *  @remarks            The header is built in memory and written together with the frames by one pwritev() on Linux and FreeBSD. The file has the layout {wav_open} creates and is RF64 if it exceeds 4 GiB. It is removed if writing fails.
+ */
+int wav_save(WAV_CONST char* filename, WAV_CONST WavInfo* info, WAV_CONST void* data);
+
+/** Called by {wav_probe_tree} for every wav file found
+ *
+ *  @param context      The {context} passed to {wav_probe_tree}
+ *  @param path         The path of the file or directory
+ *  @param info         The format of the file, NULL if it could not be probed
+ *  @param err          NULL on success, otherwise why the file or directory could not be probed
+ *  @remarks            Called concurrently from the worker threads, in no particular order.
+ */
+typedef void (*WavProbeFunc)(void *context, WAV_CONST char *path, WAV_CONST WavInfo *info, WAV_CONST WavErr *err);
+
+/** Probe every wav file in a directory tree with a pool of threads
+ *
+ *  @param root         A directory, or a single file
+ *  @param func         Called with the result for every file
+ *  @param context      Passed to {func}
+ *  @param n_threads    The number of threads, including the calling one, 0 for one per processor
+ *  @return             0 on success, otherwise an error code if {root} could not be probed, and {wav_err} tells the details
+ *  @remarks            Files named *.wav, *.wave, *.bwf and *.rf64 (in any case) are probed with {wav_probe}. Symbolic links to directories are not followed. Directories that cannot be read are reported to {func} and do not stop the walk.
+ */
+int wav_probe_tree(WAV_CONST char *root, WavProbeFunc func, void *context, size_t n_threads);
+
+typedef struct _WavAsyncWriter WavAsyncWriter;
+
+/** Write a wav file from a background thread
+ *
+ *  Frames are queued in a preallocated single-producer/single-consumer ring
+ *  buffer. A background thread drains it in large batches with {wav_write}, so
+ *  the producer is never blocked by the disk.
+ *
+ *  @param file         A {WavFile} opened for writing, with its format set. It must not be used otherwise until {wav_async_close} returns.
+ *  @param capacity     The number of frames the ring buffer holds, rounded up to a power of two
+ *  @return             NULL if an error occured
+ */
+WavAsyncWriter* wav_async_open(WavFile* file, size_t capacity);
+
+/** Write all queued frames, stop the background thread and free the writer
+ *
+ *  @param self     The {WavAsyncWriter} object
+ *  @return         0 on success, otherwise the error code of the first failed write
+ *  @remarks        {file} is left open, with the header up to date.
+ */
+int wav_async_close(WavAsyncWriter* self);
+
+/** Queue a block of frames
+ *
+ *  @param self     The {WavAsyncWriter} object
+ *  @param buffer   The frames, in the format of the file
+ *  @param count    The number of frames (block size)
+ *  @return         The number of frames queued
+ *  @remarks        This function never blocks and does not take a lock, so it can be called from an audio callback. It must not be called from more than one thread at a time. Frames that do not fit into the ring buffer are dropped and counted as an overrun.
+ */
+size_t wav_async_write(WavAsyncWriter* self, WAV_CONST void *buffer, size_t count);
+
+/** Wait until the frames queued so far are written and the header is updated
+ *
+ *  @param self         The {WavAsyncWriter} object
+ *  @param timeout_ms   The maximum time to wait, in milliseconds
+ *  @return             0 on success, {WAV_ERR_TIMEOUT} if the frames are not written in time, otherwise the error code of the first failed write
+ */
+int wav_async_flush(WavAsyncWriter* self, WavU64 timeout_ms);
+
+/** Get the number of {wav_async_write} calls that dropped frames */
+size_t wav_async_get_overrun_count(WAV_CONST WavAsyncWriter* self);
+
+/** Get the total number of frames dropped because the ring buffer was full */
+size_t wav_async_get_dropped_frames(WAV_CONST WavAsyncWriter* self);
+
+/** Get the highest number of frames that were waiting in the ring buffer */
+size_t wav_async_get_peak_fill(WAV_CONST WavAsyncWriter* self);
+
+typedef struct _WavEngine WavEngine;
+
+/** Called by {wav_engine_poll} when a request submitted with {wav_read_async} or {wav_write_async} completes
+ *
+ *  @param context      The {context} passed with the request
+ *  @param file         The {WavFile} of the request
+ *  @param count        The number of frames read or written
+ *  @param err          NULL on success, otherwise why the request failed
+ *  @remarks            The request slot is free again, so the next request can be submitted from here.
+ */
+typedef void (*WavCompletionFunc)(void *context, WavFile *file, size_t count, WAV_CONST WavErr *err);
+
+#define WAV_ENGINE_THREADS  1   /** use the thread pool even where io_uring is available */
+
+/** Create an engine that serves reads and writes of many files at once
+ *
+ *  On Linux the requests of all files go through a single io_uring, and
+ *  complete without a thread per request. Elsewhere, or if io_uring is not
+ *  available, a pool of threads issues blocking positioned reads and writes.
+ *
+ *  @param queue_depth  The maximum number of requests in flight, at most 4096
+ *  @param n_buffers    The number of buffers to preallocate. With io_uring they are registered with the kernel, which saves mapping the pages on every request.
+ *  @param buffer_size  The size of each buffer in bytes, rounded up to a multiple of 4096
+ *  @param flags        0, or {WAV_ENGINE_THREADS}
+ *  @return             NULL if an error occured
+ *  @remarks            An engine must only be used from one thread.
+ */
+WavEngine* wav_engine_open(size_t queue_depth, size_t n_buffers, size_t buffer_size, WavU32 flags);
+
+/** Wait for the requests in flight, calling their callbacks, and free the engine */
+void wav_engine_close(WavEngine* self);
+
+/** Get one of the preallocated buffers, aligned to 4096 bytes
+ *
+ *  @param self     The {WavEngine} object
+ *  @param index    Less than the {n_buffers} passed to {wav_engine_open}
+ *  @return         NULL if {index} is out of range
+ */
+void* wav_engine_get_buffer(WavEngine* self, size_t index);
+
+/** Check whether requests go through io_uring rather than the thread pool */
+WavBool wav_engine_uses_io_uring(WAV_CONST WavEngine* self);
+
+/** Get the number of requests submitted and not completed yet */
+size_t wav_engine_get_in_flight(WAV_CONST WavEngine* self);
+
+/** Submit a read of frames from a given position
+ *
+ *  @param self         The {WavEngine} object
+ *  @param file         A {WavFile} opened for reading with {wav_open}, {WAV_OPEN_FD} recommended. Files opened with {wav_open_io} have no descriptor and are rejected.
+ *  @param buffer       The buffer for the frames, which must stay valid until the request completes. Requests within one of the preallocated buffers are faster with io_uring.
+ *  @param frame_offset The first frame to read
+ *  @param count        The number of frames to read, clamped to the length of the file as in {wav_pread}
+ *  @param func         Called from {wav_engine_poll} with the result
+ *  @param context      Passed to {func}
+ *  @return             0 on success, {WAV_ERR_BUSY} if {queue_depth} requests are in flight, otherwise an error code, and {wav_err} tells the details
+ *  @remarks            The request is not started before the next {wav_engine_poll}.
+ */
+int wav_read_async(WavEngine* self, WavFile* file, void *buffer, WavU64 frame_offset, size_t count,
+                   WavCompletionFunc func, void *context);
+
+/** Submit a write of frames at the end of the file
+ *
+ *  @param self         The {WavEngine} object
+ *  @param file         A {WavFile} opened for writing with {wav_open}, {WAV_OPEN_FD} recommended, with its format set. Files opened with {wav_open_io} have no descriptor and are rejected.
+ *  @param buffer       The frames, which must stay valid until the request completes
+ *  @param count        The number of frames to write
+ *  @param func         Called from {wav_engine_poll} with the result
+ *  @param context      Passed to {func}
+ *  @return             0 on success, {WAV_ERR_BUSY} if {queue_depth} requests are in flight, otherwise an error code, and {wav_err} tells the details
+ *  @remarks            The frames are placed at the end of the file when the request is submitted, so requests on the same file may complete in any order. Do not mix with {wav_write}, and poll until every write of a file completed before calling {wav_flush} or {wav_close} on it.
+ */
+int wav_write_async(WavEngine* self, WavFile* file, WAV_CONST void *buffer, size_t count,
+                    WavCompletionFunc func, void *context);
+
+/** Start the submitted requests and complete finished ones
+ *
+ *  @param self         The {WavEngine} object
+ *  @param min_complete The number of requests to wait for, 0 to return without blocking
+ *  @return             The number of requests completed, whose callbacks were called
+ */
+size_t wav_engine_poll(WavEngine* self, size_t min_complete);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,10 +1,55 @@
+#if !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+/* fallocate() */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define WAV_HAVE_POSIX 1
+#endif
+
+/* preadv() and pwritev() */
+#if defined(__linux__) || defined(__FreeBSD__)
+#define WAV_HAVE_PWRITEV 1
+#endif
+
 #include "wav.h"
+#include "wav_convert.h"
+#include "wav_internal.h"
+
+/* 64-bit offsets for the stdio backend */
+#if defined(_MSC_VER)
+#define WAV_FSEEK   _fseeki64
+#define WAV_FTELL   _ftelli64
+#elif WAV_HAVE_POSIX
+#define WAV_FSEEK   fseeko
+#define WAV_FTELL   ftello
+#else
+#define WAV_FSEEK   fseek
+#define WAV_FTELL   ftell
+#endif
 
 #if defined(__x86_64) || defined(__amd64) || defined(__i386__) || defined(__x86_64__) || defined(__LITTLE_ENDIAN__) || defined(CORE_CM7) || defined(__arm__)
 #define WAV_ENDIAN_LITTLE 1
@@ -14,6 +59,10 @@
 
 #if WAV_ENDIAN_LITTLE
 #define WAV_RIFF_CHUNK_ID       ((WavU32)'FFIR')
+#define WAV_RF64_CHUNK_ID       ((WavU32)'46FR')
+#define WAV_BW64_CHUNK_ID       ((WavU32)'46WB')
+#define WAV_DS64_CHUNK_ID       ((WavU32)'46sd')
+#define WAV_JUNK_CHUNK_ID       ((WavU32)'KNUJ')
 #define WAV_FORMAT_CHUNK_ID     ((WavU32)' tmf')
 #define WAV_FACT_CHUNK_ID       ((WavU32)'tcaf')
 #define WAV_DATA_CHUNK_ID       ((WavU32)'atad')
@@ -22,6 +71,10 @@
 
 #if WAV_ENDIAN_BIG
 #define WAV_RIFF_CHUNK_ID       ((WavU32)'RIFF')
+#define WAV_RF64_CHUNK_ID       ((WavU32)'RF64')
+#define WAV_BW64_CHUNK_ID       ((WavU32)'BW64')
+#define WAV_DS64_CHUNK_ID       ((WavU32)'ds64')
+#define WAV_JUNK_CHUNK_ID       ((WavU32)'JUNK')
 #define WAV_FORMAT_CHUNK_ID     ((WavU32)'fmt ')
 #define WAV_FACT_CHUNK_ID       ((WavU32)'fact')
 #define WAV_DATA_CHUNK_ID       ((WavU32)'data')
@@ -150,25 +203,6 @@ void wav_err_clear(void)
     }
 }
 
-WAV_INLINE void wav_err_set(WavErrCode code, WAV_CONST char *format, ...)
-{
-    assert(g_err.code == WAV_OK);
-    va_list args;
-    va_start(args, format);
-    g_err.code = code;
-    wav_vasprintf(&g_err.message, format, args);
-    g_err._is_literal = 0;
-    va_end(args);
-}
-
-WAV_INLINE void wav_err_set_literal(WavErrCode code, WAV_CONST char *message)
-{
-    assert(g_err.code == WAV_OK);
-    g_err.code = code;
-    g_err.message = (char *)message;
-    g_err._is_literal = 1;
-}
-
 #pragma pack(push, 1)
 
 typedef struct {
@@ -219,6 +253,21 @@ typedef struct {
     WavU64 offset;
 } WavMasterChunk;
 
+/* The 64-bit sizes are kept here for every file. They are written out only once
+ * the file has been promoted to RF64, until then the chunk is a JUNK chunk. */
+typedef struct {
+    WavChunkHeader header;
+
+    WavU64 offset;
+
+    struct {
+        WavU64 riff_size;
+        WavU64 data_size;
+        WavU64 sample_count;
+        WavU32 table_length;
+    } body;
+} WavDs64Chunk;
+
 #pragma pack(pop)
 
 #define WAV_CHUNK_MASTER    ((WavU32)1)
@@ -226,415 +275,2964 @@ typedef struct {
 #define WAV_CHUNK_FACT      ((WavU32)4)
 #define WAV_CHUNK_DATA      ((WavU32)8)
 
+#define WAV_IO_BUFFER_SIZE  ((size_t)65536)
+
+/* offset, size and memory alignment of every transfer through direct_fd */
+#define WAV_DIRECT_ALIGN    ((size_t)4096)
+
+/* a 32-bit size of 0xffffffff means the size is in the ds64 chunk */
+#define WAV_SIZE_IN_DS64    ((WavU32)0xffffffff)
+#define WAV_DS64_BODY_SIZE  ((WavU32)28)
+
 struct _WavFile {
-    FILE*               fp;
+    WavIO               io;
+    void*               io_context;
+    WavBool             io_error;
+    WavBool             io_eof;
+
     char*               filename;
     WavU32              mode;
     WavBool             is_a_new_file;
 
     WavMasterChunk      riff_chunk;
+    WavDs64Chunk        ds64_chunk;
     WavFormatChunk      format_chunk;
     WavFactChunk        fact_chunk;
     WavDataChunk        data_chunk;
+
+    WavI64              recovered_frames;   /* by WAV_OPEN_RECOVER */
+
+    WavHeaderUpdate     header_update;
+    WavU64              header_update_interval;
+    WavU64              header_pending_bytes;
+    WavU64              header_last_update_ms;
+    WavBool             header_dirty;
+
+    WavU64              reserved_end;       /* space is allocated up to this offset */
+    WavU64              reserve_step;       /* in frames, 0 to not grow automatically */
+
+    WavDurability       durability;
+    WavU64              durability_interval;
+    WavBool             durability_data_only;
+    WavU64              sync_pending_bytes;
+    WavU64              sync_last_ms;
+
+    /* file descriptor backend (WAV_OPEN_FD), all I/O is positional */
+    int                 fd;
+    WavU64              io_pos;
+    WavU8*              io_buffer;          /* aligned to WAV_DIRECT_ALIGN */
+    void*               io_buffer_memory;
+    WavU64              io_buffer_pos;      /* file offset of io_buffer[0] */
+    size_t              io_buffer_len;
+    WavBool             io_buffer_dirty;    /* io_buffer holds data not yet written */
+
+    /* second descriptor that bypasses the page cache (WAV_OPEN_DIRECT), -1 if not used */
+    int                 direct_fd;
+
+    /* read-only mapping of the whole file (WAV_OPEN_MMAP) */
+    WAV_CONST WavU8*    map;
+    size_t              map_size;
+
+    /* raw samples waiting for conversion, allocated on first use */
+    WavU8*              convert_buffer;
+
+    WavBool             dither;
+    WavU32              dither_state;
+    float*              dither_buffer;
+    size_t              clip_count;
 };
 
+/* a piece of the header to be written at a fixed offset */
+typedef struct {
+    WavU64          offset;
+    WAV_CONST void* data;
+    size_t          size;
+} WavPatch;
+
+static WAV_CONST WavU8 junk_body[WAV_DS64_BODY_SIZE];
+
 static WAV_CONST WavU8 default_sub_format[16] = {
     0x01, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
 };
 
-void wav_parse_header(WavFile* self)
+/* stdio backend, the context is a FILE* */
+
+static WavI64 wav_stdio_read(void *context, void *buffer, size_t size)
 {
-    size_t read_count;
+    size_t n = fread(buffer, 1, size, context);
+    if (n < size && ferror((FILE*)context))
+        return -1;
+    return (WavI64)n;
+}
 
-    read_count = fread(&self->riff_chunk, sizeof(WavChunkHeader), 1, self->fp);
-    if (read_count != 1) {
-        wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
-        return;
-    }
+static WavI64 wav_stdio_write(void *context, WAV_CONST void *buffer, size_t size)
+{
+    size_t n = fwrite(buffer, 1, size, context);
+    if (n < size)
+        return -1;
+    return (WavI64)n;
+}
 
-    if (self->riff_chunk.id != WAV_RIFF_CHUNK_ID) {
-        wav_err_set_literal(WAV_ERR_FORMAT, "Not a RIFF file");
-        return;
-    }
+static int wav_stdio_seek(void *context, WavU64 offset)
+{
+    return WAV_FSEEK((FILE*)context, (WavI64)offset, SEEK_SET);
+}
 
-    read_count = fread(&self->riff_chunk.wave_id, 4, 1, self->fp);
-    if (read_count != 1) {
-        wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
-        return;
-    }
-    if (self->riff_chunk.wave_id != WAV_WAVE_ID) {
-        wav_err_set_literal(WAV_ERR_FORMAT, "Not a WAVE file");
-        return;
-    }
+static WavI64 wav_stdio_tell(void *context)
+{
+    return (WavI64)WAV_FTELL((FILE*)context);
+}
 
-    self->riff_chunk.offset = (WavU64)ftell(self->fp);
+static int wav_stdio_flush(void *context)
+{
+    return fflush(context);
+}
 
-    while (self->data_chunk.header.id != WAV_DATA_CHUNK_ID) {
-        WavChunkHeader header;
+#if WAV_HAVE_POSIX
+static int wav_fd_sync(int fd, WavBool data_only);
+#endif
 
-        read_count = fread(&header, sizeof(WavChunkHeader), 1, self->fp);
-        if (read_count != 1) {
-            wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
-            return;
-        }
+static int wav_stdio_sync(void *context, WavBool data_only)
+{
+    if (fflush(context) != 0)
+        return -1;
+#if WAV_HAVE_POSIX
+    return wav_fd_sync(fileno((FILE*)context), data_only);
+#elif defined(_WIN32)
+    (void)data_only;
+    return _commit(_fileno((FILE*)context));
+#else
+    (void)data_only;
+    return 0;
+#endif
+}
 
-        switch (header.id) {
-            case WAV_FORMAT_CHUNK_ID:
-                self->format_chunk.header = header;
-                self->format_chunk.offset = (WavU64)ftell(self->fp);
-                read_count = fread(&self->format_chunk.body, header.size, 1, self->fp);
-                if (read_count != 1) {
-                    wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
-                    return;
-                }
-                if (self->format_chunk.body.format_tag != WAV_FORMAT_PCM &&
-                    self->format_chunk.body.format_tag != WAV_FORMAT_IEEE_FLOAT &&
-                    self->format_chunk.body.format_tag != WAV_FORMAT_ALAW &&
-                    self->format_chunk.body.format_tag != WAV_FORMAT_MULAW)
-                {
-                    wav_err_set(WAV_ERR_FORMAT, "Unsupported format tag: %#010x", self->format_chunk.body.format_tag);
-                    return;
-                }
-                break;
-            case WAV_FACT_CHUNK_ID:
-                self->fact_chunk.header = header;
-                self->fact_chunk.offset = (WavU64)ftell(self->fp);
-                read_count = fread(&self->fact_chunk.body, header.size, 1, self->fp);
-                if (read_count != 1) {
-                    wav_err_set(WAV_ERR_FORMAT, "Unexpected EOF");
-                }
-                break;
-            case WAV_DATA_CHUNK_ID:
-                self->data_chunk.header = header;
-                self->data_chunk.offset = (WavU64)ftell(self->fp);
-                break;
-            default:
-                if (fseek(self->fp, header.size, SEEK_CUR) < 0) {
-                    wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-                    return;
-                }
-                break;
-        }
-    }
+static int wav_stdio_close(void *context)
+{
+    return fclose(context);
 }
 
-void wav_write_header(WavFile* self)
+#if WAV_HAVE_POSIX
+static ssize_t wav_fd_pread_all(int fd, void *data, size_t size, WavU64 offset);
+
+/* bypasses the stream buffer, which is fine as long as no writes are pending in it */
+static WavI64 wav_stdio_pread(void *context, void *buffer, size_t size, WavU64 offset)
 {
-    self->riff_chunk.size =
-        sizeof(self->riff_chunk.wave_id) +
-        (self->format_chunk.header.id == WAV_FORMAT_CHUNK_ID ? (sizeof(WavChunkHeader) + self->format_chunk.header.size) : 0) +
-        (self->fact_chunk.header.id == WAV_FACT_CHUNK_ID ? (sizeof(WavChunkHeader) + self->fact_chunk.header.size) : 0) +
-        (self->data_chunk.header.id == WAV_DATA_CHUNK_ID ? (sizeof(WavChunkHeader) + self->data_chunk.header.size) : 0);
+    return (WavI64)wav_fd_pread_all(fileno((FILE*)context), buffer, size, offset);
+}
+#define WAV_STDIO_PREAD (&wav_stdio_pread)
+#else
+#define WAV_STDIO_PREAD NULL
+#endif
 
-    if (fseek(self->fp, 0, SEEK_SET) != 0) {
-        wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-        return;
-    }
-    if (fwrite(&self->riff_chunk, sizeof(WavChunkHeader) + 4, 1, self->fp) != 1) {
-        wav_err_set(WAV_ERR_OS, "Error while writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
-        return;
-    }
+static WAV_CONST WavIO wav_stdio_io = {
+    &wav_stdio_read,
+    &wav_stdio_write,
+    &wav_stdio_seek,
+    &wav_stdio_tell,
+    &wav_stdio_flush,
+    &wav_stdio_sync,
+    NULL,
+    WAV_STDIO_PREAD,
+    NULL
+};
 
-    if (self->format_chunk.header.id == WAV_FORMAT_CHUNK_ID) {
-        if (fseek(self->fp, (long)(self->format_chunk.offset - sizeof(WavChunkHeader)), SEEK_SET) != 0) {
-            wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-            return;
-        }
-        if (fwrite(&self->format_chunk.header, sizeof(WavChunkHeader), 1, self->fp) != 1) {
-            wav_err_set(WAV_ERR_OS, "Error while writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
-            return;
-        }
-        if (fwrite(&self->format_chunk.body, self->format_chunk.header.size, 1, self->fp) != 1) {
-            wav_err_set(WAV_ERR_OS, "Error while writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
-            return;
-        }
-    }
+/* the FILE* opened by wav_open() belongs to the WavFile */
+static WAV_CONST WavIO wav_stdio_owned_io = {
+    &wav_stdio_read,
+    &wav_stdio_write,
+    &wav_stdio_seek,
+    &wav_stdio_tell,
+    &wav_stdio_flush,
+    &wav_stdio_sync,
+    NULL,
+    WAV_STDIO_PREAD,
+    &wav_stdio_close
+};
 
-    if (self->fact_chunk.header.id == WAV_FACT_CHUNK_ID) {
-        if (fseek(self->fp, (long)(self->fact_chunk.offset - sizeof(WavChunkHeader)), SEEK_SET) != 0) {
-            wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-            return;
-        }
-        if (fwrite(&self->fact_chunk.header, sizeof(WavChunkHeader), 1, self->fp) != 1) {
-            wav_err_set(WAV_ERR_OS, "Error while writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
-            return;
-        }
-        if (fwrite(&self->fact_chunk.body, self->fact_chunk.header.size, 1, self->fp) != 1) {
-            wav_err_set(WAV_ERR_OS, "Error while writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
-            return;
-        }
-    }
+WAV_CONST WavIO* wav_io_stdio(void)
+{
+    return &wav_stdio_io;
+}
 
-    if (self->data_chunk.header.id == WAV_DATA_CHUNK_ID) {
-        if (fseek(self->fp, (long)(self->data_chunk.offset - sizeof(WavChunkHeader)), SEEK_SET) != 0) {
-            wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-            return;
-        }
-        if (fwrite(&self->data_chunk.header, sizeof(WavChunkHeader), 1, self->fp) != 1) {
-            wav_err_set(WAV_ERR_OS, "Error while writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
-            return;
-        }
-    }
+/* memory backend, the context is a WavMemoryBuffer* */
+
+static WavI64 wav_memory_read(void *context, void *buffer, size_t size)
+{
+    WavMemoryBuffer *mem = context;
+    size_t           avail = mem->pos < mem->size ? mem->size - mem->pos : 0;
+    size_t           n = size < avail ? size : avail;
+
+    memcpy(buffer, (WAV_CONST WavU8*)mem->data + mem->pos, n);
+    mem->pos += n;
+    return (WavI64)n;
 }
 
-void wav_init(WavFile* self, WAV_CONST char* filename, WavU32 mode)
+static WavI64 wav_memory_write(void *context, WAV_CONST void *buffer, size_t size)
 {
-    memset(self, 0, sizeof(WavFile));
+    WavMemoryBuffer *mem = context;
+    size_t           end = mem->pos + size;
 
-    if (mode & WAV_OPEN_READ) {
-        if ((mode & WAV_OPEN_WRITE) || (mode & WAV_OPEN_APPEND)) {
-            self->fp = fopen(filename, "wb+");
-        } else {
-            self->fp = fopen(filename, "rb");
-        }
-    } else {
-        if ((mode & WAV_OPEN_WRITE) || (mode & WAV_OPEN_APPEND)) {
-            self->fp = fopen(filename, "wb+");
-        } else {
-            wav_err_set_literal(WAV_ERR_PARAM, "Invalid mode");
-            return;
+    if (end < mem->pos)
+        return -1;
+
+    if (end > mem->capacity) {
+        size_t capacity = mem->capacity > 4096 ? mem->capacity : 4096;
+        void  *data;
+
+        if (!mem->growable)
+            return -1;
+        while (capacity < end) {
+            capacity = capacity * 2 > capacity ? capacity * 2 : end;
         }
+        data = wav_realloc(mem->data, capacity);
+        if (data == NULL)
+            return -1;
+        mem->data = data;
+        mem->capacity = capacity;
     }
 
-    if (self->fp == NULL) {
-        wav_err_set(WAV_ERR_OS, "Error when opening %s [errno %d: %s]", filename, errno, strerror(errno));
-        return;
+    /* a seek beyond the end leaves a hole, which reads back as zeros */
+    if (mem->pos > mem->size) {
+        memset((WavU8*)mem->data + mem->size, 0, mem->pos - mem->size);
     }
 
-    self->filename = wav_strdup(filename);
-    self->mode = mode;
-
-    if (!(self->mode & WAV_OPEN_WRITE) && !(self->mode & WAV_OPEN_APPEND)) {
-        wav_parse_header(self);
-        return;
+    memcpy((WavU8*)mem->data + mem->pos, buffer, size);
+    mem->pos = end;
+    if (end > mem->size) {
+        mem->size = end;
     }
+    return (WavI64)size;
+}
 
-    if (self->mode & WAV_OPEN_APPEND) {
-        wav_parse_header(self);
-        if (g_err.code == WAV_OK) {
-            // If the header parsing was successful, return immediately.
-            return;
-        } else {
-            // Header parsing failed. Regard it as a new file.
-            wav_err_clear();
-            rewind(self->fp);
-            self->is_a_new_file = WAV_TRUE;
-        }
-    }
+static int wav_memory_seek(void *context, WavU64 offset)
+{
+    WavMemoryBuffer *mem = context;
 
-    // reaches here only if creating a new file
+    if (offset > (WavU64)(size_t)-1)
+        return -1;
+    mem->pos = (size_t)offset;
+    return 0;
+}
 
-    self->riff_chunk.id = WAV_RIFF_CHUNK_ID;
-    /* self->chunk.size = calculated by wav_write_header */
-    self->riff_chunk.wave_id = WAV_WAVE_ID;
-    self->riff_chunk.offset = sizeof(WavChunkHeader) + 4;
+static WavI64 wav_memory_tell(void *context)
+{
+    return (WavI64)((WavMemoryBuffer*)context)->pos;
+}
 
-    self->format_chunk.header.id                = WAV_FORMAT_CHUNK_ID;
-    self->format_chunk.header.size              = (WavU32)((WavUIntPtr)&self->format_chunk.body.ext_size - (WavUIntPtr)&self->format_chunk.body);
-    self->format_chunk.offset                   = self->riff_chunk.offset + sizeof(WavChunkHeader);
-    self->format_chunk.body.format_tag          = WAV_FORMAT_PCM;
-    self->format_chunk.body.num_channels        = 2;
-    self->format_chunk.body.sample_rate         = 44100;
-    self->format_chunk.body.avg_bytes_per_sec   = 44100 * 2 * 2;
-    self->format_chunk.body.block_align         = 4;
-    self->format_chunk.body.bits_per_sample     = 16;
+static int wav_memory_pwrite(void *context, WAV_CONST void *buffer, size_t size, WavU64 offset)
+{
+    WavMemoryBuffer *mem = context;
+    size_t           pos = mem->pos;
+    WavI64           n;
 
-    memcpy(self->format_chunk.body.sub_format, default_sub_format, 16);
+    if (wav_memory_seek(context, offset) != 0)
+        return -1;
+    n = wav_memory_write(context, buffer, size);
+    mem->pos = pos;
+    return n < 0 ? -1 : 0;
+}
 
-    self->data_chunk.header.id = WAV_DATA_CHUNK_ID;
-    self->data_chunk.offset = self->format_chunk.offset + self->format_chunk.header.size + sizeof(WavChunkHeader);
+static WavI64 wav_memory_pread(void *context, void *buffer, size_t size, WavU64 offset)
+{
+    WAV_CONST WavMemoryBuffer *mem = context;
+    size_t                     avail = offset < mem->size ? mem->size - (size_t)offset : 0;
+    size_t                     n = size < avail ? size : avail;
 
-    wav_write_header(self);
+    memcpy(buffer, (WAV_CONST WavU8*)mem->data + offset, n);
+    return (WavI64)n;
 }
 
-void wav_finalize(WavFile* self)
+static WAV_CONST WavIO wav_memory_io = {
+    &wav_memory_read,
+    &wav_memory_write,
+    &wav_memory_seek,
+    &wav_memory_tell,
+    NULL,
+    NULL,
+    &wav_memory_pwrite,
+    &wav_memory_pread,
+    NULL
+};
+
+WAV_CONST WavIO* wav_io_memory(void)
 {
-    int ret;
+    return &wav_memory_io;
+}
 
-    wav_free(self->filename);
+#if WAV_HAVE_POSIX
 
-    if (self->fp == NULL) {
-        return;
+static int wav_fd_pwrite_all(int fd, WAV_CONST void *data, size_t size, WavU64 offset)
+{
+    WAV_CONST WavU8 *p = data;
+
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        size -= (size_t)n;
+        offset += (WavU64)n;
     }
 
-    ret = fclose(self->fp);
-    if (ret != 0) {
-        fprintf(stderr, "[WARN] [libwav] fclose failed with code %d [errno %d: %s]", ret, errno, strerror(errno));
-        return;
+    return 0;
+}
+
+static int wav_fd_sync(int fd, WavBool data_only)
+{
+#if defined(__APPLE__)
+    (void)data_only;
+    return fsync(fd);
+#else
+    return data_only ? fdatasync(fd) : fsync(fd);
+#endif
+}
+
+static ssize_t wav_fd_pread_all(int fd, void *data, size_t size, WavU64 offset)
+{
+    WavU8 *p = data;
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t n = pread(fd, p + total, size - total, (off_t)(offset + total));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        total += (size_t)n;
     }
+
+    return (ssize_t)total;
 }
 
-WavFile* wav_open(WAV_CONST char* filename, WavU32 mode)
+/* raw file descriptor backend, the context is the descriptor cast to a pointer */
+
+#define WAV_CONTEXT_FD(context) ((int)(WavIntPtr)(context))
+
+static WavI64 wav_raw_fd_read(void *context, void *buffer, size_t size)
 {
-    WavFile* self = wav_malloc(sizeof(WavFile));
-    if (self == NULL) {
-        return NULL;
+    WavU8 *p = buffer;
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t n = read(WAV_CONTEXT_FD(context), p + total, size - total);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        total += (size_t)n;
     }
 
-    wav_init(self, filename, mode);
+    return (WavI64)total;
+}
 
-    return self;
+static WavI64 wav_raw_fd_write(void *context, WAV_CONST void *buffer, size_t size)
+{
+    WAV_CONST WavU8 *p = buffer;
+    size_t           total = 0;
+
+    while (total < size) {
+        ssize_t n = write(WAV_CONTEXT_FD(context), p + total, size - total);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        total += (size_t)n;
+    }
+
+    return (WavI64)total;
 }
 
-void wav_close(WavFile* self)
+static int wav_raw_fd_seek(void *context, WavU64 offset)
 {
-    wav_finalize(self);
-    wav_free(self);
+    return lseek(WAV_CONTEXT_FD(context), (off_t)offset, SEEK_SET) < 0 ? -1 : 0;
 }
 
-WavFile* wav_reopen(WavFile* self, WAV_CONST char* filename, WavU32 mode)
+static WavI64 wav_raw_fd_tell(void *context)
 {
-    wav_finalize(self);
-    wav_init(self, filename, mode);
-    return self;
+    return (WavI64)lseek(WAV_CONTEXT_FD(context), 0, SEEK_CUR);
 }
 
-size_t wav_read(WavFile* self, void *buffer, size_t count)
+static int wav_raw_fd_pwrite(void *context, WAV_CONST void *buffer, size_t size, WavU64 offset)
 {
-    size_t read_count;
-    WavU16 n_channels = wav_get_num_channels(self);
-    size_t sample_size = wav_get_sample_size(self);
-    size_t len_remain;
+    return wav_fd_pwrite_all(WAV_CONTEXT_FD(context), buffer, size, offset);
+}
 
-    if (!(self->mode & WAV_OPEN_READ)) {
-        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not readable");
-        return 0;
-    }
+static WavI64 wav_raw_fd_pread(void *context, void *buffer, size_t size, WavU64 offset)
+{
+    return (WavI64)wav_fd_pread_all(WAV_CONTEXT_FD(context), buffer, size, offset);
+}
 
-    if (self->format_chunk.body.format_tag == WAV_FORMAT_EXTENSIBLE) {
-        wav_err_set_literal(WAV_ERR_FORMAT, "Extensible format is not supported");
-        return 0;
+static int wav_raw_fd_sync(void *context, WavBool data_only)
+{
+    return wav_fd_sync(WAV_CONTEXT_FD(context), data_only);
+}
+
+static WAV_CONST WavIO wav_raw_fd_io = {
+    &wav_raw_fd_read,
+    &wav_raw_fd_write,
+    &wav_raw_fd_seek,
+    &wav_raw_fd_tell,
+    NULL,
+    &wav_raw_fd_sync,
+    &wav_raw_fd_pwrite,
+    &wav_raw_fd_pread,
+    NULL
+};
+
+/* buffered positional backend of WAV_OPEN_FD, WAV_OPEN_MMAP and
+ * WAV_OPEN_DIRECT, the context is the WavFile, which holds the descriptors and
+ * the buffer */
+
+/* direct I/O of WAV_OPEN_DIRECT. io_buffer always starts at a block boundary.
+ * Whole blocks go through direct_fd, while the partial blocks at the header
+ * and at the end of the written data go through fd. */
+
+/* Read whole blocks, stopping at the end of the file */
+static ssize_t wav_direct_pread(int fd, void *data, size_t size, WavU64 offset)
+{
+    WavU8 *p = data;
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t n = pread(fd, p + total, size - total, (off_t)(offset + total));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        total += (size_t)n;
+        if (n == 0 || total % WAV_DIRECT_ALIGN != 0)
+            break;
+    }
+
+    return (ssize_t)total;
+}
+
+static int wav_direct_flush(WavFile *self)
+{
+    size_t full = self->io_buffer_len & ~(WAV_DIRECT_ALIGN - 1);
+    size_t tail = self->io_buffer_len - full;
+
+    if (!self->io_buffer_dirty)
+        return 0;
+
+    if (full > 0 && wav_fd_pwrite_all(self->direct_fd, self->io_buffer, full, self->io_buffer_pos) != 0)
+        return -1;
+    if (tail > 0 && wav_fd_pwrite_all(self->fd, self->io_buffer + full, tail, self->io_buffer_pos + full) != 0)
+        return -1;
+
+    /* keep the partial block, it is written again once it is full */
+    memmove(self->io_buffer, self->io_buffer + full, tail);
+    self->io_buffer_pos += full;
+    self->io_buffer_len = tail;
+    self->io_buffer_dirty = WAV_FALSE;
+    return 0;
+}
+
+static WavI64 wav_direct_read(WavFile *self, void *buffer, size_t size)
+{
+    WavU8 *p = buffer;
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t n;
+
+        if (self->io_pos >= self->io_buffer_pos && self->io_pos < self->io_buffer_pos + self->io_buffer_len) {
+            size_t avail = (size_t)(self->io_buffer_pos + self->io_buffer_len - self->io_pos);
+            size_t len = size - total < avail ? size - total : avail;
+            memcpy(p + total, self->io_buffer + (self->io_pos - self->io_buffer_pos), len);
+            total += len;
+            self->io_pos += len;
+            continue;
+        }
+
+        if (wav_direct_flush(self) != 0)
+            return -1;
+
+        self->io_buffer_pos = self->io_pos & ~(WavU64)(WAV_DIRECT_ALIGN - 1);
+        n = wav_direct_pread(self->direct_fd, self->io_buffer, WAV_IO_BUFFER_SIZE, self->io_buffer_pos);
+        self->io_buffer_len = n > 0 ? (size_t)n : 0;
+        if (n < 0)
+            return -1;
+        if (self->io_pos >= self->io_buffer_pos + self->io_buffer_len)
+            break;
+    }
+
+    return (WavI64)total;
+}
+
+static WavI64 wav_direct_write(WavFile *self, WAV_CONST void *buffer, size_t size)
+{
+    WAV_CONST WavU8 *p = buffer;
+    size_t           total = 0;
+
+    while (total < size) {
+        size_t offset;
+        size_t len;
+
+        /* start a new block, with the bytes before the position read back */
+        if (self->io_pos < self->io_buffer_pos || self->io_pos > self->io_buffer_pos + self->io_buffer_len) {
+            WavU64  start = self->io_pos & ~(WavU64)(WAV_DIRECT_ALIGN - 1);
+            size_t  prefix = (size_t)(self->io_pos - start);
+            ssize_t n = 0;
+
+            if (wav_direct_flush(self) != 0)
+                return -1;
+            if (prefix > 0 && (n = wav_fd_pread_all(self->fd, self->io_buffer, prefix, start)) < 0)
+                return -1;
+            memset(self->io_buffer + n, 0, prefix - (size_t)n);
+            self->io_buffer_pos = start;
+            self->io_buffer_len = prefix;
+        }
+
+        offset = (size_t)(self->io_pos - self->io_buffer_pos);
+        if (offset == WAV_IO_BUFFER_SIZE) {
+            /* the block is full, write it out if dirty and go on with an empty one */
+            if (wav_direct_flush(self) != 0)
+                return -1;
+            self->io_buffer_pos = self->io_pos;
+            self->io_buffer_len = 0;
+            continue;
+        }
+
+        len = size - total < WAV_IO_BUFFER_SIZE - offset ? size - total : WAV_IO_BUFFER_SIZE - offset;
+        memcpy(self->io_buffer + offset, p + total, len);
+        total += len;
+        self->io_pos += len;
+        if (offset + len > self->io_buffer_len)
+            self->io_buffer_len = offset + len;
+        self->io_buffer_dirty = WAV_TRUE;
+    }
+
+    return (WavI64)total;
+}
+
+
+static int wav_fd_flush(void *context)
+{
+    WavFile *self = context;
+
+    if (self->direct_fd >= 0)
+        return wav_direct_flush(self);
+
+    if (!self->io_buffer_dirty)
+        return 0;
+
+    if (wav_fd_pwrite_all(self->fd, self->io_buffer, self->io_buffer_len, self->io_buffer_pos) != 0)
+        return -1;
+
+    self->io_buffer_dirty = WAV_FALSE;
+    return 0;
+}
+
+static WavI64 wav_fd_read(void *context, void *buffer, size_t size)
+{
+    WavFile *self = context;
+    WavU8   *p = buffer;
+    size_t   total = 0;
+
+    if (self->map != NULL) {
+        size_t avail = self->io_pos < self->map_size ? (size_t)(self->map_size - self->io_pos) : 0;
+        total = size < avail ? size : avail;
+        memcpy(buffer, self->map + self->io_pos, total);
+        self->io_pos += total;
+        return (WavI64)total;
+    }
+
+    if (self->direct_fd >= 0)
+        return wav_direct_read(self, buffer, size);
+
+    if (wav_fd_flush(self) != 0)
+        return -1;
+
+    while (total < size) {
+        ssize_t n;
+
+        if (self->io_pos >= self->io_buffer_pos && self->io_pos < self->io_buffer_pos + self->io_buffer_len) {
+            size_t avail = (size_t)(self->io_buffer_pos + self->io_buffer_len - self->io_pos);
+            size_t len = size - total < avail ? size - total : avail;
+            memcpy(p + total, self->io_buffer + (self->io_pos - self->io_buffer_pos), len);
+            total += len;
+            self->io_pos += len;
+            continue;
+        }
+
+        if (size - total >= WAV_IO_BUFFER_SIZE) {
+            n = wav_fd_pread_all(self->fd, p + total, size - total, self->io_pos);
+            if (n > 0) {
+                total += (size_t)n;
+                self->io_pos += (WavU64)n;
+            }
+        } else {
+            n = wav_fd_pread_all(self->fd, self->io_buffer, WAV_IO_BUFFER_SIZE, self->io_pos);
+            self->io_buffer_pos = self->io_pos;
+            self->io_buffer_len = n > 0 ? (size_t)n : 0;
+        }
+
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+    }
+
+    return (WavI64)total;
+}
+
+static WavI64 wav_fd_write(void *context, WAV_CONST void *buffer, size_t size)
+{
+    WavFile *self = context;
+
+    if (self->direct_fd >= 0)
+        return wav_direct_write(self, buffer, size);
+
+    if (!self->io_buffer_dirty || self->io_pos != self->io_buffer_pos + self->io_buffer_len) {
+        if (wav_fd_flush(self) != 0)
+            return -1;
+        self->io_buffer_pos = self->io_pos;
+        self->io_buffer_len = 0;
+    }
+
+    if (self->io_buffer_len + size > WAV_IO_BUFFER_SIZE) {
+        if (wav_fd_flush(self) != 0)
+            return -1;
+        self->io_buffer_pos = self->io_pos;
+        self->io_buffer_len = 0;
+
+        if (size >= WAV_IO_BUFFER_SIZE) {
+            if (wav_fd_pwrite_all(self->fd, buffer, size, self->io_pos) != 0)
+                return -1;
+            self->io_pos += size;
+            self->io_buffer_pos = self->io_pos;
+            return (WavI64)size;
+        }
+    }
+
+    memcpy(self->io_buffer + self->io_buffer_len, buffer, size);
+    self->io_buffer_len += size;
+    self->io_buffer_dirty = WAV_TRUE;
+    self->io_pos += size;
+    return (WavI64)size;
+}
+
+static int wav_fd_seek(void *context, WavU64 offset)
+{
+    WavFile *self = context;
+
+    if (wav_fd_flush(self) != 0)
+        return -1;
+    self->io_pos = offset;
+    return 0;
+}
+
+static WavI64 wav_fd_tell(void *context)
+{
+    return (WavI64)((WavFile*)context)->io_pos;
+}
+
+static int wav_fd_pwrite(void *context, WAV_CONST void *buffer, size_t size, WavU64 offset)
+{
+    WavFile *self = context;
+    WavU64   end = offset + size;
+    WavU64   buffer_end = self->io_buffer_pos + self->io_buffer_len;
+
+    /* keep the buffered copy consistent with what goes to the file */
+    if (offset < buffer_end && end > self->io_buffer_pos) {
+        WavU64 lo = offset > self->io_buffer_pos ? offset : self->io_buffer_pos;
+        WavU64 hi = end < buffer_end ? end : buffer_end;
+        memcpy(self->io_buffer + (lo - self->io_buffer_pos), (WAV_CONST WavU8*)buffer + (lo - offset), (size_t)(hi - lo));
+    }
+
+    return wav_fd_pwrite_all(self->fd, buffer, size, offset);
+}
+
+/* bypasses the buffer, so frames still buffered for writing are not seen */
+static WavI64 wav_fd_pread(void *context, void *buffer, size_t size, WavU64 offset)
+{
+    WAV_CONST WavFile *self = context;
+
+    if (self->map != NULL) {
+        size_t avail = offset < self->map_size ? (size_t)(self->map_size - offset) : 0;
+        size_t n = size < avail ? size : avail;
+        memcpy(buffer, self->map + offset, n);
+        return (WavI64)n;
+    }
+
+    return (WavI64)wav_fd_pread_all(self->fd, buffer, size, offset);
+}
+
+static int wav_fd_close(void *context)
+{
+    WavFile *self = context;
+    int      ret = wav_fd_flush(self);
+
+    if (self->map != NULL) {
+        munmap((void*)self->map, self->map_size);
+    }
+    if (self->direct_fd >= 0 && close(self->direct_fd) != 0) {
+        ret = -1;
+    }
+    if (close(self->fd) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+static int wav_fd_sync_buffered(void *context, WavBool data_only)
+{
+    WavFile *self = context;
+
+    if (wav_fd_flush(self) != 0)
+        return -1;
+    return wav_fd_sync(self->fd, data_only);
+}
+
+static WAV_CONST WavIO wav_fd_io = {
+    &wav_fd_read,
+    &wav_fd_write,
+    &wav_fd_seek,
+    &wav_fd_tell,
+    &wav_fd_flush,
+    &wav_fd_sync_buffered,
+    &wav_fd_pwrite,
+    &wav_fd_pread,
+    &wav_fd_close
+};
+
+#if WAV_HAVE_PWRITEV
+
+/* iovecs passed to one preadv() or pwritev() */
+#define WAV_IOV_BATCH   64
+
+/* Transfer {cnt} iovecs at {offset}, resuming after partial transfers. Returns
+ * the number of bytes transferred, less than requested only at the end of the
+ * file, or -1 on error. {iov} is modified. */
+static WavI64 wav_fd_transferv(int fd, struct iovec *iov, int cnt, WavU64 offset, WavBool is_write)
+{
+    WavU64 total = 0;
+
+    while (cnt > 0) {
+        ssize_t n = is_write ? pwritev(fd, iov, cnt, (off_t)(offset + total)) : preadv(fd, iov, cnt, (off_t)(offset + total));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        total += (WavU64)n;
+
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= (ssize_t)iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (WavU8*)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+
+    return (WavI64)total;
+}
+
+/* Read or write {size} bytes of {spans} at the current position, bypassing the
+ * buffer like large requests of wav_fd_read() and wav_fd_write() do */
+static WavI64 wav_fd_vectored(WavFile *self, WAV_CONST WavFrameSpan *spans, size_t n, size_t frame_size, WavU64 size, WavBool is_write)
+{
+    struct iovec iov[WAV_IOV_BATCH];
+    WavU64       total = 0;
+    size_t       i = 0;
+
+    if (wav_fd_flush(self) != 0)
+        return -1;
+
+    while (total < size) {
+        WavU64 batch = 0;
+        int    cnt = 0;
+        WavI64 done;
+
+        for (; i < n && cnt < WAV_IOV_BATCH && total + batch < size; ++i) {
+            WavU64 len = (WavU64)spans[i].count * frame_size;
+            if (len > size - total - batch)
+                len = size - total - batch;
+            if (len == 0)
+                continue;
+            iov[cnt].iov_base = spans[i].data;
+            iov[cnt++].iov_len = (size_t)len;
+            batch += len;
+        }
+
+        done = wav_fd_transferv(self->fd, iov, cnt, self->io_pos, is_write);
+        if (done < 0)
+            return -1;
+        self->io_pos += (WavU64)done;
+        total += (WavU64)done;
+        if ((WavU64)done < batch)
+            break;
+    }
+
+    if (is_write) {
+        self->io_buffer_pos = self->io_pos;
+        self->io_buffer_len = 0;
+    }
+
+    return (WavI64)total;
+}
+
+#endif
+
+#endif
+
+WAV_CONST WavIO* wav_io_fd(void)
+{
+#if WAV_HAVE_POSIX
+    return &wav_raw_fd_io;
+#else
+    return NULL;
+#endif
+}
+
+static size_t wav_io_read(WavFile* self, void *buffer, size_t size)
+{
+    WavI64 n = self->io.read(self->io_context, buffer, size);
+
+    if (n < 0) {
+        self->io_error = WAV_TRUE;
+        return 0;
+    }
+    if ((size_t)n < size) {
+        self->io_eof = WAV_TRUE;
+    }
+    return (size_t)n;
+}
+
+static size_t wav_io_write(WavFile* self, WAV_CONST void *buffer, size_t size)
+{
+    WavI64 n = self->io.write(self->io_context, buffer, size);
+
+    if (n < 0) {
+        self->io_error = WAV_TRUE;
+        return 0;
+    }
+    return (size_t)n;
+}
+
+/* Read or write up to {size} bytes of {spans} at the current position. Large
+ * transfers of the fd backend take one system call for all spans. */
+static WavU64 wav_io_vectored(WavFile* self, WAV_CONST WavFrameSpan *spans, size_t n, size_t frame_size, WavU64 size, WavBool is_write)
+{
+    WavU64 total = 0;
+
+#if WAV_HAVE_PWRITEV
+    if (self->io.read == &wav_fd_read && self->map == NULL && self->direct_fd < 0 && size >= WAV_IO_BUFFER_SIZE) {
+        WavI64 done = wav_fd_vectored(self, spans, n, frame_size, size, is_write);
+        if (done < 0) {
+            self->io_error = WAV_TRUE;
+            return 0;
+        }
+        if (!is_write && (WavU64)done < size) {
+            self->io_eof = WAV_TRUE;
+        }
+        return (WavU64)done;
+    }
+#endif
+
+    for (size_t i = 0; i < n && total < size; ++i) {
+        size_t len = spans[i].count * frame_size;
+        size_t done;
+
+        if (len > size - total)
+            len = (size_t)(size - total);
+        done = is_write ? wav_io_write(self, spans[i].data, len) : wav_io_read(self, spans[i].data, len);
+        total += done;
+        if (done < len)
+            break;
+    }
+
+    return total;
+}
+
+static int wav_io_error(WAV_CONST WavFile* self)
+{
+    return self->io_error;
+}
+
+static int wav_io_eof(WAV_CONST WavFile* self)
+{
+    return self->io_eof;
+}
+
+static WavI64 wav_io_tell(WAV_CONST WavFile* self)
+{
+    return self->io.tell(self->io_context);
+}
+
+static int wav_io_seek(WavFile* self, WavU64 offset)
+{
+    if (self->io.seek(self->io_context, offset) != 0)
+        return -1;
+    self->io_eof = WAV_FALSE;
+    return 0;
+}
+
+static int wav_io_flush(WavFile* self)
+{
+    if (self->io.flush == NULL)
+        return 0;
+    return self->io.flush(self->io_context);
+}
+
+static int wav_io_sync(WavFile* self)
+{
+    if (self->io.sync == NULL)
+        return 0;
+    return self->io.sync(self->io_context, self->durability_data_only);
+}
+
+/* Write {patches} at their offsets and stay at the current position. Backends
+ * with a pwrite callback never move the stream position. */
+static int wav_io_patch(WavFile* self, WAV_CONST WavPatch *patches, size_t n)
+{
+    WavI64 save_pos;
+
+    if (self->io.pwrite != NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            if (self->io.pwrite(self->io_context, patches[i].data, patches[i].size, patches[i].offset) != 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    save_pos = wav_io_tell(self);
+    if (save_pos < 0)
+        return -1;
+    for (size_t i = 0; i < n; ++i) {
+        if (self->io.seek(self->io_context, patches[i].offset) != 0)
+            return -1;
+        if (self->io.write(self->io_context, patches[i].data, patches[i].size) != (WavI64)patches[i].size)
+            return -1;
+    }
+    return self->io.seek(self->io_context, (WavU64)save_pos);
+}
+
+void wav_parse_header(WavFile* self)
+{
+    size_t read_count;
+
+    read_count = wav_io_read(self, &self->riff_chunk, sizeof(WavChunkHeader));
+    if (read_count != sizeof(WavChunkHeader)) {
+        wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
+        return;
+    }
+
+    if (self->riff_chunk.id != WAV_RIFF_CHUNK_ID &&
+        self->riff_chunk.id != WAV_RF64_CHUNK_ID &&
+        self->riff_chunk.id != WAV_BW64_CHUNK_ID)
+    {
+        wav_err_set_literal(WAV_ERR_FORMAT, "Not a RIFF file");
+        return;
+    }
+
+    read_count = wav_io_read(self, &self->riff_chunk.wave_id, 4);
+    if (read_count != 4) {
+        wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
+        return;
+    }
+    if (self->riff_chunk.wave_id != WAV_WAVE_ID) {
+        wav_err_set_literal(WAV_ERR_FORMAT, "Not a WAVE file");
+        return;
+    }
+
+    self->riff_chunk.offset = (WavU64)wav_io_tell(self);
+
+    while (self->data_chunk.header.id != WAV_DATA_CHUNK_ID) {
+        WavChunkHeader header;
+
+        read_count = wav_io_read(self, &header, sizeof(WavChunkHeader));
+        if (read_count != sizeof(WavChunkHeader)) {
+            wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
+            return;
+        }
+
+        switch (header.id) {
+            case WAV_DS64_CHUNK_ID:
+                if (header.size < WAV_DS64_BODY_SIZE - 4) {
+                    wav_err_set(WAV_ERR_FORMAT, "Invalid ds64 chunk size: %u", header.size);
+                    return;
+                }
+                self->ds64_chunk.header = header;
+                self->ds64_chunk.offset = (WavU64)wav_io_tell(self);
+                read_count = wav_io_read(self, &self->ds64_chunk.body, header.size < WAV_DS64_BODY_SIZE ? header.size : WAV_DS64_BODY_SIZE);
+                if (read_count < WAV_DS64_BODY_SIZE - 4) {
+                    wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
+                    return;
+                }
+                /* skip the table of other chunk sizes, which is not used */
+                if (wav_io_seek(self, self->ds64_chunk.offset + header.size) < 0) {
+                    wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
+                    return;
+                }
+                break;
+            case WAV_JUNK_CHUNK_ID:
+                /* a JUNK chunk right after the RIFF header is room for a ds64 chunk */
+                if (self->riff_chunk.id == WAV_RIFF_CHUNK_ID &&
+                    header.size >= WAV_DS64_BODY_SIZE &&
+                    (WavU64)wav_io_tell(self) == self->riff_chunk.offset + sizeof(WavChunkHeader))
+                {
+                    self->ds64_chunk.header = header;
+                    self->ds64_chunk.offset = (WavU64)wav_io_tell(self);
+                }
+                if (wav_io_seek(self, (WavU64)wav_io_tell(self) + header.size) < 0) {
+                    wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
+                    return;
+                }
+                break;
+            case WAV_FORMAT_CHUNK_ID:
+                self->format_chunk.header = header;
+                self->format_chunk.offset = (WavU64)wav_io_tell(self);
+                read_count = wav_io_read(self, &self->format_chunk.body, header.size < sizeof(self->format_chunk.body) ? header.size : sizeof(self->format_chunk.body));
+                if (read_count != (header.size < sizeof(self->format_chunk.body) ? header.size : sizeof(self->format_chunk.body))) {
+                    wav_err_set_literal(WAV_ERR_FORMAT, "Unexpected EOF");
+                    return;
+                }
+                if (header.size > sizeof(self->format_chunk.body) && wav_io_seek(self, self->format_chunk.offset + header.size) < 0) {
+                    wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
+                    return;
+                }
+                /* extensible files can be accessed with wav_read_raw() and wav_write_raw() */
+                if (self->format_chunk.body.format_tag != WAV_FORMAT_PCM &&
+                    self->format_chunk.body.format_tag != WAV_FORMAT_IEEE_FLOAT &&
+                    self->format_chunk.body.format_tag != WAV_FORMAT_ALAW &&
+                    self->format_chunk.body.format_tag != WAV_FORMAT_MULAW &&
+                    self->format_chunk.body.format_tag != WAV_FORMAT_EXTENSIBLE)
+                {
+                    wav_err_set(WAV_ERR_FORMAT, "Unsupported format tag: %#010x", self->format_chunk.body.format_tag);
+                    return;
+                }
+                break;
+            case WAV_FACT_CHUNK_ID:
+                self->fact_chunk.header = header;
+                self->fact_chunk.offset = (WavU64)wav_io_tell(self);
+                read_count = wav_io_read(self, &self->fact_chunk.body, header.size);
+                if (read_count != header.size) {
+                    wav_err_set(WAV_ERR_FORMAT, "Unexpected EOF");
+                }
+                break;
+            case WAV_DATA_CHUNK_ID:
+                self->data_chunk.header = header;
+                self->data_chunk.offset = (WavU64)wav_io_tell(self);
+                break;
+            default:
+                if (wav_io_seek(self, (WavU64)wav_io_tell(self) + header.size) < 0) {
+                    wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
+                    return;
+                }
+                break;
+        }
+    }
+
+    if (self->riff_chunk.id != WAV_RIFF_CHUNK_ID && self->ds64_chunk.header.id != WAV_DS64_CHUNK_ID) {
+        wav_err_set_literal(WAV_ERR_FORMAT, "RF64 file without a ds64 chunk");
+        return;
+    }
+
+    /* from here on the 64-bit sizes are the ones in use */
+    if (self->riff_chunk.size != WAV_SIZE_IN_DS64 || self->riff_chunk.id == WAV_RIFF_CHUNK_ID) {
+        self->ds64_chunk.body.riff_size = self->riff_chunk.size;
+    }
+    if (self->data_chunk.header.size != WAV_SIZE_IN_DS64 || self->riff_chunk.id == WAV_RIFF_CHUNK_ID) {
+        self->ds64_chunk.body.data_size = self->data_chunk.header.size;
+    }
+    if (self->fact_chunk.header.id == WAV_FACT_CHUNK_ID &&
+        (self->fact_chunk.body.sample_length != WAV_SIZE_IN_DS64 || self->riff_chunk.id == WAV_RIFF_CHUNK_ID))
+    {
+        self->ds64_chunk.body.sample_count = self->fact_chunk.body.sample_length;
+    } else if (self->fact_chunk.header.id != WAV_FACT_CHUNK_ID && self->format_chunk.body.block_align != 0) {
+        self->ds64_chunk.body.sample_count = self->ds64_chunk.body.data_size / self->format_chunk.body.block_align;
+    }
+}
+
+/* Derive the 32-bit sizes in the RIFF, fact and data chunks from the 64-bit ones */
+static void wav_sync_sizes(WavFile* self)
+{
+    if (self->riff_chunk.id == WAV_RIFF_CHUNK_ID) {
+        self->riff_chunk.size = (WavU32)self->ds64_chunk.body.riff_size;
+        self->data_chunk.header.size = (WavU32)self->ds64_chunk.body.data_size;
+        self->fact_chunk.body.sample_length = (WavU32)self->ds64_chunk.body.sample_count;
+    } else {
+        self->riff_chunk.size = WAV_SIZE_IN_DS64;
+        self->data_chunk.header.size = WAV_SIZE_IN_DS64;
+        self->fact_chunk.body.sample_length = WAV_SIZE_IN_DS64;
+    }
+}
+
+/* Promote the file to RF64 if {bytes} more bytes of data would not fit in the 32-bit sizes */
+static WavBool wav_make_room(WavFile* self, WavU64 bytes)
+{
+    if (self->riff_chunk.id == WAV_RIFF_CHUNK_ID && self->ds64_chunk.body.riff_size + bytes >= WAV_SIZE_IN_DS64) {
+        if (self->ds64_chunk.offset == 0) {
+            wav_err_set(WAV_ERR_FORMAT, "%s would exceed 4 GiB but has no room for a ds64 chunk", self->filename);
+            return WAV_FALSE;
+        }
+        self->riff_chunk.id = WAV_RF64_CHUNK_ID;
+        self->ds64_chunk.header.id = WAV_DS64_CHUNK_ID;
+    }
+    return WAV_TRUE;
+}
+
+/* bytes read at once by wav_probe(), enough for the header of almost any file */
+#define WAV_PROBE_SIZE  ((size_t)4096)
+
+typedef struct {
+    WavU8   buffer[WAV_PROBE_SIZE];
+    size_t  len;                /* bytes at the beginning of the file in buffer */
+#if WAV_HAVE_POSIX
+    int     fd;
+#else
+    FILE*   fp;
+#endif
+} WavProbe;
+
+/* Copy up to {size} bytes at {offset} of the file, from the buffer if they are
+ * in it and with a targeted read otherwise. Returns the number of bytes copied,
+ * or -1 on error. */
+static WavI64 wav_probe_fetch(WavProbe* probe, WavU64 offset, void* dst, size_t size)
+{
+    if (offset + size <= probe->len) {
+        memcpy(dst, probe->buffer + offset, size);
+        return (WavI64)size;
+    }
+
+    /* the whole file is in the buffer */
+    if (probe->len < WAV_PROBE_SIZE) {
+        size_t n = offset < probe->len ? probe->len - (size_t)offset : 0;
+        memcpy(dst, probe->buffer + (offset < probe->len ? offset : 0), n);
+        return (WavI64)n;
+    }
+
+#if WAV_HAVE_POSIX
+    return (WavI64)wav_fd_pread_all(probe->fd, dst, size, offset);
+#else
+    if (WAV_FSEEK(probe->fp, (WavI64)offset, SEEK_SET) != 0)
+        return -1;
+    return (WavI64)fread(dst, 1, size, probe->fp);
+#endif
+}
+
+static int wav_probe_parse(WavProbe* probe, WAV_CONST char* filename, WavInfo* info)
+{
+    WavMasterChunk riff;
+    WavDs64Chunk   ds64;
+    WavFormatChunk format;
+    WavFactChunk   fact;
+    WavU64         offset;
+    WavU64         data_size;
+
+    memset(&ds64, 0, sizeof(ds64));
+    memset(&format, 0, sizeof(format));
+    memset(&fact, 0, sizeof(fact));
+
+    if (wav_probe_fetch(probe, 0, &riff, sizeof(WavChunkHeader) + 4) != (WavI64)(sizeof(WavChunkHeader) + 4)) {
+        wav_err_set(WAV_ERR_FORMAT, "%s: Unexpected EOF", filename);
+        return (int)g_err.code;
+    }
+    if (riff.id != WAV_RIFF_CHUNK_ID && riff.id != WAV_RF64_CHUNK_ID && riff.id != WAV_BW64_CHUNK_ID) {
+        wav_err_set(WAV_ERR_FORMAT, "%s: Not a RIFF file", filename);
+        return (int)g_err.code;
+    }
+    if (riff.wave_id != WAV_WAVE_ID) {
+        wav_err_set(WAV_ERR_FORMAT, "%s: Not a WAVE file", filename);
+        return (int)g_err.code;
+    }
+
+    info->num_chunks = 0;
+    offset = sizeof(WavChunkHeader) + 4;
+    for (;;) {
+        WavChunkHeader header;
+        WavU64         body;
+        size_t         size;
+        WavI64         n;
+
+        if (wav_probe_fetch(probe, offset, &header, sizeof(WavChunkHeader)) != (WavI64)sizeof(WavChunkHeader)) {
+            wav_err_set(WAV_ERR_FORMAT, "%s: Unexpected EOF", filename);
+            return (int)g_err.code;
+        }
+        body = offset + sizeof(WavChunkHeader);
+
+        if (info->num_chunks < WAV_INFO_MAX_CHUNKS) {
+            memcpy(info->chunks[info->num_chunks].id, &header.id, 4);
+            info->chunks[info->num_chunks].offset = offset;
+            info->chunks[info->num_chunks].size = header.size;
+            info->num_chunks++;
+        }
+
+        if (header.id == WAV_DATA_CHUNK_ID) {
+            data_size = header.size;
+            info->data_offset = body;
+            break;
+        }
+
+        switch (header.id) {
+            case WAV_DS64_CHUNK_ID:
+                size = header.size < WAV_DS64_BODY_SIZE ? header.size : WAV_DS64_BODY_SIZE;
+                n = wav_probe_fetch(probe, body, &ds64.body, size);
+                if (header.size < WAV_DS64_BODY_SIZE - 4 || n < (WavI64)(WAV_DS64_BODY_SIZE - 4)) {
+                    wav_err_set(WAV_ERR_FORMAT, "%s: Invalid ds64 chunk", filename);
+                    return (int)g_err.code;
+                }
+                ds64.header = header;
+                break;
+            case WAV_FORMAT_CHUNK_ID:
+                size = header.size < sizeof(format.body) ? header.size : sizeof(format.body);
+                if (wav_probe_fetch(probe, body, &format.body, size) != (WavI64)size) {
+                    wav_err_set(WAV_ERR_FORMAT, "%s: Unexpected EOF", filename);
+                    return (int)g_err.code;
+                }
+                format.header = header;
+                break;
+            case WAV_FACT_CHUNK_ID:
+                if (header.size >= 4 && wav_probe_fetch(probe, body, &fact.body, 4) == 4) {
+                    fact.header = header;
+                }
+                break;
+            default:
+                break;
+        }
+
+        /* chunks are padded to an even size */
+        offset = body + header.size + (header.size & 1);
+    }
+
+    if (format.header.id != WAV_FORMAT_CHUNK_ID || format.body.num_channels == 0 || format.body.block_align == 0) {
+        wav_err_set(WAV_ERR_FORMAT, "%s: Missing or invalid format chunk", filename);
+        return (int)g_err.code;
+    }
+
+    info->rf64 = riff.id != WAV_RIFF_CHUNK_ID;
+    if (info->rf64) {
+        if (ds64.header.id != WAV_DS64_CHUNK_ID) {
+            wav_err_set(WAV_ERR_FORMAT, "%s: RF64 file without a ds64 chunk", filename);
+            return (int)g_err.code;
+        }
+        if (data_size == WAV_SIZE_IN_DS64) {
+            data_size = ds64.body.data_size;
+            if (info->num_chunks > 0 && info->chunks[info->num_chunks - 1].offset + sizeof(WavChunkHeader) == info->data_offset) {
+                info->chunks[info->num_chunks - 1].size = data_size;
+            }
+        }
+    }
+
+    info->format = format.body.format_tag;
+    info->num_channels = format.body.num_channels;
+    info->sample_rate = format.body.sample_rate;
+    info->sample_size = format.body.block_align / format.body.num_channels;
+    info->length = data_size / format.body.block_align;
+    if (format.body.format_tag == WAV_FORMAT_EXTENSIBLE && format.header.size >= sizeof(format.body)) {
+        info->valid_bits_per_sample = format.body.valid_bits_per_sample;
+        info->channel_mask = format.body.channel_mask;
+        info->sub_format = (WavU16)(format.body.sub_format[0] | (format.body.sub_format[1] << 8));
+    } else {
+        info->valid_bits_per_sample = format.body.bits_per_sample;
+        info->channel_mask = 0;
+        info->sub_format = 0;
+    }
+
+    return 0;
+}
+
+static void wav_probe_close(WavProbe* probe)
+{
+#if WAV_HAVE_POSIX
+    close(probe->fd);
+#else
+    fclose(probe->fp);
+#endif
+}
+
+/* Open {filename} and parse its header from the first read */
+static int wav_probe_open(WavProbe* probe, WAV_CONST char* filename, WavInfo* info)
+{
+    WavI64 n;
+    int    ret;
+
+#if WAV_HAVE_POSIX
+    probe->fd = open(filename, O_RDONLY);
+    if (probe->fd < 0) {
+        wav_err_set(WAV_ERR_OS, "Error when opening %s [errno %d: %s]", filename, errno, strerror(errno));
+        return (int)g_err.code;
+    }
+    n = (WavI64)wav_fd_pread_all(probe->fd, probe->buffer, WAV_PROBE_SIZE, 0);
+#else
+    probe->fp = fopen(filename, "rb");
+    if (probe->fp == NULL) {
+        wav_err_set(WAV_ERR_OS, "Error when opening %s [errno %d: %s]", filename, errno, strerror(errno));
+        return (int)g_err.code;
+    }
+    n = (WavI64)fread(probe->buffer, 1, WAV_PROBE_SIZE, probe->fp);
+    if (ferror(probe->fp))
+        n = -1;
+#endif
+
+    if (n < 0) {
+        wav_err_set(WAV_ERR_OS, "Error when reading %s [errno %d: %s]", filename, errno, strerror(errno));
+        ret = (int)g_err.code;
+    } else {
+        probe->len = (size_t)n;
+        ret = wav_probe_parse(probe, filename, info);
+    }
+
+    if (ret != 0) {
+        wav_probe_close(probe);
+    }
+    return ret;
+}
+
+int wav_probe(WAV_CONST char* filename, WavInfo* info)
+{
+    WavProbe probe;
+    int      ret = wav_probe_open(&probe, filename, info);
+
+    if (ret == 0) {
+        wav_probe_close(&probe);
+    }
+    return ret;
+}
+
+int wav_load(WAV_CONST char* filename, WavInfo* info, void** data)
+{
+    WavProbe probe;
+    WavU64   size;
+    WavI64   n;
+    int      ret;
+
+    *data = NULL;
+
+    ret = wav_probe_open(&probe, filename, info);
+    if (ret != 0) {
+        return ret;
+    }
+
+    size = info->length * (info->sample_size * info->num_channels);
+
+#if WAV_HAVE_POSIX
+    {
+        /* check the size before allocating, the header of a truncated file overstates it */
+        struct stat st;
+        if (fstat(probe.fd, &st) != 0) {
+            wav_err_set(WAV_ERR_OS, "Error when reading %s [errno %d: %s]", filename, errno, strerror(errno));
+            goto done;
+        }
+        if (info->data_offset + size > (WavU64)st.st_size) {
+            wav_err_set(WAV_ERR_FORMAT, "%s: Unexpected EOF", filename);
+            goto done;
+        }
+    }
+#endif
+
+    if (size > (WavU64)(size_t)-1) {
+        wav_err_set(WAV_ERR_PARAM, "%s is too large to be loaded", filename);
+        goto done;
+    }
+    if (size == 0) {
+        goto done;
+    }
+
+    *data = wav_malloc((size_t)size);
+    if (*data == NULL) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the samples");
+        goto done;
+    }
+
+    /* served from the first read when the file is small */
+    n = wav_probe_fetch(&probe, info->data_offset, *data, (size_t)size);
+    if (n < 0) {
+        wav_err_set(WAV_ERR_OS, "Error when reading %s [errno %d: %s]", filename, errno, strerror(errno));
+    } else if (n != (WavI64)size) {
+        wav_err_set(WAV_ERR_FORMAT, "%s: Unexpected EOF", filename);
+    }
+
+done:
+    wav_probe_close(&probe);
+    if (g_err.code != WAV_OK) {
+        wav_free(*data);
+        *data = NULL;
+    }
+    return (int)g_err.code;
+}
+
+int wav_save(WAV_CONST char* filename, WAV_CONST WavInfo* info, WAV_CONST void* data)
+{
+    WavMasterChunk riff;
+    WavDs64Chunk   ds64;
+    WavFormatChunk format;
+    WavChunkHeader data_header;
+    WavU8          header[sizeof(WavChunkHeader) + 4 + sizeof(WavChunkHeader) + WAV_DS64_BODY_SIZE + sizeof(WavChunkHeader) + sizeof(format.body) + sizeof(WavChunkHeader)];
+    size_t         header_size = 0;
+    WavU8          pad = 0;
+    WavU64         size;
+    size_t         block_align = info->sample_size * info->num_channels;
+
+    if (info->num_channels == 0 || info->sample_size == 0 || block_align > 0xffff) {
+        wav_err_set(WAV_ERR_PARAM, "Invalid format: %u channels of %zu-byte samples", info->num_channels, info->sample_size);
+        return (int)g_err.code;
+    }
+    size = info->length * block_align;
+
+    memset(&format, 0, sizeof(format));
+    format.header.id = WAV_FORMAT_CHUNK_ID;
+    format.body.format_tag = info->format;
+    format.body.num_channels = info->num_channels;
+    format.body.sample_rate = info->sample_rate;
+    format.body.avg_bytes_per_sec = (WavU32)(block_align * info->sample_rate);
+    format.body.block_align = (WavU16)block_align;
+    if (info->format == WAV_FORMAT_EXTENSIBLE) {
+        format.header.size = sizeof(format.body);
+        format.body.bits_per_sample = (WavU16)(info->sample_size * 8);
+        format.body.ext_size = 22;
+        format.body.valid_bits_per_sample = info->valid_bits_per_sample != 0 ? info->valid_bits_per_sample : format.body.bits_per_sample;
+        format.body.channel_mask = info->channel_mask;
+        memcpy(format.body.sub_format, default_sub_format, 16);
+        format.body.sub_format[0] = (WavU8)(info->sub_format & 0xff);
+        format.body.sub_format[1] = (WavU8)(info->sub_format >> 8);
+    } else {
+        format.header.size = (WavU32)((WavUIntPtr)&format.body.ext_size - (WavUIntPtr)&format.body);
+        format.body.bits_per_sample = info->valid_bits_per_sample != 0 ? info->valid_bits_per_sample : (WavU16)(info->sample_size * 8);
+    }
+
+    /* the same layout as wav_open() creates, so the file can be appended to */
+    memset(&ds64, 0, sizeof(ds64));
+    ds64.header.size = WAV_DS64_BODY_SIZE;
+    ds64.body.riff_size = 4 + (sizeof(WavChunkHeader) + WAV_DS64_BODY_SIZE) + (sizeof(WavChunkHeader) + format.header.size) +
+                          sizeof(WavChunkHeader) + size + (size & 1);
+    ds64.body.data_size = size;
+    ds64.body.sample_count = info->length;
+    riff.wave_id = WAV_WAVE_ID;
+    data_header.id = WAV_DATA_CHUNK_ID;
+    if (ds64.body.riff_size < WAV_SIZE_IN_DS64) {
+        riff.id = WAV_RIFF_CHUNK_ID;
+        riff.size = (WavU32)ds64.body.riff_size;
+        ds64.header.id = WAV_JUNK_CHUNK_ID;
+        data_header.size = (WavU32)size;
+    } else {
+        riff.id = WAV_RF64_CHUNK_ID;
+        riff.size = WAV_SIZE_IN_DS64;
+        ds64.header.id = WAV_DS64_CHUNK_ID;
+        data_header.size = WAV_SIZE_IN_DS64;
+    }
+
+    memcpy(header, &riff, sizeof(WavChunkHeader) + 4);
+    header_size += sizeof(WavChunkHeader) + 4;
+    memcpy(header + header_size, &ds64.header, sizeof(WavChunkHeader));
+    header_size += sizeof(WavChunkHeader);
+    memcpy(header + header_size, ds64.header.id == WAV_DS64_CHUNK_ID ? (WAV_CONST void*)&ds64.body : junk_body, WAV_DS64_BODY_SIZE);
+    header_size += WAV_DS64_BODY_SIZE;
+    memcpy(header + header_size, &format.header, sizeof(WavChunkHeader));
+    header_size += sizeof(WavChunkHeader);
+    memcpy(header + header_size, &format.body, format.header.size);
+    header_size += format.header.size;
+    memcpy(header + header_size, &data_header, sizeof(WavChunkHeader));
+    header_size += sizeof(WavChunkHeader);
+
+    if (size > (WavU64)(size_t)-1) {
+        wav_err_set(WAV_ERR_PARAM, "%s would be too large to be saved", filename);
+        return (int)g_err.code;
+    }
+
+#if WAV_HAVE_POSIX
+    {
+        int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        int failed;
+
+        if (fd < 0) {
+            wav_err_set(WAV_ERR_OS, "Error when opening %s [errno %d: %s]", filename, errno, strerror(errno));
+            return (int)g_err.code;
+        }
+#if WAV_HAVE_PWRITEV
+        {
+            struct iovec iov[3];
+            iov[0].iov_base = header;
+            iov[0].iov_len = header_size;
+            iov[1].iov_base = (void*)data;
+            iov[1].iov_len = (size_t)size;
+            iov[2].iov_base = &pad;
+            iov[2].iov_len = (size_t)(size & 1);
+            failed = wav_fd_transferv(fd, iov, 3, 0, WAV_TRUE) < 0;
+        }
+#else
+        failed = wav_fd_pwrite_all(fd, header, header_size, 0) != 0 ||
+                 wav_fd_pwrite_all(fd, data, (size_t)size, header_size) != 0 ||
+                 wav_fd_pwrite_all(fd, &pad, (size_t)(size & 1), header_size + size) != 0;
+#endif
+        if (failed) {
+            wav_err_set(WAV_ERR_OS, "Error when writing %s [errno %d: %s]", filename, errno, strerror(errno));
+        }
+        if (close(fd) != 0 && !failed) {
+            wav_err_set(WAV_ERR_OS, "Error when closing %s [errno %d: %s]", filename, errno, strerror(errno));
+        }
+    }
+#else
+    {
+        FILE* fp = fopen(filename, "wb");
+
+        if (fp == NULL) {
+            wav_err_set(WAV_ERR_OS, "Error when opening %s [errno %d: %s]", filename, errno, strerror(errno));
+            return (int)g_err.code;
+        }
+        if (fwrite(header, 1, header_size, fp) != header_size ||
+            fwrite(data, 1, (size_t)size, fp) != (size_t)size ||
+            fwrite(&pad, 1, (size_t)(size & 1), fp) != (size_t)(size & 1)) {
+            wav_err_set(WAV_ERR_OS, "Error when writing %s [errno %d: %s]", filename, errno, strerror(errno));
+        }
+        if (fclose(fp) != 0 && g_err.code == WAV_OK) {
+            wav_err_set(WAV_ERR_OS, "Error when closing %s [errno %d: %s]", filename, errno, strerror(errno));
+        }
+    }
+#endif
+
+    if (g_err.code != WAV_OK) {
+        remove(filename);
+    }
+    return (int)g_err.code;
+}
+
+void wav_write_header(WavFile* self)
+{
+    WavPatch patches[8];
+    size_t   n = 0;
+
+    self->ds64_chunk.body.riff_size =
+        sizeof(self->riff_chunk.wave_id) +
+        (self->ds64_chunk.offset != 0 ? (sizeof(WavChunkHeader) + self->ds64_chunk.header.size) : 0) +
+        (self->format_chunk.header.id == WAV_FORMAT_CHUNK_ID ? (sizeof(WavChunkHeader) + self->format_chunk.header.size) : 0) +
+        (self->fact_chunk.header.id == WAV_FACT_CHUNK_ID ? (sizeof(WavChunkHeader) + self->fact_chunk.header.size) : 0) +
+        (self->data_chunk.header.id == WAV_DATA_CHUNK_ID ? (sizeof(WavChunkHeader) + self->ds64_chunk.body.data_size) : 0);
+    wav_sync_sizes(self);
+
+    patches[n].offset = 0;
+    patches[n].data = &self->riff_chunk;
+    patches[n++].size = sizeof(WavChunkHeader) + 4;
+
+    if (self->ds64_chunk.offset != 0) {
+        patches[n].offset = self->ds64_chunk.offset - sizeof(WavChunkHeader);
+        patches[n].data = &self->ds64_chunk.header;
+        patches[n++].size = sizeof(WavChunkHeader);
+        patches[n].offset = self->ds64_chunk.offset;
+        patches[n].data = self->ds64_chunk.header.id == WAV_DS64_CHUNK_ID ? (WAV_CONST void*)&self->ds64_chunk.body : junk_body;
+        patches[n++].size = WAV_DS64_BODY_SIZE;
+    }
+
+    if (self->format_chunk.header.id == WAV_FORMAT_CHUNK_ID) {
+        patches[n].offset = self->format_chunk.offset - sizeof(WavChunkHeader);
+        patches[n].data = &self->format_chunk.header;
+        patches[n++].size = sizeof(WavChunkHeader);
+        patches[n].offset = self->format_chunk.offset;
+        patches[n].data = &self->format_chunk.body;
+        patches[n++].size = self->format_chunk.header.size;
+    }
+
+    if (self->fact_chunk.header.id == WAV_FACT_CHUNK_ID) {
+        patches[n].offset = self->fact_chunk.offset - sizeof(WavChunkHeader);
+        patches[n].data = &self->fact_chunk.header;
+        patches[n++].size = sizeof(WavChunkHeader);
+        patches[n].offset = self->fact_chunk.offset;
+        patches[n].data = &self->fact_chunk.body;
+        patches[n++].size = self->fact_chunk.header.size;
+    }
+
+    if (self->data_chunk.header.id == WAV_DATA_CHUNK_ID) {
+        patches[n].offset = self->data_chunk.offset - sizeof(WavChunkHeader);
+        patches[n].data = &self->data_chunk.header;
+        patches[n++].size = sizeof(WavChunkHeader);
+    }
+
+    if (wav_io_patch(self, patches, n) != 0) {
+        wav_err_set(WAV_ERR_OS, "Error while writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return;
+    }
+
+    if (self->data_chunk.header.id == WAV_DATA_CHUNK_ID) {
+        if (wav_io_seek(self, self->data_chunk.offset) != 0) {
+            wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
+            return;
+        }
+    }
+}
+
+WAV_INLINE void wav_update_sizes(WavFile *self)
+{
+    WavPatch patches[5];
+    size_t   n = 0;
+
+    /* the chunk IDs are rewritten too, they change when the file is promoted to RF64 */
+    patches[n].offset = 0;
+    patches[n].data = &self->riff_chunk;
+    patches[n++].size = sizeof(WavChunkHeader);
+
+    if (self->ds64_chunk.header.id == WAV_DS64_CHUNK_ID) {
+        patches[n].offset = self->ds64_chunk.offset - sizeof(WavChunkHeader);
+        patches[n].data = &self->ds64_chunk.header;
+        patches[n++].size = sizeof(WavChunkHeader);
+        patches[n].offset = self->ds64_chunk.offset;
+        patches[n].data = &self->ds64_chunk.body;
+        patches[n++].size = WAV_DS64_BODY_SIZE;
+    }
+
+    if (self->fact_chunk.header.id == WAV_FACT_CHUNK_ID) {
+        patches[n].offset = self->fact_chunk.offset;
+        patches[n].data = &self->fact_chunk.body.sample_length;
+        patches[n++].size = 4;
+    }
+
+    patches[n].offset = self->data_chunk.offset - 4;
+    patches[n].data = &self->data_chunk.header.size;
+    patches[n++].size = 4;
+
+    if (wav_io_patch(self, patches, n) != 0) {
+        wav_err_set(WAV_ERR_OS, "Error while writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return;
+    }
+
+    self->header_dirty = WAV_FALSE;
+    self->header_pending_bytes = 0;
+    if (self->header_update == WAV_HEADER_UPDATE_MS) {
+        self->header_last_update_ms = wav_now_ms();
+    }
+}
+
+/* Make the samples durable, and only then the header that describes them */
+static int wav_sync(WavFile *self)
+{
+    if (wav_io_sync(self) != 0) {
+        wav_err_set(WAV_ERR_OS, "fsync() failed on %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return (int)g_err.code;
+    }
+
+    if (self->header_dirty) {
+        wav_update_sizes(self);
+        if (g_err.code != WAV_OK) {
+            return (int)g_err.code;
+        }
+        if (wav_io_sync(self) != 0) {
+            wav_err_set(WAV_ERR_OS, "fsync() failed on %s [errno %d: %s]", self->filename, errno, strerror(errno));
+            return (int)g_err.code;
+        }
+    }
+
+    self->sync_pending_bytes = 0;
+    self->sync_last_ms = wav_now_ms();
+    return 0;
+}
+
+WAV_INLINE void wav_maybe_sync(WavFile *self, size_t bytes_written)
+{
+    self->sync_pending_bytes += bytes_written;
+
+    switch (self->durability) {
+        case WAV_DURABILITY_NONE:
+        case WAV_DURABILITY_ON_CLOSE:
+            return;
+        case WAV_DURABILITY_BYTES:
+            if (self->sync_pending_bytes < self->durability_interval)
+                return;
+            break;
+        case WAV_DURABILITY_MS:
+            if (wav_now_ms() - self->sync_last_ms < self->durability_interval)
+                return;
+            break;
+    }
+
+    wav_sync(self);
+}
+
+WAV_INLINE void wav_maybe_update_sizes(WavFile *self, size_t bytes_written)
+{
+    self->header_dirty = WAV_TRUE;
+    self->header_pending_bytes += bytes_written;
+
+    /* the header follows the data at each sync */
+    if (self->durability == WAV_DURABILITY_BYTES || self->durability == WAV_DURABILITY_MS)
+        return;
+
+    switch (self->header_update) {
+        case WAV_HEADER_UPDATE_ALWAYS:
+            break;
+        case WAV_HEADER_UPDATE_ON_FLUSH:
+            return;
+        case WAV_HEADER_UPDATE_BYTES:
+            if (self->header_pending_bytes < self->header_update_interval)
+                return;
+            break;
+        case WAV_HEADER_UPDATE_MS:
+            if (wav_now_ms() - self->header_last_update_ms < self->header_update_interval)
+                return;
+            break;
+    }
+
+    wav_update_sizes(self);
+}
+
+#if WAV_HAVE_POSIX
+static void wav_map(WavFile* self)
+{
+    struct stat st;
+    void*       p;
+
+    if (fstat(self->fd, &st) != 0) {
+        wav_err_set(WAV_ERR_OS, "fstat() failed [errno %d: %s]", errno, strerror(errno));
+        return;
+    }
+
+    if (st.st_size == 0) {
+        return;
+    }
+
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, self->fd, 0);
+    if (p == MAP_FAILED) {
+        wav_err_set(WAV_ERR_OS, "mmap() failed [errno %d: %s]", errno, strerror(errno));
+        return;
+    }
+
+    self->map = p;
+    self->map_size = (size_t)st.st_size;
+}
+#endif
+
+/* Get ready to append to the data chunk of an existing file. Only the header is
+ * read, however long the file is. */
+static void wav_resume(WavFile* self)
+{
+    WavU64 end = self->data_chunk.offset + self->ds64_chunk.body.data_size;
+    WavU64 riff_size = end - sizeof(WavChunkHeader);
+    WavU8  tail[2];
+
+    /* chunks after the data would be overwritten, a pad byte is fine */
+    if (wav_io_seek(self, end) != 0) {
+        wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
+        return;
+    }
+    if (wav_io_read(self, tail, sizeof(tail)) > (self->ds64_chunk.body.data_size & 1)) {
+        wav_err_set(WAV_ERR_FORMAT, "Cannot append to %s, the data chunk is not the last chunk", self->filename);
+        return;
+    }
+    if (wav_io_seek(self, end) != 0) {
+        wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
+        return;
+    }
+
+    /* the RIFF size no longer counts a pad byte, the data grows over it */
+    if (self->ds64_chunk.body.riff_size != riff_size) {
+        self->ds64_chunk.body.riff_size = riff_size;
+        self->header_dirty = WAV_TRUE;
+    }
+}
+
+int wav_native_fd(WAV_CONST WavFile* self)
+{
+#if WAV_HAVE_POSIX
+    if (self->fd >= 0)
+        return self->fd;
+    if (self->io.read == &wav_stdio_read)
+        return fileno((FILE*)self->io_context);
+    if (self->io.read == &wav_raw_fd_read)
+        return WAV_CONTEXT_FD(self->io_context);
+#else
+    (void)self;
+#endif
+    return -1;
+}
+
+/* Allocate the blocks of the file up to byte {end} without changing its size */
+static int wav_reserve_bytes(WavFile* self, WavU64 end)
+{
+#if defined(__linux__)
+    int fd = wav_native_fd(self);
+
+    if (fd >= 0 && end > self->reserved_end) {
+        WavU64 begin = self->data_chunk.offset + self->ds64_chunk.body.data_size;
+        if (begin < self->reserved_end) {
+            begin = self->reserved_end;
+        }
+        if (fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t)begin, (off_t)(end - begin)) != 0)
+            return -1;
+        self->reserved_end = end;
+    }
+#else
+    (void)self;
+    (void)end;
+#endif
+    return 0;
+}
+
+/* The size of a file opened by wav_init() */
+static WavI64 wav_file_size(WavFile* self)
+{
+#if WAV_HAVE_POSIX
+    struct stat st;
+
+    if (fstat(wav_native_fd(self), &st) != 0)
+        return -1;
+    return (WavI64)st.st_size;
+#else
+    FILE*  fp = self->io_context;
+    WavI64 pos = (WavI64)WAV_FTELL(fp);
+    WavI64 size;
+
+    if (pos < 0 || WAV_FSEEK(fp, 0, SEEK_END) != 0)
+        return -1;
+    size = (WavI64)WAV_FTELL(fp);
+    if (WAV_FSEEK(fp, pos, SEEK_SET) != 0)
+        return -1;
+    return size;
+#endif
+}
+
+/* If the data chunk is followed by a chain of chunks that ends exactly at the
+ * end of the file, which stale sizes are very unlikely to produce by chance */
+static WavBool wav_has_trailing_chunks(WavFile* self, WavU64 offset, WavU64 file_size)
+{
+    for (size_t n = 0; n < 16 && offset + sizeof(WavChunkHeader) <= file_size; ++n) {
+        WavChunkHeader  header;
+        WAV_CONST char* id = (WAV_CONST char*)&header.id;
+
+        if (wav_io_seek(self, offset) != 0 || wav_io_read(self, &header, sizeof(header)) != sizeof(header))
+            return WAV_FALSE;
+        for (size_t i = 0; i < 4; ++i) {
+            if (id[i] < 0x20 || id[i] > 0x7e)
+                return WAV_FALSE;
+        }
+
+        offset += sizeof(WavChunkHeader) + header.size + (header.size & 1);
+        if (offset == file_size || offset == file_size + 1)
+            return WAV_TRUE;
+    }
+    return WAV_FALSE;
+}
+
+/* Make the size of the data chunk agree with the length of the file, after a
+ * writer died before it could update the header. Costs an fstat() and a few
+ * reads, the samples are not scanned. */
+static void wav_recover(WavFile* self)
+{
+    WavU64 block_align = self->format_chunk.body.block_align;
+    WavU64 declared = self->ds64_chunk.body.data_size;
+    WavU64 declared_end = self->data_chunk.offset + declared;
+    WavI64 file_size = wav_file_size(self);
+    WavU64 data_size;
+
+    if (file_size < 0) {
+        wav_err_set(WAV_ERR_OS, "Cannot get the size of %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return;
+    }
+    if ((WavU64)file_size < self->data_chunk.offset || block_align == 0) {
+        wav_err_set(WAV_ERR_FORMAT, "%s is truncated inside the header", self->filename);
+        return;
+    }
+
+    /* the declared size is right if the file ends there, or other chunks follow */
+    if (declared_end + (declared & 1) == (WavU64)file_size ||
+        (declared_end < (WavU64)file_size && wav_has_trailing_chunks(self, declared_end + (declared & 1), (WavU64)file_size)))
+    {
+        wav_io_seek(self, self->data_chunk.offset);
+        return;
+    }
+
+    data_size = (WavU64)file_size - self->data_chunk.offset;
+    data_size -= data_size % block_align;
+
+    self->ds64_chunk.body.data_size = data_size;
+    self->ds64_chunk.body.riff_size = self->data_chunk.offset + data_size - sizeof(WavChunkHeader);
+    self->ds64_chunk.body.sample_count = data_size / block_align;
+    if (!wav_make_room(self, 0)) {
+        return;
+    }
+    wav_sync_sizes(self);
+    self->recovered_frames = (WavI64)(data_size / block_align) - (WavI64)(declared / block_align);
+
+#if WAV_HAVE_POSIX
+    /* drop the partial frame at the end */
+    if (self->data_chunk.offset + data_size < (WavU64)file_size &&
+        ftruncate(wav_native_fd(self), (off_t)(self->data_chunk.offset + data_size)) != 0)
+    {
+        wav_err_set(WAV_ERR_OS, "Error when truncating %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return;
+    }
+#endif
+
+    self->header_dirty = WAV_TRUE;
+    wav_update_sizes(self);
+    if (g_err.code != WAV_OK) {
+        return;
+    }
+    wav_io_flush(self);
+    wav_io_seek(self, self->data_chunk.offset);
+}
+
+/* Fill in the zero fields of {spec} with the defaults of a new file and check
+ * the result. Returns 0 if the format is valid. */
+static int wav_resolve_format_spec(WAV_CONST WavFormatSpec* spec, WavFormatSpec* out)
+{
+    WavU16 sample_format;
+    size_t block_align;
+
+    *out = *spec;
+    if (out->format == 0) {
+        out->format = WAV_FORMAT_PCM;
+    }
+    if (out->format == WAV_FORMAT_EXTENSIBLE && out->sub_format == 0) {
+        out->sub_format = WAV_FORMAT_PCM;
+    }
+    if (out->num_channels == 0) {
+        out->num_channels = 2;
+    }
+    if (out->sample_rate == 0) {
+        out->sample_rate = 44100;
+    }
+
+    sample_format = out->format == WAV_FORMAT_EXTENSIBLE ? out->sub_format : out->format;
+    if (out->sample_size == 0) {
+        out->sample_size = (sample_format == WAV_FORMAT_ALAW || sample_format == WAV_FORMAT_MULAW) ? 1 : sample_format == WAV_FORMAT_IEEE_FLOAT ? 4 : 2;
+    }
+    if (out->valid_bits_per_sample == 0) {
+        out->valid_bits_per_sample = (WavU16)(out->sample_size * 8);
+    }
+
+    block_align = out->sample_size * out->num_channels;
+    if (block_align > 0xffff || (WavU64)block_align * out->sample_rate > 0xffffffff) {
+        wav_err_set(WAV_ERR_PARAM, "Invalid format: %u channels of %zu-byte samples at %u Hz", out->num_channels, out->sample_size, out->sample_rate);
+        return (int)g_err.code;
+    }
+    if ((sample_format == WAV_FORMAT_ALAW || sample_format == WAV_FORMAT_MULAW) && out->sample_size != 1) {
+        wav_err_set(WAV_ERR_PARAM, "Invalid sample size for A-law and mu-law: %zu", out->sample_size);
+        return (int)g_err.code;
+    }
+    if (sample_format == WAV_FORMAT_IEEE_FLOAT && out->sample_size != 4 && out->sample_size != 8) {
+        wav_err_set(WAV_ERR_PARAM, "Invalid sample size for IEEE float: %zu", out->sample_size);
+        return (int)g_err.code;
+    }
+    /* the same rules as wav_set_valid_bits_per_sample(), 0 was replaced by the default above */
+    if (out->valid_bits_per_sample > out->sample_size * 8 ||
+        ((sample_format == WAV_FORMAT_ALAW || sample_format == WAV_FORMAT_MULAW) && out->valid_bits_per_sample != 8))
+    {
+        wav_err_set(WAV_ERR_PARAM, "Invalid ValidBitsPerSample: %u", out->valid_bits_per_sample);
+        return (int)g_err.code;
+    }
+
+    return 0;
+}
+
+/* Give a new file the format {spec}, resolved by wav_resolve_format_spec() */
+static void wav_apply_format_spec(WavFile* self, WAV_CONST WavFormatSpec* spec)
+{
+    self->format_chunk.body.format_tag = spec->format;
+    self->format_chunk.body.num_channels = spec->num_channels;
+    self->format_chunk.body.sample_rate = spec->sample_rate;
+    self->format_chunk.body.block_align = (WavU16)(spec->sample_size * spec->num_channels);
+    self->format_chunk.body.avg_bytes_per_sec = self->format_chunk.body.block_align * spec->sample_rate;
+    self->format_chunk.body.bits_per_sample = (WavU16)(spec->sample_size * 8);
+
+    if (spec->format == WAV_FORMAT_EXTENSIBLE) {
+        self->format_chunk.header.size = sizeof(self->format_chunk.body);
+        self->format_chunk.body.ext_size = 22;
+        self->format_chunk.body.valid_bits_per_sample = spec->valid_bits_per_sample;
+        self->format_chunk.body.channel_mask = spec->channel_mask;
+        self->format_chunk.body.sub_format[0] = (WavU8)(spec->sub_format & 0xff);
+        self->format_chunk.body.sub_format[1] = (WavU8)(spec->sub_format >> 8);
+    } else {
+        self->format_chunk.body.bits_per_sample = spec->valid_bits_per_sample;
+    }
+}
+
+/* Check the format of an existing file against the non-zero fields of {spec} */
+static void wav_check_format_spec(WavFile* self, WAV_CONST WavFormatSpec* spec)
+{
+    if ((spec->format != 0 && spec->format != wav_get_format(self)) ||
+        (spec->num_channels != 0 && spec->num_channels != wav_get_num_channels(self)) ||
+        (spec->sample_rate != 0 && spec->sample_rate != wav_get_sample_rate(self)) ||
+        (spec->sample_size != 0 && spec->sample_size != wav_get_sample_size(self)) ||
+        (spec->valid_bits_per_sample != 0 && spec->valid_bits_per_sample != wav_get_valid_bits_per_sample(self)) ||
+        (wav_get_format(self) == WAV_FORMAT_EXTENSIBLE && spec->channel_mask != 0 && spec->channel_mask != wav_get_channel_mask(self)) ||
+        (wav_get_format(self) == WAV_FORMAT_EXTENSIBLE && spec->sub_format != 0 && spec->sub_format != wav_get_sub_format(self)))
+    {
+        wav_err_set(WAV_ERR_FORMAT, "The format of %s does not match the requested one", self->filename);
+    }
+}
+
+/* Parse the header of an existing file or write the header of a new one. {spec}
+ * is NULL or a format resolved by wav_resolve_format_spec() for a new file. */
+static void wav_start(WavFile* self, WAV_CONST WavFormatSpec* spec)
+{
+    if (!(self->mode & WAV_OPEN_WRITE) && !(self->mode & WAV_OPEN_APPEND)) {
+        wav_parse_header(self);
+        if (g_err.code == WAV_OK && (self->mode & WAV_OPEN_RECOVER)) {
+            wav_recover(self);
+        }
+#if WAV_HAVE_POSIX
+        if (g_err.code == WAV_OK && (self->mode & WAV_OPEN_MMAP)) {
+            wav_map(self);
+        }
+#endif
+        return;
+    }
+
+    if ((self->mode & WAV_OPEN_APPEND) && !(self->mode & WAV_OPEN_WRITE)) {
+        WavU8 byte;
+
+        wav_parse_header(self);
+        if (g_err.code == WAV_OK && (self->mode & WAV_OPEN_RECOVER)) {
+            wav_recover(self);
+        }
+        if (g_err.code == WAV_OK) {
+            wav_resume(self);
+            return;
+        }
+
+        // Header parsing failed. Regard it as a new file if it is empty, and leave anything else alone.
+        if (wav_io_seek(self, 0) != 0 || wav_io_read(self, &byte, 1) != 0) {
+            return;
+        }
+        wav_err_clear();
+        wav_io_seek(self, 0);
+        self->is_a_new_file = WAV_TRUE;
+    }
+
+    // reaches here only if creating a new file
+
+    self->riff_chunk.id = WAV_RIFF_CHUNK_ID;
+    /* self->chunk.size = calculated by wav_write_header */
+    self->riff_chunk.wave_id = WAV_WAVE_ID;
+    self->riff_chunk.offset = sizeof(WavChunkHeader) + 4;
+
+    /* reserve room for a ds64 chunk in case the file grows beyond 4 GiB */
+    memset(&self->ds64_chunk, 0, sizeof(WavDs64Chunk));
+    self->ds64_chunk.header.id = WAV_JUNK_CHUNK_ID;
+    self->ds64_chunk.header.size = WAV_DS64_BODY_SIZE;
+    self->ds64_chunk.offset = self->riff_chunk.offset + sizeof(WavChunkHeader);
+
+    self->format_chunk.header.id                = WAV_FORMAT_CHUNK_ID;
+    self->format_chunk.header.size              = (WavU32)((WavUIntPtr)&self->format_chunk.body.ext_size - (WavUIntPtr)&self->format_chunk.body);
+    self->format_chunk.offset                   = self->ds64_chunk.offset + self->ds64_chunk.header.size + sizeof(WavChunkHeader);
+    self->format_chunk.body.format_tag          = WAV_FORMAT_PCM;
+    self->format_chunk.body.num_channels        = 2;
+    self->format_chunk.body.sample_rate         = 44100;
+    self->format_chunk.body.avg_bytes_per_sec   = 44100 * 2 * 2;
+    self->format_chunk.body.block_align         = 4;
+    self->format_chunk.body.bits_per_sample     = 16;
+
+    memcpy(self->format_chunk.body.sub_format, default_sub_format, 16);
+
+    if (spec != NULL) {
+        wav_apply_format_spec(self, spec);
+    }
+
+    self->data_chunk.header.id = WAV_DATA_CHUNK_ID;
+    self->data_chunk.offset = self->format_chunk.offset + self->format_chunk.header.size + sizeof(WavChunkHeader);
+
+    wav_write_header(self);
+}
+
+static void wav_init_spec(WavFile* self, WAV_CONST char* filename, WavU32 mode, WAV_CONST WavFormatSpec* spec)
+{
+    WavBool writable = (mode & WAV_OPEN_WRITE) || (mode & WAV_OPEN_APPEND);
+
+    memset(self, 0, sizeof(WavFile));
+    self->fd = -1;
+    self->direct_fd = -1;
+
+    if (!(mode & WAV_OPEN_READ) && !writable) {
+        wav_err_set_literal(WAV_ERR_PARAM, "Invalid mode");
+        return;
+    }
+
+    if ((mode & WAV_OPEN_MMAP) && (mode & WAV_OPEN_DIRECT)) {
+        wav_err_set_literal(WAV_ERR_PARAM, "WAV_OPEN_MMAP cannot be used with WAV_OPEN_DIRECT");
+        return;
+    }
+
+    if ((mode & WAV_OPEN_MMAP) && writable) {
+        wav_err_set_literal(WAV_ERR_MODE, "WAV_OPEN_MMAP can only be used for reading");
+        return;
+    }
+
+    if ((mode & WAV_OPEN_RECOVER) && (mode & WAV_OPEN_WRITE)) {
+        wav_err_set_literal(WAV_ERR_PARAM, "WAV_OPEN_RECOVER cannot be used with WAV_OPEN_WRITE");
+        return;
+    }
+
+    if (mode & (WAV_OPEN_FD | WAV_OPEN_MMAP | WAV_OPEN_DIRECT)) {
+#if WAV_HAVE_POSIX
+        int flags = (mode & WAV_OPEN_WRITE) ? (O_RDWR | O_CREAT | O_TRUNC) : writable ? (O_RDWR | O_CREAT) : (mode & WAV_OPEN_RECOVER) ? O_RDWR : O_RDONLY;
+
+        self->io_buffer_memory = wav_malloc(WAV_IO_BUFFER_SIZE + WAV_DIRECT_ALIGN);
+        if (self->io_buffer_memory == NULL) {
+            wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the I/O buffer");
+            return;
+        }
+        self->io_buffer = (WavU8*)(((WavUIntPtr)self->io_buffer_memory + WAV_DIRECT_ALIGN - 1) & ~(WavUIntPtr)(WAV_DIRECT_ALIGN - 1));
+        self->fd = open(filename, flags, 0666);
+        if (self->fd < 0) {
+            wav_err_set(WAV_ERR_OS, "Error when opening %s [errno %d: %s]", filename, errno, strerror(errno));
+            return;
+        }
+        if (mode & WAV_OPEN_DIRECT) {
+            flags &= ~(O_CREAT | O_TRUNC);
+#if defined(O_DIRECT)
+            self->direct_fd = open(filename, flags | O_DIRECT);
+#elif defined(F_NOCACHE)
+            self->direct_fd = open(filename, flags);
+            if (self->direct_fd >= 0 && fcntl(self->direct_fd, F_NOCACHE, 1) != 0) {
+                close(self->direct_fd);
+                self->direct_fd = -1;
+            }
+#else
+            errno = ENOTSUP;
+#endif
+            if (self->direct_fd < 0) {
+                wav_err_set(WAV_ERR_OS, "Error when opening %s for direct I/O [errno %d: %s]", filename, errno, strerror(errno));
+                close(self->fd);
+                self->fd = -1;
+                return;
+            }
+        }
+        self->io = wav_fd_io;
+        self->io_context = self;
+#else
+        wav_err_set_literal(WAV_ERR_PARAM, "WAV_OPEN_FD, WAV_OPEN_MMAP and WAV_OPEN_DIRECT are not supported on this platform");
+        return;
+#endif
+    } else {
+        FILE *fp = fopen(filename, (mode & WAV_OPEN_WRITE) ? "wb+" : (writable || (mode & WAV_OPEN_RECOVER)) ? "rb+" : "rb");
+        if (fp == NULL && errno == ENOENT && writable) {
+            fp = fopen(filename, "wb+");
+        }
+        if (fp == NULL) {
+            wav_err_set(WAV_ERR_OS, "Error when opening %s [errno %d: %s]", filename, errno, strerror(errno));
+            return;
+        }
+        self->io = wav_stdio_owned_io;
+        self->io_context = fp;
+    }
+
+    self->filename = wav_strdup(filename);
+    self->mode = mode;
+
+    wav_start(self, spec);
+}
+
+void wav_init(WavFile* self, WAV_CONST char* filename, WavU32 mode)
+{
+    wav_init_spec(self, filename, mode, NULL);
+}
+
+static void wav_init_io(WavFile* self, WAV_CONST WavIO* io, void *context, WavU32 mode)
+{
+    WavBool writable = (mode & WAV_OPEN_WRITE) || (mode & WAV_OPEN_APPEND);
+
+    memset(self, 0, sizeof(WavFile));
+    self->fd = -1;
+    self->direct_fd = -1;
+
+    if ((!(mode & WAV_OPEN_READ) && !writable) || (mode & (WAV_OPEN_FD | WAV_OPEN_MMAP | WAV_OPEN_RECOVER | WAV_OPEN_DIRECT))) {
+        wav_err_set_literal(WAV_ERR_PARAM, "Invalid mode");
+        return;
+    }
+
+    if (io->seek == NULL || io->tell == NULL ||
+        (io->read == NULL && (mode & (WAV_OPEN_READ | WAV_OPEN_APPEND))) ||
+        (io->write == NULL && writable))
+    {
+        wav_err_set_literal(WAV_ERR_PARAM, "The WavIO callbacks required by the mode are missing");
+        return;
+    }
+
+    self->io = *io;
+    self->io_context = context;
+    self->filename = wav_strdup("<WavIO>");
+    self->mode = mode;
+
+    wav_start(self, NULL);
+}
+
+/* Patch the sizes in the header on close, and sync the file if the durability
+ * policy asks for it. An error left pending by an earlier call is kept for the
+ * caller, and a failure here is then only reported as a warning. */
+static void wav_finalize_sizes(WavFile* self, WavBool sync)
+{
+    WavErr pending = g_err;
+
+    g_err.code = WAV_OK;
+    g_err.message = (char*)"";
+    g_err._is_literal = 1;
+
+    if (sync) {
+        wav_sync(self);
+    } else {
+        wav_update_sizes(self);
+    }
+
+    if (pending.code != WAV_OK) {
+        if (g_err.code != WAV_OK) {
+            fprintf(stderr, "[WARN] [libwav] %s %s failed: %s", sync ? "syncing" : "updating the header of", self->filename, g_err.message);
+            wav_err_clear();
+        }
+        g_err = pending;
+    }
+}
+
+void wav_finalize(WavFile* self)
+{
+    int ret;
+
+    if (self->io.tell != NULL && self->durability != WAV_DURABILITY_NONE && wav_is_writable(self)) {
+        wav_finalize_sizes(self, WAV_TRUE);
+    } else if (self->io.tell != NULL && self->header_dirty) {
+        wav_finalize_sizes(self, WAV_FALSE);
+    }
+
+#if WAV_HAVE_POSIX
+    /* truncating to the current size releases the blocks reserved beyond it */
+    if (self->reserved_end > 0) {
+        int    fd = wav_native_fd(self);
+        WavI64 size = wav_io_flush(self) == 0 ? wav_file_size(self) : -1;
+        if (size >= 0 && (WavU64)size < self->reserved_end && ftruncate(fd, (off_t)size) != 0) {
+            fprintf(stderr, "[WARN] [libwav] releasing the reserved space failed [errno %d: %s]", errno, strerror(errno));
+        }
+    }
+#endif
+
+    wav_free(self->filename);
+
+    if (self->io.close != NULL) {
+        ret = self->io.close(self->io_context);
+        if (ret != 0) {
+            fprintf(stderr, "[WARN] [libwav] close failed with code %d [errno %d: %s]", ret, errno, strerror(errno));
+        }
+    }
+
+    wav_free(self->io_buffer_memory);
+    wav_free(self->convert_buffer);
+    wav_free(self->dither_buffer);
+}
+
+WavFile* wav_open(WAV_CONST char* filename, WavU32 mode)
+{
+    WavFile* self = wav_malloc(sizeof(WavFile));
+    if (self == NULL) {
+        return NULL;
+    }
+
+    wav_init(self, filename, mode);
+
+    return self;
+}
+
+WavFile* wav_open_ex(WAV_CONST char* filename, WavU32 mode, WAV_CONST WavFormatSpec* format)
+{
+    WavFormatSpec resolved;
+    WavFile*      self;
+
+    if (format != NULL && wav_resolve_format_spec(format, &resolved) != 0) {
+        return NULL;
+    }
+
+    self = wav_malloc(sizeof(WavFile));
+    if (self == NULL) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the WavFile");
+        return NULL;
+    }
+
+    wav_init_spec(self, filename, mode, format != NULL ? &resolved : NULL);
+
+    /* the header of an existing file was parsed instead */
+    if (format != NULL && g_err.code == WAV_OK && !(mode & WAV_OPEN_WRITE) && !self->is_a_new_file) {
+        wav_check_format_spec(self, format);
+    }
+
+    return self;
+}
+
+WavFile* wav_open_io(WAV_CONST WavIO* io, void *context, WavU32 mode)
+{
+    WavFile* self = wav_malloc(sizeof(WavFile));
+    if (self == NULL) {
+        return NULL;
+    }
+
+    wav_init_io(self, io, context, mode);
+
+    return self;
+}
+
+void wav_close(WavFile* self)
+{
+    wav_finalize(self);
+    wav_free(self);
+}
+
+WavFile* wav_reopen(WavFile* self, WAV_CONST char* filename, WavU32 mode)
+{
+    wav_finalize(self);
+    wav_init(self, filename, mode);
+    return self;
+}
+
+size_t wav_read(WavFile* self, void *buffer, size_t count)
+{
+    WavFrameSpan span;
+
+    span.data = buffer;
+    span.count = count;
+    return wav_readv(self, &span, 1);
+}
+
+size_t wav_readv(WavFile* self, WAV_CONST WavFrameSpan *spans, size_t n)
+{
+    WavU64 read_count;
+    WavU64 count = 0;
+    size_t frame_size = wav_get_sample_size(self) * wav_get_num_channels(self);
+    WavI64 pos;
+    WavU64 len_remain;
+
+    if (!(self->mode & WAV_OPEN_READ)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not readable");
+        return 0;
+    }
+
+    pos = wav_tell(self);
+    if (g_err.code != WAV_OK) {
+        return 0;
+    }
+    len_remain = wav_get_length(self) - (WavU64)pos;
+    for (size_t i = 0; i < n; ++i) {
+        count += spans[i].count;
+    }
+    count = (count <= len_remain) ? count : len_remain;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    read_count = wav_io_vectored(self, spans, n, frame_size, frame_size * count, WAV_FALSE);
+    if (wav_io_error(self)) {
+        wav_err_set(WAV_ERR_OS, "Error when reading %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return 0;
+    }
+
+    return (size_t)(read_count / frame_size);
+}
+
+size_t wav_read_raw(WavFile* self, void *buffer, size_t size)
+{
+    WavI64 pos;
+    WavU64 end = self->data_chunk.offset + self->ds64_chunk.body.data_size;
+    size_t read_size;
+
+    if (!(self->mode & WAV_OPEN_READ)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not readable");
+        return 0;
+    }
+
+    pos = wav_io_tell(self);
+    if (pos < 0) {
+        wav_err_set(WAV_ERR_OS, "ftell() failed [errno %d: %s]", errno, strerror(errno));
+        return 0;
+    }
+    if ((WavU64)pos >= end) {
+        return 0;
+    }
+    size = (size <= end - (WavU64)pos) ? size : (size_t)(end - (WavU64)pos);
+
+    read_size = wav_io_read(self, buffer, size);
+    if (wav_io_error(self)) {
+        wav_err_set(WAV_ERR_OS, "Error when reading %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return 0;
+    }
+
+    return read_size;
+}
+
+size_t wav_pread(WAV_CONST WavFile* self, void *buffer, WavU64 frame_offset, size_t count)
+{
+    size_t block_align = wav_get_sample_size(self) * wav_get_num_channels(self);
+    WavU64 length = wav_get_length(self);
+    WavI64 n;
+
+    if (!(self->mode & WAV_OPEN_READ)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not readable");
+        return 0;
+    }
+
+    if (self->io.pread == NULL) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile does not support positional reads");
+        return 0;
+    }
+
+    if (frame_offset >= length) {
+        return 0;
+    }
+    count = (count <= length - frame_offset) ? count : (size_t)(length - frame_offset);
+
+    n = self->io.pread(self->io_context, buffer, block_align * count, self->data_chunk.offset + frame_offset * block_align);
+    if (n < 0) {
+        wav_err_set(WAV_ERR_OS, "Error when reading %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return 0;
+    }
+
+    return (size_t)n / block_align;
+}
+
+static WavBool wav_alloc_convert_buffer(WavFile* self)
+{
+    if (self->convert_buffer == NULL) {
+        self->convert_buffer = wav_malloc(WAV_IO_BUFFER_SIZE);
+        if (self->convert_buffer == NULL) {
+            wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the conversion buffer");
+            return WAV_FALSE;
+        }
+    }
+    return WAV_TRUE;
+}
+
+/* Called with {count} frames in the file format that belong at frame {offset} of the caller's buffer */
+typedef void (*WavBlockFunc)(void* context, WAV_CONST void* src, size_t offset, size_t count);
+
+/* Read up to {count} frames and hand them to {func} in blocks, straight out of
+ * the mapping if the file is mapped, otherwise through the conversion buffer. */
+static size_t wav_read_blocks(WavFile* self, size_t count, WavBlockFunc func, void* context)
+{
+    size_t block_align = self->format_chunk.body.block_align;
+    size_t total = 0;
+
+    if (self->map != NULL) {
+        WAV_CONST void* src;
+        WavU64          len_remain;
+        WavI64          pos = wav_tell(self);
+        if (g_err.code != WAV_OK) {
+            return 0;
+        }
+        len_remain = wav_get_length(self) - (WavU64)pos;
+        count = (count <= len_remain) ? count : (size_t)len_remain;
+        if (count == 0) {
+            return 0;
+        }
+        src = wav_map_frames(self, (size_t)pos, count);
+        if (src == NULL) {
+            return 0;
+        }
+        func(context, src, 0, count);
+        wav_io_seek(self, self->data_chunk.offset + ((WavU64)pos + count) * block_align);
+        return count;
+    }
+
+    if (!wav_alloc_convert_buffer(self)) {
+        return 0;
+    }
+
+    while (total < count) {
+        size_t chunk = WAV_IO_BUFFER_SIZE / block_align;
+        size_t n;
+
+        if (chunk > count - total) {
+            chunk = count - total;
+        }
+
+        n = wav_read(self, self->convert_buffer, chunk);
+        if (n == 0) {
+            break;
+        }
+
+        func(context, self->convert_buffer, total, n);
+        total += n;
+
+        if (n < chunk) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+typedef struct {
+    void*           buffer;
+    WavU16          n_channels;
+    WavSampleType   type;
+    unsigned        valid_bits;     /* 0 if the samples fill their container */
+} WavConvertContext;
+
+static void wav_read_f32_block(void* context, WAV_CONST void* src, size_t offset, size_t count)
+{
+    WavConvertContext* ctx = context;
+    float*             dst = (float*)ctx->buffer + offset * ctx->n_channels;
+
+    wav_convert_to_f32(dst, src, count * ctx->n_channels, ctx->type);
+    if (ctx->valid_bits != 0) {
+        wav_truncate_f32(dst, count * ctx->n_channels, ctx->valid_bits);
+    }
+}
+
+static void wav_read_i16_block(void* context, WAV_CONST void* src, size_t offset, size_t count)
+{
+    WavConvertContext* ctx = context;
+    WavI16*            dst = (WavI16*)ctx->buffer + offset * ctx->n_channels;
+
+    wav_convert_to_i16(dst, src, count * ctx->n_channels, ctx->type);
+    if (ctx->valid_bits != 0 && ctx->valid_bits < 16) {
+        WavI16 mask = (WavI16)~((1 << (16 - ctx->valid_bits)) - 1);
+        for (size_t i = 0; i < count * ctx->n_channels; ++i) {
+            dst[i] &= mask;
+        }
+    }
+}
+
+static size_t wav_read_converted(WavFile* self, void *buffer, size_t count, WavBlockFunc func)
+{
+    WavConvertContext ctx;
+
+    ctx.buffer = buffer;
+    ctx.n_channels = wav_get_num_channels(self);
+    ctx.type = wav_sample_type(wav_sample_format(self), wav_get_sample_size(self));
+    ctx.valid_bits = wav_valid_bits(self);
+
+    if (ctx.type == WAV_SAMPLE_UNKNOWN) {
+        wav_err_set(WAV_ERR_FORMAT, "Cannot convert format %#06x with %zu-byte samples",
+                    wav_sample_format(self), wav_get_sample_size(self));
+        return 0;
+    }
+
+    return wav_read_blocks(self, count, func, &ctx);
+}
+
+size_t wav_read_f32(WavFile* self, float *buffer, size_t count)
+{
+    return wav_read_converted(self, buffer, count, &wav_read_f32_block);
+}
+
+size_t wav_read_i16(WavFile* self, WavI16 *buffer, size_t count)
+{
+    return wav_read_converted(self, buffer, count, &wav_read_i16_block);
+}
+
+typedef struct {
+    void* WAV_CONST*    channels;
+    size_t              n_channels;
+    size_t              sample_size;
+} WavPlanarContext;
+
+static void wav_read_planar_block(void* context, WAV_CONST void* src, size_t offset, size_t count)
+{
+    WavPlanarContext* ctx = context;
+    wav_deinterleave(ctx->channels, offset, src, ctx->n_channels, ctx->sample_size, count);
+}
+
+size_t wav_read_planar(WavFile* self, void **channels, size_t count)
+{
+    WavPlanarContext ctx;
+
+    ctx.channels = channels;
+    ctx.n_channels = wav_get_num_channels(self);
+    ctx.sample_size = wav_get_sample_size(self);
+
+    return wav_read_blocks(self, count, &wav_read_planar_block, &ctx);
+}
+
+WavU16 wav_sample_format(WAV_CONST WavFile* self)
+{
+    return self->format_chunk.body.format_tag == WAV_FORMAT_EXTENSIBLE ? wav_get_sub_format(self) : self->format_chunk.body.format_tag;
+}
+
+unsigned wav_valid_bits(WAV_CONST WavFile* self)
+{
+    unsigned bits = wav_get_valid_bits_per_sample(self);
+
+    if (wav_sample_format(self) != WAV_FORMAT_PCM || bits == 0 || bits >= 8 * wav_get_sample_size(self)) {
+        return 0;
     }
+    return bits;
+}
 
-    len_remain = wav_get_length(self) - (size_t)wav_tell(self);
-    if (g_err.code != WAV_OK) {
+WavBool wav_is_readable(WAV_CONST WavFile* self)
+{
+    return (self->mode & WAV_OPEN_READ) != 0;
+}
+
+WavBool wav_is_writable(WAV_CONST WavFile* self)
+{
+    return (self->mode & WAV_OPEN_WRITE) || (self->mode & WAV_OPEN_APPEND);
+}
+
+size_t wav_write(WavFile* self, WAV_CONST void *buffer, size_t count)
+{
+    WavFrameSpan span;
+
+    span.data = (void*)buffer;
+    span.count = count;
+    return wav_writev(self, &span, 1);
+}
+
+/* Append {size} bytes of {spans}, whose counts are in units of {unit} bytes, to
+ * the data chunk. Returns the number of bytes written, 0 on error. */
+static WavU64 wav_append(WavFile* self, WAV_CONST WavFrameSpan *spans, size_t n, size_t unit, WavU64 size)
+{
+    WavU64 written;
+    WavI64 pos;
+
+    pos = wav_io_tell(self);
+    if (pos < 0) {
+        wav_err_set(WAV_ERR_OS, "ftell() failed [errno %d: %s]", errno, strerror(errno));
+        return 0;
+    }
+
+    if (!wav_make_room(self, size)) {
+        return 0;
+    }
+
+    /* grow the reservation in large steps, on a best effort basis */
+    if (self->reserve_step != 0 &&
+        self->data_chunk.offset + self->ds64_chunk.body.data_size + size > self->reserved_end)
+    {
+        WavU64 end = self->data_chunk.offset + self->ds64_chunk.body.data_size + size + self->reserve_step * self->format_chunk.body.block_align;
+        if (wav_reserve_bytes(self, end) != 0) {
+            self->reserve_step = 0;
+        }
+    }
+
+    /* appending always writes at the end, wherever the last read left off */
+    if (!(self->mode & WAV_OPEN_WRITE) && (WavU64)pos != self->data_chunk.offset + self->ds64_chunk.body.data_size) {
+        if (wav_io_seek(self, self->data_chunk.offset + self->ds64_chunk.body.data_size) != 0) {
+            wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
+            return 0;
+        }
+    }
+
+    written = wav_io_vectored(self, spans, n, unit, size, WAV_TRUE);
+    if (wav_io_error(self)) {
+        wav_err_set(WAV_ERR_OS, "Error when writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return 0;
+    }
+
+    self->ds64_chunk.body.riff_size += written;
+    self->ds64_chunk.body.data_size += written;
+    self->ds64_chunk.body.sample_count = self->ds64_chunk.body.data_size / self->format_chunk.body.block_align;
+    wav_sync_sizes(self);
+
+    wav_maybe_update_sizes(self, (size_t)written);
+    if (g_err.code != WAV_OK)
+        return 0;
+
+    wav_maybe_sync(self, (size_t)written);
+    if (g_err.code != WAV_OK)
+        return 0;
+
+    return written;
+}
+
+size_t wav_writev(WavFile* self, WAV_CONST WavFrameSpan *spans, size_t n)
+{
+    WavU64 count = 0;
+    size_t frame_size = wav_get_sample_size(self) * wav_get_num_channels(self);
+
+    if (!wav_is_writable(self)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return 0;
     }
-    count = (count <= len_remain) ? count : len_remain;
 
+    for (size_t i = 0; i < n; ++i) {
+        count += spans[i].count;
+    }
     if (count == 0) {
         return 0;
     }
 
-    read_count = fread(buffer, sample_size, n_channels * count, self->fp);
-    if (ferror(self->fp)) {
-        wav_err_set(WAV_ERR_OS, "Error when reading %s [errno %d: %s]", self->filename, errno, strerror(errno));
+    return (size_t)(wav_append(self, spans, n, frame_size, frame_size * count) / frame_size);
+}
+
+size_t wav_write_raw(WavFile* self, WAV_CONST void *buffer, size_t size)
+{
+    WavFrameSpan span;
+
+    if (!wav_is_writable(self)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
+        return 0;
+    }
+
+    if (size == 0) {
         return 0;
     }
 
-    return read_count / n_channels;
+    span.data = (void*)buffer;
+    span.count = size;
+    return (size_t)wav_append(self, &span, 1, 1, size);
 }
 
-WAV_INLINE void wav_update_sizes(WavFile *self)
+int wav_extend(WavFile* self, WavU64 frames)
 {
-    long int save_pos = ftell(self->fp);
-    if (fseek(self->fp, (long)(sizeof(WavChunkHeader) - 4), SEEK_SET) != 0) {
-        wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-        return;
+    WavU64 length = wav_get_length(self);
+    WavU64 block_align = self->format_chunk.body.block_align;
+    WavU64 bytes;
+    WavU64 end;
+    WavU8  zero = 0;
+
+    if (!wav_is_writable(self)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
+        return (int)g_err.code;
     }
-    if (fwrite(&self->riff_chunk.size, 4, 1, self->fp) != 1) {
-        wav_err_set(WAV_ERR_OS, "fwrite() failed [errno %d: %s]", errno, strerror(errno));
-        return;
+
+    if (frames <= length) {
+        return 0;
     }
-    if (self->fact_chunk.header.id == WAV_FACT_CHUNK_ID) {
-        if (fseek(self->fp, (long)self->fact_chunk.offset, SEEK_SET) != 0) {
-            wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-            return;
-        }
-        if (fwrite(&self->fact_chunk.body.sample_length, 4, 1, self->fp) != 1) {
-            wav_err_set(WAV_ERR_OS, "fwrite() failed [errno %d: %s]", errno, strerror(errno));
-            return;
+
+    bytes = (frames - length) * block_align;
+    if (!wav_make_room(self, bytes)) {
+        return (int)g_err.code;
+    }
+    end = self->data_chunk.offset + self->ds64_chunk.body.data_size + bytes;
+
+#if defined(__linux__)
+    /* allocate the blocks up front, the write below leaves a hole if this is not
+     * supported, but running out of space has to fail before any frame is written */
+    if (self->fd >= 0) {
+        int ret = posix_fallocate(self->fd, (off_t)(end - bytes), (off_t)bytes);
+        if (ret != 0 && ret != EOPNOTSUPP && ret != EINVAL) {
+            wav_err_set(WAV_ERR_OS, "Error when allocating %s [errno %d: %s]", self->filename, ret, strerror(ret));
+            return (int)g_err.code;
         }
     }
-    if (fseek(self->fp, (long)(self->data_chunk.offset - 4), SEEK_SET) != 0) {
-        wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-        return;
+#endif
+
+    if (wav_io_seek(self, end - 1) != 0 || wav_io_write(self, &zero, 1) != 1 || wav_io_flush(self) != 0) {
+        wav_err_set(WAV_ERR_OS, "Error when writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return (int)g_err.code;
     }
-    if (fwrite(&self->data_chunk.header.size, 4, 1, self->fp) != 1) {
-        wav_err_set(WAV_ERR_OS, "fwrite() failed [errno %d: %s]", errno, strerror(errno));
-        return;
+
+    self->ds64_chunk.body.riff_size += bytes;
+    self->ds64_chunk.body.data_size += bytes;
+    self->ds64_chunk.body.sample_count = self->ds64_chunk.body.data_size / block_align;
+    wav_sync_sizes(self);
+    self->header_dirty = WAV_TRUE;
+    wav_update_sizes(self);
+
+    return (int)g_err.code;
+}
+
+int wav_claim_frames(WavFile* self, size_t count, WavU64* frame_offset)
+{
+    WavU64 bytes = (WavU64)count * self->format_chunk.body.block_align;
+
+    if (!wav_is_writable(self)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
+        return (int)g_err.code;
     }
-    if (fseek(self->fp, save_pos, SEEK_SET) != 0) {
-        wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
-        return;
+
+    /* whatever is buffered goes out before the claimed frames are written around it */
+    if (wav_io_flush(self) != 0) {
+        wav_err_set(WAV_ERR_OS, "Error when writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return (int)g_err.code;
     }
+
+    if (!wav_make_room(self, bytes)) {
+        return (int)g_err.code;
+    }
+
+    *frame_offset = wav_get_length(self);
+    self->ds64_chunk.body.riff_size += bytes;
+    self->ds64_chunk.body.data_size += bytes;
+    self->ds64_chunk.body.sample_count += count;
+    wav_sync_sizes(self);
+    self->header_dirty = WAV_TRUE;
+
+    return 0;
 }
 
-size_t wav_write(WavFile* self, WAV_CONST void *buffer, size_t count)
+WavU64 wav_data_offset(WAV_CONST WavFile* self)
+{
+    return self->data_chunk.offset;
+}
+
+int wav_pwrite(WavFile* self, WAV_CONST void *buffer, WavU64 frame_offset, size_t count)
+{
+    WavU64   block_align = self->format_chunk.body.block_align;
+    WavPatch patch;
+
+    if (frame_offset > wav_get_length(self) || count > wav_get_length(self) - frame_offset) {
+        wav_err_set(WAV_ERR_PARAM, "Frames [%llu, %llu) are out of range",
+                    (unsigned long long)frame_offset, (unsigned long long)(frame_offset + count));
+        return (int)g_err.code;
+    }
+
+    patch.offset = self->data_chunk.offset + frame_offset * block_align;
+    patch.data = buffer;
+    patch.size = (size_t)(count * block_align);
+    if (wav_io_patch(self, &patch, 1) != 0) {
+        wav_err_set(WAV_ERR_OS, "Error when writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return (int)g_err.code;
+    }
+
+    return 0;
+}
+
+/* Called to fill {dst} with {count} frames in the file format taken from frame {offset} of the caller's buffer */
+typedef void (*WavFillFunc)(void* context, void* dst, size_t offset, size_t count);
+
+/* Write {count} frames produced by {func} in blocks of at most {chunk} frames through the conversion buffer */
+static size_t wav_write_blocks(WavFile* self, size_t count, size_t chunk, WavFillFunc func, void* context)
 {
-    size_t write_count;
-    WavU16 n_channels = wav_get_num_channels(self);
-    size_t sample_size = wav_get_sample_size(self);
+    size_t total = 0;
 
     if (!(self->mode & WAV_OPEN_WRITE) && !(self->mode & WAV_OPEN_APPEND)) {
         wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return 0;
     }
 
-    if (self->format_chunk.body.format_tag == WAV_FORMAT_EXTENSIBLE) {
-        wav_err_set_literal(WAV_ERR_FORMAT, "Extensible format is not supported");
+    /* not even one frame fits the buffers */
+    if (chunk == 0) {
+        wav_err_set_literal(WAV_ERR_PARAM, "Too many channels to convert the frames");
         return 0;
     }
 
-    if (count == 0) {
+    if (!wav_alloc_convert_buffer(self)) {
         return 0;
     }
 
-    wav_tell(self);
-    if (g_err.code != WAV_OK) {
-        return 0;
-    }
+    while (total < count) {
+        size_t frames = count - total < chunk ? count - total : chunk;
+        size_t n;
 
-    if (!(self->mode & WAV_OPEN_READ) && !(self->mode & WAV_OPEN_WRITE)) {
-        wav_seek(self, 0, SEEK_END);
-        if (g_err.code != WAV_OK) {
-            return 0;
+        func(context, self->convert_buffer, total, frames);
+
+        n = wav_write(self, self->convert_buffer, frames);
+        total += n;
+        if (n < frames) {
+            break;
         }
     }
 
-    write_count = fwrite(buffer, sample_size, n_channels * count, self->fp);
-    if (ferror(self->fp)) {
-        wav_err_set(WAV_ERR_OS, "Error when writing to %s [errno %d: %s]", self->filename, errno, strerror(errno));
-        return 0;
+    return total;
+}
+
+typedef struct {
+    WavFile*            file;
+    WAV_CONST float*    buffer;
+    WavU16              n_channels;
+    WavSampleType       type;
+    WavBool             dither;
+    unsigned            valid_bits;     /* 0 if the samples fill their container */
+} WavQuantizeContext;
+
+static void wav_write_f32_block(void* context, void* dst, size_t offset, size_t count)
+{
+    WavQuantizeContext* ctx = context;
+    WavFile*            self = ctx->file;
+    size_t              n = count * ctx->n_channels;
+
+    if (ctx->dither) {
+        wav_tpdf_noise(self->dither_buffer, n, &self->dither_state);
     }
 
-    self->riff_chunk.size += write_count * sample_size;
-    if (self->fact_chunk.header.id == WAV_FACT_CHUNK_ID) {
-        self->fact_chunk.body.sample_length += write_count / n_channels;
+    /* round to the valid bits first, the padding bits then stay zero */
+    if (ctx->valid_bits != 0) {
+        self->clip_count += wav_round_f32(self->dither_buffer, ctx->buffer + offset * ctx->n_channels,
+                                          ctx->dither ? self->dither_buffer : NULL, n, ctx->valid_bits);
+        wav_convert_from_f32(dst, self->dither_buffer, NULL, n, ctx->type);
+        return;
     }
-    self->data_chunk.header.size += write_count * sample_size;
 
-    wav_update_sizes(self);
-    if (g_err.code != WAV_OK)
+    self->clip_count += wav_convert_from_f32(dst, ctx->buffer + offset * ctx->n_channels,
+                                             ctx->dither ? self->dither_buffer : NULL, n, ctx->type);
+}
+
+size_t wav_write_f32(WavFile* self, WAV_CONST float *buffer, size_t count)
+{
+    WavQuantizeContext ctx;
+    size_t             sample_size = wav_get_sample_size(self);
+    size_t             chunk;
+
+    ctx.file = self;
+    ctx.buffer = buffer;
+    ctx.n_channels = wav_get_num_channels(self);
+    ctx.type = wav_sample_type(wav_sample_format(self), sample_size);
+    ctx.dither = self->dither && ctx.type != WAV_SAMPLE_F32 && ctx.type != WAV_SAMPLE_F64;
+    ctx.valid_bits = wav_valid_bits(self);
+
+    self->clip_count = 0;
+
+    if (ctx.type == WAV_SAMPLE_UNKNOWN) {
+        wav_err_set(WAV_ERR_FORMAT, "Cannot convert to format %#06x with %zu-byte samples",
+                    wav_sample_format(self), sample_size);
         return 0;
+    }
+
+    /* the dither buffer also holds the rounded samples */
+    if ((ctx.dither || ctx.valid_bits != 0) && self->dither_buffer == NULL) {
+        self->dither_buffer = wav_malloc(WAV_IO_BUFFER_SIZE);
+        if (self->dither_buffer == NULL) {
+            wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the dither buffer");
+            return 0;
+        }
+    }
+
+    /* the dither buffer holds one float per sample */
+    chunk = WAV_IO_BUFFER_SIZE / (ctx.n_channels * (sample_size > sizeof(float) ? sample_size : sizeof(float)));
+
+    return wav_write_blocks(self, count, chunk, &wav_write_f32_block, &ctx);
+}
+
+typedef struct {
+    WAV_CONST void* WAV_CONST*  channels;
+    size_t                      n_channels;
+    size_t                      sample_size;
+} WavInterleaveContext;
+
+static void wav_write_planar_block(void* context, void* dst, size_t offset, size_t count)
+{
+    WavInterleaveContext* ctx = context;
+    wav_interleave(dst, ctx->channels, offset, ctx->n_channels, ctx->sample_size, count);
+}
+
+size_t wav_write_planar(WavFile* self, WAV_CONST void* WAV_CONST* channels, size_t count)
+{
+    WavInterleaveContext ctx;
 
-    return write_count / n_channels;
+    ctx.channels = channels;
+    ctx.n_channels = wav_get_num_channels(self);
+    ctx.sample_size = wav_get_sample_size(self);
+
+    return wav_write_blocks(self, count, WAV_IO_BUFFER_SIZE / self->format_chunk.body.block_align, &wav_write_planar_block, &ctx);
 }
 
-long int wav_tell(WAV_CONST WavFile* self)
+WavI64 wav_tell(WAV_CONST WavFile* self)
 {
-    long pos = ftell(self->fp);
+    WavI64 pos = wav_io_tell(self);
 
-    if (pos == -1L) {
+    if (pos == -1) {
         wav_err_set(WAV_ERR_OS, "ftell() failed [errno %d: %s]", errno, strerror(errno));
-        return -1L;
+        return -1;
     }
 
-    assert(pos >= (long)self->data_chunk.offset);
+    assert((WavU64)pos >= self->data_chunk.offset);
 
-    return (long)(((WavU64)pos - self->data_chunk.offset) / (self->format_chunk.body.block_align));
+    return (WavI64)(((WavU64)pos - self->data_chunk.offset) / (self->format_chunk.body.block_align));
 }
 
-int wav_seek(WavFile* self, long int offset, int origin)
+int wav_seek(WavFile* self, WavI64 offset, int origin)
 {
-    size_t length = wav_get_length(self);
+    WavU64 length = wav_get_length(self);
     int    ret;
 
     if (origin == SEEK_CUR) {
-        offset += (long)wav_tell(self);
+        offset += wav_tell(self);
     } else if (origin == SEEK_END) {
-        offset += (long)length;
+        offset += (WavI64)length;
     }
 
     /* POSIX allows seeking beyond end of file */
@@ -645,7 +3243,7 @@ int wav_seek(WavFile* self, long int offset, int origin)
         return (int)g_err.code;
     }
 
-    ret = fseek(self->fp, (long)self->data_chunk.offset + offset, SEEK_SET);
+    ret = wav_io_seek(self, self->data_chunk.offset + (WavU64)offset);
 
     if (ret != 0) {
         wav_err_set(WAV_ERR_OS, "fseek() failed [errno %d: %s]", errno, strerror(errno));
@@ -662,12 +3260,25 @@ void wav_rewind(WavFile* self)
 
 int wav_eof(WAV_CONST WavFile* self)
 {
-    return feof(self->fp) || ftell(self->fp) == (long)(self->data_chunk.offset + self->data_chunk.header.size);
+    return wav_io_eof(self) || (WavU64)wav_io_tell(self) == self->data_chunk.offset + self->ds64_chunk.body.data_size;
 }
 
 int wav_flush(WavFile* self)
 {
-    int ret = fflush(self->fp);
+    int ret;
+
+    if (self->durability != WAV_DURABILITY_NONE) {
+        return wav_sync(self);
+    }
+
+    if (self->header_dirty) {
+        wav_update_sizes(self);
+        if (g_err.code != WAV_OK) {
+            return (int)g_err.code;
+        }
+    }
+
+    ret = wav_io_flush(self);
 
     if (ret != 0) {
         wav_err_set(WAV_ERR_OS, "fflush() failed [errno %d: %s]", errno, strerror(errno));
@@ -676,9 +3287,153 @@ int wav_flush(WavFile* self)
     return ret;
 }
 
+WAV_CONST void* wav_map_frames(WAV_CONST WavFile* self, size_t start, size_t count)
+{
+    WavU64 begin;
+    WavU64 end;
+
+    if (!(self->mode & WAV_OPEN_MMAP)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not opened with WAV_OPEN_MMAP");
+        return NULL;
+    }
+
+    if (start > wav_get_length(self) || count > wav_get_length(self) - start) {
+        wav_err_set(WAV_ERR_PARAM, "Frames [%zu, %zu) are out of range", start, start + count);
+        return NULL;
+    }
+
+    begin = self->data_chunk.offset + (WavU64)start * self->format_chunk.body.block_align;
+    end = begin + (WavU64)count * self->format_chunk.body.block_align;
+    if (end > self->map_size) {
+        wav_err_set_literal(WAV_ERR_FORMAT, "The data chunk is truncated");
+        return NULL;
+    }
+
+    return self->map + begin;
+}
+
+int wav_map_advise(WavFile* self, WavMapAdvice advice)
+{
+#if WAV_HAVE_POSIX
+    int hint;
+
+    if (!(self->mode & WAV_OPEN_MMAP)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not opened with WAV_OPEN_MMAP");
+        return (int)g_err.code;
+    }
+
+    switch (advice) {
+        case WAV_MAP_NORMAL:
+            hint = MADV_NORMAL;
+            break;
+        case WAV_MAP_SEQUENTIAL:
+            hint = MADV_SEQUENTIAL;
+            break;
+        case WAV_MAP_RANDOM:
+            hint = MADV_RANDOM;
+            break;
+        case WAV_MAP_WILLNEED:
+            hint = MADV_WILLNEED;
+            break;
+        default:
+            wav_err_set(WAV_ERR_PARAM, "Invalid map advice: %d", (int)advice);
+            return (int)g_err.code;
+    }
+
+    if (self->map == NULL) {
+        return 0;
+    }
+
+    if (madvise((void*)self->map, self->map_size, hint) != 0) {
+        wav_err_set(WAV_ERR_OS, "madvise() failed [errno %d: %s]", errno, strerror(errno));
+        return (int)g_err.code;
+    }
+
+    return 0;
+#else
+    (void)self;
+    (void)advice;
+    wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not opened with WAV_OPEN_MMAP");
+    return (int)g_err.code;
+#endif
+}
+
+void wav_set_header_update(WavFile* self, WavHeaderUpdate policy, WavU64 interval)
+{
+    if (policy != WAV_HEADER_UPDATE_ALWAYS &&
+        policy != WAV_HEADER_UPDATE_ON_FLUSH &&
+        policy != WAV_HEADER_UPDATE_BYTES &&
+        policy != WAV_HEADER_UPDATE_MS)
+    {
+        wav_err_set(WAV_ERR_PARAM, "Invalid header update policy: %d", (int)policy);
+        return;
+    }
+
+    self->header_update = policy;
+    self->header_update_interval = interval;
+    self->header_last_update_ms = wav_now_ms();
+
+    if (policy == WAV_HEADER_UPDATE_ALWAYS && self->header_dirty) {
+        wav_update_sizes(self);
+    }
+}
+
+void wav_set_durability(WavFile* self, WavDurability policy, WavU64 interval, WavBool data_only)
+{
+    if (policy != WAV_DURABILITY_NONE &&
+        policy != WAV_DURABILITY_ON_CLOSE &&
+        policy != WAV_DURABILITY_BYTES &&
+        policy != WAV_DURABILITY_MS)
+    {
+        wav_err_set(WAV_ERR_PARAM, "Invalid durability policy: %d", (int)policy);
+        return;
+    }
+
+    self->durability = policy;
+    self->durability_interval = interval;
+    self->durability_data_only = data_only;
+    self->sync_pending_bytes = 0;
+    self->sync_last_ms = wav_now_ms();
+}
+
+int wav_reserve(WavFile* self, WavU64 frames)
+{
+    if (!wav_is_writable(self)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
+        return (int)g_err.code;
+    }
+
+    if (wav_reserve_bytes(self, self->data_chunk.offset + frames * self->format_chunk.body.block_align) != 0) {
+        wav_err_set(WAV_ERR_OS, "fallocate() failed on %s [errno %d: %s]", self->filename, errno, strerror(errno));
+        return (int)g_err.code;
+    }
+
+    return 0;
+}
+
+void wav_set_reserve_step(WavFile* self, WavU64 frames)
+{
+    self->reserve_step = frames;
+}
+
+void wav_set_dither(WavFile* self, WavBool enable)
+{
+    self->dither = enable;
+}
+
+WavI64 wav_get_recovered_frames(WAV_CONST WavFile* self)
+{
+    return self->recovered_frames;
+}
+
+size_t wav_get_clip_count(WAV_CONST WavFile* self)
+{
+    return self->clip_count;
+}
+
 void wav_set_format(WavFile* self, WavU16 format)
 {
-    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->data_chunk.header.size == 0)) {
+    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->ds64_chunk.body.data_size == 0)) {
         wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return;
     }
@@ -686,14 +3441,21 @@ void wav_set_format(WavFile* self, WavU16 format)
     if (format == self->format_chunk.body.format_tag)
         return;
 
-    self->format_chunk.body.format_tag = format;
-    if (format != WAV_FORMAT_PCM && format != WAV_FORMAT_EXTENSIBLE) {
+    if (format == WAV_FORMAT_EXTENSIBLE) {
+        /* the samples keep their format as the sub-format */
+        self->format_chunk.body.ext_size = 22;
+        self->format_chunk.body.valid_bits_per_sample = self->format_chunk.body.bits_per_sample;
+        self->format_chunk.body.sub_format[0] = (WavU8)(self->format_chunk.body.format_tag & 0xff);
+        self->format_chunk.body.sub_format[1] = (WavU8)(self->format_chunk.body.format_tag >> 8);
+        self->format_chunk.header.size = sizeof(self->format_chunk.body);
+    } else {
         self->format_chunk.body.ext_size = 0;
         self->format_chunk.header.size = (WavU32)((WavUIntPtr)&self->format_chunk.body.ext_size - (WavUIntPtr)&self->format_chunk.body);
-    } else if (format == WAV_FORMAT_EXTENSIBLE) {
-        self->format_chunk.body.ext_size = 22;
-        self->format_chunk.header.size = sizeof(WavFormatChunk) - sizeof(WavChunkHeader);
     }
+    self->format_chunk.body.format_tag = format;
+
+    /* the data chunk follows the format chunk, whose size may have changed */
+    self->data_chunk.offset = self->format_chunk.offset + self->format_chunk.header.size + sizeof(WavChunkHeader);
 
     if (format == WAV_FORMAT_ALAW || format == WAV_FORMAT_MULAW) {
         WavU16 sample_size = wav_get_sample_size(self);
@@ -712,7 +3474,7 @@ void wav_set_format(WavFile* self, WavU16 format)
 
 void wav_set_num_channels(WavFile* self, WavU16 num_channels)
 {
-    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->data_chunk.header.size == 0)) {
+    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->ds64_chunk.body.data_size == 0)) {
         wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return;
     }
@@ -735,7 +3497,7 @@ void wav_set_num_channels(WavFile* self, WavU16 num_channels)
 
 void wav_set_sample_rate(WavFile* self, WavU32 sample_rate)
 {
-    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->data_chunk.header.size == 0)) {
+    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->ds64_chunk.body.data_size == 0)) {
         wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return;
     }
@@ -751,7 +3513,7 @@ void wav_set_sample_rate(WavFile* self, WavU32 sample_rate)
 
 void wav_set_valid_bits_per_sample(WavFile* self, WavU16 bits)
 {
-    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->data_chunk.header.size == 0)) {
+    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->ds64_chunk.body.data_size == 0)) {
         wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return;
     }
@@ -778,7 +3540,7 @@ void wav_set_valid_bits_per_sample(WavFile* self, WavU16 bits)
 
 void wav_set_sample_size(WavFile* self, size_t sample_size)
 {
-    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->data_chunk.header.size == 0)) {
+    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->ds64_chunk.body.data_size == 0)) {
         wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return;
     }
@@ -800,13 +3562,13 @@ void wav_set_sample_size(WavFile* self, size_t sample_size)
 
 void wav_set_channel_mask(WavFile* self, WavU32 channel_mask)
 {
-    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->data_chunk.header.size == 0)) {
+    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->ds64_chunk.body.data_size == 0)) {
         wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return;
     }
 
     if (self->format_chunk.body.format_tag != WAV_FORMAT_EXTENSIBLE) {
-        wav_err_set_literal(WAV_ERR_FORMAT, "Extensible format is not supported");
+        wav_err_set_literal(WAV_ERR_FORMAT, "Only the extensible format has a channel mask");
         return;
     }
 
@@ -817,13 +3579,13 @@ void wav_set_channel_mask(WavFile* self, WavU32 channel_mask)
 
 void wav_set_sub_format(WavFile* self, WavU16 sub_format)
 {
-    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->data_chunk.header.size == 0)) {
+    if (!(self->mode & WAV_OPEN_WRITE) && !((self->mode & WAV_OPEN_APPEND) && self->is_a_new_file && self->ds64_chunk.body.data_size == 0)) {
         wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
         return;
     }
 
     if (self->format_chunk.body.format_tag != WAV_FORMAT_EXTENSIBLE) {
-        wav_err_set_literal(WAV_ERR_FORMAT, "Extensible format is not supported");
+        wav_err_set_literal(WAV_ERR_FORMAT, "Only the extensible format has a sub-format");
         return;
     }
 
@@ -862,9 +3624,9 @@ size_t wav_get_sample_size(WAV_CONST WavFile* self)
     return self->format_chunk.body.block_align / self->format_chunk.body.num_channels;
 }
 
-size_t wav_get_length(WAV_CONST WavFile* self)
+WavU64 wav_get_length(WAV_CONST WavFile* self)
 {
-    return self->data_chunk.header.size / (self->format_chunk.body.block_align);
+    return self->ds64_chunk.body.data_size / (self->format_chunk.body.block_align);
 }
 
 WavU32 wav_get_channel_mask(WAV_CONST WavFile* self)
@@ -0,0 +1,290 @@
+#include <string.h>
+
+#include "wav_internal.h"
+#include "wav_thread.h"
+
+/* bytes per write issued by the background thread */
+#define WAV_ASYNC_BATCH_SIZE    ((size_t)65536)
+
+/* the longest time queued frames wait before they are written */
+#define WAV_ASYNC_PERIOD_MS     ((WavU64)20)
+
+struct _WavAsyncWriter {
+    WavFile*        file;
+    WavU8*          ring;
+    size_t          capacity;           /* in frames, a power of two */
+    size_t          block_align;
+    size_t          batch;              /* frames per write, a power of two */
+
+    volatile size_t head;               /* frames queued, advanced by the producer */
+    volatile size_t tail;               /* frames written, advanced by the background thread */
+    volatile size_t failed;
+
+    volatile size_t overrun_count;
+    volatile size_t dropped_frames;
+    volatile size_t peak_fill;
+
+    WavThread       thread;
+    WavMutex        mutex;
+    WavCond         wake;               /* wakes the background thread */
+    WavCond         done;               /* a flush request has been served */
+
+    /* protected by mutex */
+    size_t          flush_requested;
+    size_t          flush_completed;
+    WavBool         stop;
+    WavErrCode      error_code;
+    char*           error_message;
+};
+
+/* Remember the error of the background thread and stop writing */
+static void wav_async_fail(WavAsyncWriter* self)
+{
+    wav_mutex_lock(&self->mutex);
+    if (self->error_code == WAV_OK) {
+        self->error_code = g_err.code != WAV_OK ? g_err.code : WAV_ERR_OS;
+        self->error_message = wav_strdup(g_err.code != WAV_OK ? g_err.message : "Short write");
+    }
+    wav_mutex_unlock(&self->mutex);
+    wav_atomic_store(&self->failed, 1);
+    wav_err_clear();
+}
+
+/* Write the queued frames. Writes never cross a multiple of {batch} frames in
+ * the ring, and a partial batch is only written if {all} is set. */
+static void wav_async_drain(WavAsyncWriter* self, WavBool all)
+{
+    size_t tail = self->tail;
+
+    while (!wav_atomic_load(&self->failed)) {
+        size_t head = wav_atomic_load(&self->head);
+        size_t index = tail & (self->capacity - 1);
+        size_t n = self->batch - (index & (self->batch - 1));
+
+        if (n > head - tail) {
+            n = head - tail;
+            if (n == 0 || !all) {
+                break;
+            }
+        }
+
+        if (wav_write(self->file, self->ring + index * self->block_align, n) != n || g_err.code != WAV_OK) {
+            wav_async_fail(self);
+            break;
+        }
+
+        tail += n;
+        wav_atomic_store(&self->tail, tail);
+    }
+}
+
+static WavThreadResult WAV_THREAD_CALL wav_async_main(void *arg)
+{
+    WavAsyncWriter* self = arg;
+    WavBool         timed_out = WAV_FALSE;
+
+    wav_mutex_lock(&self->mutex);
+    for (;;) {
+        size_t  flush_seq = self->flush_requested;
+        WavBool stop = self->stop;
+        WavBool flush = stop || flush_seq != self->flush_completed;
+
+        wav_mutex_unlock(&self->mutex);
+        wav_async_drain(self, flush || timed_out);
+        if (flush && !wav_atomic_load(&self->failed) && wav_flush(self->file) != 0) {
+            wav_async_fail(self);
+        }
+        wav_mutex_lock(&self->mutex);
+
+        if (flush_seq != self->flush_completed) {
+            self->flush_completed = flush_seq;
+            wav_cond_broadcast(&self->done);
+        }
+        if (stop) {
+            break;
+        }
+
+        timed_out = WAV_FALSE;
+        if (!self->stop && self->flush_requested == flush_seq) {
+            timed_out = wav_cond_timedwait(&self->wake, &self->mutex, WAV_ASYNC_PERIOD_MS) != 0;
+        }
+    }
+    wav_mutex_unlock(&self->mutex);
+
+    return (WavThreadResult)0;
+}
+
+WavAsyncWriter* wav_async_open(WavFile* file, size_t capacity)
+{
+    WavAsyncWriter* self;
+    size_t          block_align = wav_get_sample_size(file) * wav_get_num_channels(file);
+
+    if (!wav_is_writable(file)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not writable");
+        return NULL;
+    }
+
+    if (capacity < 2 || capacity > ((size_t)-1 >> 1) / block_align) {
+        wav_err_set(WAV_ERR_PARAM, "Invalid ring buffer capacity: %zu", capacity);
+        return NULL;
+    }
+
+    self = wav_malloc(sizeof(WavAsyncWriter));
+    if (self == NULL) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the async writer");
+        return NULL;
+    }
+    memset(self, 0, sizeof(WavAsyncWriter));
+
+    self->file = file;
+    self->block_align = block_align;
+    self->capacity = 2;
+    while (self->capacity < capacity) {
+        self->capacity <<= 1;
+    }
+
+    /* leave the producer a few batches of headroom while a write is in progress */
+    self->batch = 1;
+    while (self->batch * 2 * block_align <= WAV_ASYNC_BATCH_SIZE && self->batch * 8 <= self->capacity) {
+        self->batch <<= 1;
+    }
+
+    self->ring = wav_malloc(self->capacity * block_align);
+    if (self->ring == NULL) {
+        wav_free(self);
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the ring buffer");
+        return NULL;
+    }
+
+    wav_mutex_init(&self->mutex);
+    wav_cond_init(&self->wake);
+    wav_cond_init(&self->done);
+
+    if (wav_thread_create(&self->thread, &wav_async_main, self) != 0) {
+        wav_cond_destroy(&self->done);
+        wav_cond_destroy(&self->wake);
+        wav_mutex_destroy(&self->mutex);
+        wav_free(self->ring);
+        wav_free(self);
+        wav_err_set_literal(WAV_ERR_OS, "Failed to start the writer thread");
+        return NULL;
+    }
+
+    return self;
+}
+
+/* Report the error of the background thread in the calling thread */
+static int wav_async_error(WavAsyncWriter* self)
+{
+    if (self->error_code != WAV_OK) {
+        wav_err_set(self->error_code, "%s", self->error_message != NULL ? self->error_message : "");
+    }
+    return (int)self->error_code;
+}
+
+int wav_async_close(WavAsyncWriter* self)
+{
+    int ret;
+
+    wav_mutex_lock(&self->mutex);
+    self->stop = WAV_TRUE;
+    wav_cond_signal(&self->wake);
+    wav_mutex_unlock(&self->mutex);
+
+    wav_thread_join(self->thread);
+
+    ret = wav_async_error(self);
+
+    wav_cond_destroy(&self->done);
+    wav_cond_destroy(&self->wake);
+    wav_mutex_destroy(&self->mutex);
+    wav_free(self->error_message);
+    wav_free(self->ring);
+    wav_free(self);
+
+    return ret;
+}
+
+size_t wav_async_write(WavAsyncWriter* self, WAV_CONST void *buffer, size_t count)
+{
+    size_t head = self->head;
+    size_t tail = wav_atomic_load(&self->tail);
+    size_t space = self->capacity - (head - tail);
+    size_t index = head & (self->capacity - 1);
+    size_t first;
+    size_t n;
+
+    if (wav_atomic_load(&self->failed)) {
+        wav_err_set_literal(WAV_ERR_OS, "The async writer stopped after an error");
+        return 0;
+    }
+
+    n = count <= space ? count : space;
+    if (n < count) {
+        wav_atomic_add(&self->overrun_count, 1);
+        wav_atomic_add(&self->dropped_frames, count - n);
+    }
+
+    first = self->capacity - index;
+    first = n <= first ? n : first;
+    memcpy(self->ring + index * self->block_align, buffer, first * self->block_align);
+    memcpy(self->ring, (WAV_CONST WavU8*)buffer + first * self->block_align, (n - first) * self->block_align);
+
+    wav_atomic_store(&self->head, head + n);
+
+    if (head + n - tail > self->peak_fill) {
+        wav_atomic_store(&self->peak_fill, head + n - tail);
+    }
+
+    /* wake the writer once per batch, it polls for anything less */
+    if ((head & ~(self->batch - 1)) != ((head + n) & ~(self->batch - 1))) {
+        wav_cond_signal(&self->wake);
+    }
+
+    return n;
+}
+
+int wav_async_flush(WavAsyncWriter* self, WavU64 timeout_ms)
+{
+    WavU64 start = wav_now_ms();
+    size_t seq;
+    int    ret;
+
+    wav_mutex_lock(&self->mutex);
+    seq = ++self->flush_requested;
+    wav_cond_signal(&self->wake);
+
+    while (self->flush_completed < seq) {
+        WavU64 elapsed = wav_now_ms() - start;
+        WavU64 wait;
+
+        if (elapsed >= timeout_ms) {
+            wav_mutex_unlock(&self->mutex);
+            wav_err_set(WAV_ERR_TIMEOUT, "wav_async_flush() timed out after %llu ms", (unsigned long long)timeout_ms);
+            return (int)g_err.code;
+        }
+
+        /* wait in slices so that huge timeouts do not overflow the wait functions */
+        wait = timeout_ms - elapsed;
+        wav_cond_timedwait(&self->done, &self->mutex, wait < 1000 ? wait : 1000);
+    }
+    ret = wav_async_error(self);
+    wav_mutex_unlock(&self->mutex);
+
+    return ret;
+}
+
+size_t wav_async_get_overrun_count(WAV_CONST WavAsyncWriter* self)
+{
+    return wav_atomic_load(&self->overrun_count);
+}
+
+size_t wav_async_get_dropped_frames(WAV_CONST WavAsyncWriter* self)
+{
+    return wav_atomic_load(&self->dropped_frames);
+}
+
+size_t wav_async_get_peak_fill(WAV_CONST WavAsyncWriter* self)
+{
+    return wav_atomic_load(&self->peak_fill);
+}
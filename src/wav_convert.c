@@ -0,0 +1,1512 @@
+#include <math.h>
+#include <string.h>
+
+#include "wav_convert.h"
+
+#if defined(__x86_64__) || defined(__x86_64) || defined(__amd64) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define WAV_ARCH_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if WAV_ARCH_X86 && (defined(__GNUC__) || defined(__clang__))
+#define WAV_TARGET_SSE2 __attribute__((target("sse2")))
+#define WAV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define WAV_TARGET_SSE2
+#define WAV_TARGET_AVX2
+#endif
+
+typedef enum {
+    WAV_ISA_SCALAR,
+    WAV_ISA_SSE2,
+    WAV_ISA_AVX2,
+} WavIsa;
+
+static WavIsa wav_detect_isa(void)
+{
+#if WAV_ARCH_X86 && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return WAV_ISA_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return WAV_ISA_SSE2;
+    return WAV_ISA_SCALAR;
+#elif WAV_ARCH_X86 && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        int ext[4];
+        __cpuid(info, 1);
+        __cpuidex(ext, 7, 0);
+        /* OSXSAVE, AVX and the OS saving YMM state */
+        if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6 && (ext[1] & (1 << 5)))
+            return WAV_ISA_AVX2;
+    }
+    __cpuid(info, 1);
+    if (info[3] & (1 << 26))
+        return WAV_ISA_SSE2;
+    return WAV_ISA_SCALAR;
+#else
+    return WAV_ISA_SCALAR;
+#endif
+}
+
+static WavIsa wav_isa(void)
+{
+    /* detection is idempotent, so racing initializations store the same value */
+    static volatile int isa = -1;
+    if (isa < 0)
+        isa = (int)wav_detect_isa();
+    return (WavIsa)isa;
+}
+
+static size_t wav_sample_type_size(WavSampleType type)
+{
+    switch (type) {
+        case WAV_SAMPLE_U8:
+        case WAV_SAMPLE_ALAW:
+        case WAV_SAMPLE_MULAW:
+            return 1;
+        case WAV_SAMPLE_I16:
+            return 2;
+        case WAV_SAMPLE_I24:
+            return 3;
+        case WAV_SAMPLE_I32:
+        case WAV_SAMPLE_F32:
+            return 4;
+        case WAV_SAMPLE_F64:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+WavSampleType wav_sample_type(WavU16 format_tag, size_t sample_size)
+{
+    if (format_tag == WAV_FORMAT_PCM) {
+        switch (sample_size) {
+            case 1:
+                return WAV_SAMPLE_U8;
+            case 2:
+                return WAV_SAMPLE_I16;
+            case 3:
+                return WAV_SAMPLE_I24;
+            case 4:
+                return WAV_SAMPLE_I32;
+        }
+    } else if (format_tag == WAV_FORMAT_IEEE_FLOAT) {
+        switch (sample_size) {
+            case 4:
+                return WAV_SAMPLE_F32;
+            case 8:
+                return WAV_SAMPLE_F64;
+        }
+    } else if (format_tag == WAV_FORMAT_ALAW && sample_size == 1) {
+        return WAV_SAMPLE_ALAW;
+    } else if (format_tag == WAV_FORMAT_MULAW && sample_size == 1) {
+        return WAV_SAMPLE_MULAW;
+    }
+    return WAV_SAMPLE_UNKNOWN;
+}
+
+/* portable kernels */
+
+WAV_INLINE WavI32 wav_load_i24(WAV_CONST WavU8* p)
+{
+    return (WavI32)((WavU32)p[0] << 8 | (WavU32)p[1] << 16 | (WavU32)p[2] << 24) >> 8;
+}
+
+/* Unpack 4 packed 24-bit samples with three 32-bit loads */
+WAV_INLINE void wav_load_i24x4(WAV_CONST WavU8* p, WavI32* out)
+{
+    WavU32 a, b, c;
+    memcpy(&a, p, 4);
+    memcpy(&b, p + 4, 4);
+    memcpy(&c, p + 8, 4);
+    out[0] = (WavI32)(a << 8) >> 8;
+    out[1] = (WavI32)((a >> 24) << 8 | b << 16) >> 8;
+    out[2] = (WavI32)((b >> 16) << 8 | c << 24) >> 8;
+    out[3] = (WavI32)c >> 8;
+}
+
+WAV_INLINE WavI16 wav_f32_to_i16(float x)
+{
+    float v = x * 32768.0f;
+    if (!(v > -32768.0f))
+        return -32768;
+    if (v >= 32767.0f)
+        return 32767;
+    return (WavI16)lrintf(v);
+}
+
+/* G.711 decoding tables, padded with an entry so that 32-bit gathers of the
+ * last code stay inside the table */
+static WAV_CONST WavI16 wav_alaw_table[257] = {
+     -5504,  -5248,  -6016,  -5760,  -4480,  -4224,  -4992,  -4736,
+     -7552,  -7296,  -8064,  -7808,  -6528,  -6272,  -7040,  -6784,
+     -2752,  -2624,  -3008,  -2880,  -2240,  -2112,  -2496,  -2368,
+     -3776,  -3648,  -4032,  -3904,  -3264,  -3136,  -3520,  -3392,
+    -22016, -20992, -24064, -23040, -17920, -16896, -19968, -18944,
+    -30208, -29184, -32256, -31232, -26112, -25088, -28160, -27136,
+    -11008, -10496, -12032, -11520,  -8960,  -8448,  -9984,  -9472,
+    -15104, -14592, -16128, -15616, -13056, -12544, -14080, -13568,
+      -344,   -328,   -376,   -360,   -280,   -264,   -312,   -296,
+      -472,   -456,   -504,   -488,   -408,   -392,   -440,   -424,
+       -88,    -72,   -120,   -104,    -24,     -8,    -56,    -40,
+      -216,   -200,   -248,   -232,   -152,   -136,   -184,   -168,
+     -1376,  -1312,  -1504,  -1440,  -1120,  -1056,  -1248,  -1184,
+     -1888,  -1824,  -2016,  -1952,  -1632,  -1568,  -1760,  -1696,
+      -688,   -656,   -752,   -720,   -560,   -528,   -624,   -592,
+      -944,   -912,  -1008,   -976,   -816,   -784,   -880,   -848,
+      5504,   5248,   6016,   5760,   4480,   4224,   4992,   4736,
+      7552,   7296,   8064,   7808,   6528,   6272,   7040,   6784,
+      2752,   2624,   3008,   2880,   2240,   2112,   2496,   2368,
+      3776,   3648,   4032,   3904,   3264,   3136,   3520,   3392,
+     22016,  20992,  24064,  23040,  17920,  16896,  19968,  18944,
+     30208,  29184,  32256,  31232,  26112,  25088,  28160,  27136,
+     11008,  10496,  12032,  11520,   8960,   8448,   9984,   9472,
+     15104,  14592,  16128,  15616,  13056,  12544,  14080,  13568,
+       344,    328,    376,    360,    280,    264,    312,    296,
+       472,    456,    504,    488,    408,    392,    440,    424,
+        88,     72,    120,    104,     24,      8,     56,     40,
+       216,    200,    248,    232,    152,    136,    184,    168,
+      1376,   1312,   1504,   1440,   1120,   1056,   1248,   1184,
+      1888,   1824,   2016,   1952,   1632,   1568,   1760,   1696,
+       688,    656,    752,    720,    560,    528,    624,    592,
+       944,    912,   1008,    976,    816,    784,    880,    848,
+    0,
+};
+
+static WAV_CONST WavI16 wav_mulaw_table[257] = {
+    -32124, -31100, -30076, -29052, -28028, -27004, -25980, -24956,
+    -23932, -22908, -21884, -20860, -19836, -18812, -17788, -16764,
+    -15996, -15484, -14972, -14460, -13948, -13436, -12924, -12412,
+    -11900, -11388, -10876, -10364,  -9852,  -9340,  -8828,  -8316,
+     -7932,  -7676,  -7420,  -7164,  -6908,  -6652,  -6396,  -6140,
+     -5884,  -5628,  -5372,  -5116,  -4860,  -4604,  -4348,  -4092,
+     -3900,  -3772,  -3644,  -3516,  -3388,  -3260,  -3132,  -3004,
+     -2876,  -2748,  -2620,  -2492,  -2364,  -2236,  -2108,  -1980,
+     -1884,  -1820,  -1756,  -1692,  -1628,  -1564,  -1500,  -1436,
+     -1372,  -1308,  -1244,  -1180,  -1116,  -1052,   -988,   -924,
+      -876,   -844,   -812,   -780,   -748,   -716,   -684,   -652,
+      -620,   -588,   -556,   -524,   -492,   -460,   -428,   -396,
+      -372,   -356,   -340,   -324,   -308,   -292,   -276,   -260,
+      -244,   -228,   -212,   -196,   -180,   -164,   -148,   -132,
+      -120,   -112,   -104,    -96,    -88,    -80,    -72,    -64,
+       -56,    -48,    -40,    -32,    -24,    -16,     -8,      0,
+     32124,  31100,  30076,  29052,  28028,  27004,  25980,  24956,
+     23932,  22908,  21884,  20860,  19836,  18812,  17788,  16764,
+     15996,  15484,  14972,  14460,  13948,  13436,  12924,  12412,
+     11900,  11388,  10876,  10364,   9852,   9340,   8828,   8316,
+      7932,   7676,   7420,   7164,   6908,   6652,   6396,   6140,
+      5884,   5628,   5372,   5116,   4860,   4604,   4348,   4092,
+      3900,   3772,   3644,   3516,   3388,   3260,   3132,   3004,
+      2876,   2748,   2620,   2492,   2364,   2236,   2108,   1980,
+      1884,   1820,   1756,   1692,   1628,   1564,   1500,   1436,
+      1372,   1308,   1244,   1180,   1116,   1052,    988,    924,
+       876,    844,    812,    780,    748,    716,    684,    652,
+       620,    588,    556,    524,    492,    460,    428,    396,
+       372,    356,    340,    324,    308,    292,    276,    260,
+       244,    228,    212,    196,    180,    164,    148,    132,
+       120,    112,    104,     96,     88,     80,     72,     64,
+        56,     48,     40,     32,     24,     16,      8,      0,
+    0,
+};
+
+/* G.711 encoding without branches or tables: the segment is the number of
+ * thresholds the magnitude exceeds, the mantissa the 4 bits below its leading
+ * one. Matches the reference encoder, which truncates. */
+
+WAV_INLINE WavU8 wav_alaw_encode(WavI16 x)
+{
+    int      p = x >> 3;
+    int      sign = p >> 15;
+    unsigned m = (unsigned)(p ^ sign);  /* -p - 1 for negative samples, at most 0xfff */
+    unsigned seg = (m > 0x1f) + (m > 0x3f) + (m > 0x7f) + (m > 0xff) + (m > 0x1ff) + (m > 0x3ff) + (m > 0x7ff);
+    unsigned shift = seg + (seg == 0);
+
+    return (WavU8)((seg << 4 | ((m >> shift) & 0xf)) ^ (0x55u | (~(unsigned)sign & 0x80u)));
+}
+
+WAV_INLINE WavU8 wav_mulaw_encode(WavI16 x)
+{
+    int      p = x >> 2;
+    int      sign = p >> 15;
+    unsigned m = (unsigned)((p ^ sign) - sign) + 33;
+    unsigned seg;
+
+    m = m < 0x1fff ? m : 0x1fff;
+    seg = (m > 0x3f) + (m > 0x7f) + (m > 0xff) + (m > 0x1ff) + (m > 0x3ff) + (m > 0x7ff) + (m > 0xfff);
+
+    return (WavU8)((seg << 4 | ((m >> (seg + 1)) & 0xf)) ^ (0x7fu | (~(unsigned)sign & 0x80u)));
+}
+
+static void wav_to_f32_scalar(float* WAV_RESTRICT dst, WAV_CONST WavU8* WAV_RESTRICT src, size_t n, WavSampleType type)
+{
+    size_t i = 0;
+
+    switch (type) {
+        case WAV_SAMPLE_U8:
+            for (; i < n; ++i)
+                dst[i] = (float)((int)src[i] - 128) * (1.0f / 128.0f);
+            break;
+        case WAV_SAMPLE_I16:
+            for (; i < n; ++i) {
+                WavI16 x;
+                memcpy(&x, src + 2 * i, 2);
+                dst[i] = (float)x * (1.0f / 32768.0f);
+            }
+            break;
+        case WAV_SAMPLE_I24:
+            for (; i + 4 <= n; i += 4) {
+                WavI32 x[4];
+                wav_load_i24x4(src + 3 * i, x);
+                dst[i + 0] = (float)x[0] * (1.0f / 8388608.0f);
+                dst[i + 1] = (float)x[1] * (1.0f / 8388608.0f);
+                dst[i + 2] = (float)x[2] * (1.0f / 8388608.0f);
+                dst[i + 3] = (float)x[3] * (1.0f / 8388608.0f);
+            }
+            for (; i < n; ++i)
+                dst[i] = (float)wav_load_i24(src + 3 * i) * (1.0f / 8388608.0f);
+            break;
+        case WAV_SAMPLE_I32:
+            for (; i < n; ++i) {
+                WavI32 x;
+                memcpy(&x, src + 4 * i, 4);
+                dst[i] = (float)x * (1.0f / 2147483648.0f);
+            }
+            break;
+        case WAV_SAMPLE_F32:
+            memcpy(dst, src, n * sizeof(float));
+            break;
+        case WAV_SAMPLE_F64:
+            for (; i < n; ++i) {
+                double x;
+                memcpy(&x, src + 8 * i, 8);
+                dst[i] = (float)x;
+            }
+            break;
+        case WAV_SAMPLE_ALAW:
+            for (; i < n; ++i)
+                dst[i] = (float)wav_alaw_table[src[i]] * (1.0f / 32768.0f);
+            break;
+        case WAV_SAMPLE_MULAW:
+            for (; i < n; ++i)
+                dst[i] = (float)wav_mulaw_table[src[i]] * (1.0f / 32768.0f);
+            break;
+        default:
+            break;
+    }
+}
+
+static void wav_to_i16_scalar(WavI16* WAV_RESTRICT dst, WAV_CONST WavU8* WAV_RESTRICT src, size_t n, WavSampleType type)
+{
+    size_t i = 0;
+
+    switch (type) {
+        case WAV_SAMPLE_U8:
+            for (; i < n; ++i)
+                dst[i] = (WavI16)(((int)src[i] - 128) * 256);
+            break;
+        case WAV_SAMPLE_I16:
+            memcpy(dst, src, n * sizeof(WavI16));
+            break;
+        case WAV_SAMPLE_I24:
+            for (; i < n; ++i)
+                dst[i] = (WavI16)((WavU16)src[3 * i + 1] | (WavU16)src[3 * i + 2] << 8);
+            break;
+        case WAV_SAMPLE_I32:
+            for (; i < n; ++i) {
+                WavI32 x;
+                memcpy(&x, src + 4 * i, 4);
+                dst[i] = (WavI16)(x >> 16);
+            }
+            break;
+        case WAV_SAMPLE_F32:
+            for (; i < n; ++i) {
+                float x;
+                memcpy(&x, src + 4 * i, 4);
+                dst[i] = wav_f32_to_i16(x);
+            }
+            break;
+        case WAV_SAMPLE_F64:
+            for (; i < n; ++i) {
+                double x;
+                memcpy(&x, src + 8 * i, 8);
+                dst[i] = wav_f32_to_i16((float)x);
+            }
+            break;
+        case WAV_SAMPLE_ALAW:
+            for (; i < n; ++i)
+                dst[i] = wav_alaw_table[src[i]];
+            break;
+        case WAV_SAMPLE_MULAW:
+            for (; i < n; ++i)
+                dst[i] = wav_mulaw_table[src[i]];
+            break;
+        default:
+            break;
+    }
+}
+
+/* full scale and clipping limits of the integer targets, the upper limit of
+ * 32-bit PCM is the largest float below 2^31 */
+typedef struct {
+    float scale;
+    float lo;
+    float hi;
+} WavQuantizer;
+
+static int wav_quantizer(WavSampleType type, WavQuantizer* q)
+{
+    switch (type) {
+        case WAV_SAMPLE_U8:
+            q->scale = 128.0f;
+            q->lo = -128.0f;
+            q->hi = 127.0f;
+            return 1;
+        case WAV_SAMPLE_I16:
+        case WAV_SAMPLE_ALAW:       /* companded from 16-bit PCM */
+        case WAV_SAMPLE_MULAW:
+            q->scale = 32768.0f;
+            q->lo = -32768.0f;
+            q->hi = 32767.0f;
+            return 1;
+        case WAV_SAMPLE_I24:
+            q->scale = 8388608.0f;
+            q->lo = -8388608.0f;
+            q->hi = 8388607.0f;
+            return 1;
+        case WAV_SAMPLE_I32:
+            q->scale = 2147483648.0f;
+            q->lo = -2147483648.0f;
+            q->hi = 2147483520.0f;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+WAV_INLINE WavI32 wav_quantize(float x, float noise, WAV_CONST WavQuantizer* q, size_t* clipped)
+{
+    float v = x * q->scale + noise;
+    if (v < q->lo) {
+        ++*clipped;
+        v = q->lo;
+    } else if (v > q->hi) {
+        ++*clipped;
+        v = q->hi;
+    } else if (v != v) {
+        v = q->lo;
+    }
+    return (WavI32)lrintf(v);
+}
+
+WAV_INLINE void wav_store_i24(WavU8* p, WavI32 x)
+{
+    p[0] = (WavU8)x;
+    p[1] = (WavU8)(x >> 8);
+    p[2] = (WavU8)(x >> 16);
+}
+
+static size_t wav_from_f32_scalar(WavU8* WAV_RESTRICT dst, WAV_CONST float* WAV_RESTRICT src, WAV_CONST float* WAV_RESTRICT noise, size_t n, WavSampleType type)
+{
+    WavQuantizer q;
+    size_t       clipped = 0;
+    size_t       i;
+
+    if (type == WAV_SAMPLE_F32) {
+        memcpy(dst, src, n * sizeof(float));
+        return 0;
+    }
+    if (type == WAV_SAMPLE_F64) {
+        for (i = 0; i < n; ++i) {
+            double x = src[i];
+            memcpy(dst + 8 * i, &x, 8);
+        }
+        return 0;
+    }
+    if (!wav_quantizer(type, &q)) {
+        return 0;
+    }
+
+    for (i = 0; i < n; ++i) {
+        WavI32 x = wav_quantize(src[i], noise != NULL ? noise[i] : 0.0f, &q, &clipped);
+        switch (type) {
+            case WAV_SAMPLE_U8:
+                dst[i] = (WavU8)(x + 128);
+                break;
+            case WAV_SAMPLE_I16: {
+                WavI16 y = (WavI16)x;
+                memcpy(dst + 2 * i, &y, 2);
+                break;
+            }
+            case WAV_SAMPLE_I24:
+                wav_store_i24(dst + 3 * i, x);
+                break;
+            case WAV_SAMPLE_ALAW:
+                dst[i] = wav_alaw_encode((WavI16)x);
+                break;
+            case WAV_SAMPLE_MULAW:
+                dst[i] = wav_mulaw_encode((WavI16)x);
+                break;
+            default:
+                memcpy(dst + 4 * i, &x, 4);
+                break;
+        }
+    }
+
+    return clipped;
+}
+
+/* portable (de)interleaving, the switch lets the compiler turn the copies into plain loads and stores */
+
+#define WAV_DEINTERLEAVE_LOOP(size)                                                                 \
+    for (i = 0; i < count; ++i)                                                                     \
+        for (c = 0; c < n_channels; ++c)                                                            \
+            memcpy((WavU8*)dst[c] + (offset + i) * (size), s + (i * n_channels + c) * (size), (size))
+
+#define WAV_INTERLEAVE_LOOP(size)                                                                   \
+    for (i = 0; i < count; ++i)                                                                     \
+        for (c = 0; c < n_channels; ++c)                                                            \
+            memcpy(d + (i * n_channels + c) * (size), (WAV_CONST WavU8*)src[c] + (offset + i) * (size), (size))
+
+static void wav_deinterleave_scalar(void* WAV_CONST* dst, size_t offset, WAV_CONST WavU8* s, size_t n_channels, size_t sample_size, size_t count)
+{
+    size_t i, c;
+
+    switch (sample_size) {
+        case 1:
+            WAV_DEINTERLEAVE_LOOP(1);
+            break;
+        case 2:
+            WAV_DEINTERLEAVE_LOOP(2);
+            break;
+        case 3:
+            WAV_DEINTERLEAVE_LOOP(3);
+            break;
+        case 4:
+            WAV_DEINTERLEAVE_LOOP(4);
+            break;
+        case 8:
+            WAV_DEINTERLEAVE_LOOP(8);
+            break;
+        default:
+            WAV_DEINTERLEAVE_LOOP(sample_size);
+            break;
+    }
+}
+
+static void wav_interleave_scalar(WavU8* d, WAV_CONST void* WAV_CONST* src, size_t offset, size_t n_channels, size_t sample_size, size_t count)
+{
+    size_t i, c;
+
+    switch (sample_size) {
+        case 1:
+            WAV_INTERLEAVE_LOOP(1);
+            break;
+        case 2:
+            WAV_INTERLEAVE_LOOP(2);
+            break;
+        case 3:
+            WAV_INTERLEAVE_LOOP(3);
+            break;
+        case 4:
+            WAV_INTERLEAVE_LOOP(4);
+            break;
+        case 8:
+            WAV_INTERLEAVE_LOOP(8);
+            break;
+        default:
+            WAV_INTERLEAVE_LOOP(sample_size);
+            break;
+    }
+}
+
+#if WAV_ARCH_X86
+
+/* SSE2 kernels, each returns the number of samples converted; the caller
+ * finishes the tail with the portable kernel. */
+
+WAV_TARGET_SSE2
+static size_t wav_to_f32_sse2(float* WAV_RESTRICT dst, WAV_CONST WavU8* WAV_RESTRICT src, size_t n, WavSampleType type)
+{
+    size_t i = 0;
+
+    switch (type) {
+        case WAV_SAMPLE_U8: {
+            __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+            __m128i zero = _mm_setzero_si128();
+            __m128i bias = _mm_set1_epi16(128);
+            for (; i + 16 <= n; i += 16) {
+                __m128i v = _mm_loadu_si128((WAV_CONST __m128i*)(src + i));
+                __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), bias);
+                __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), bias);
+                _mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16)), scale));
+                _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16)), scale));
+                _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16)), scale));
+                _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16)), scale));
+            }
+            break;
+        }
+        case WAV_SAMPLE_I16: {
+            __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+            for (; i + 8 <= n; i += 8) {
+                __m128i v = _mm_loadu_si128((WAV_CONST __m128i*)(src + 2 * i));
+                _mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale));
+                _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale));
+            }
+            break;
+        }
+        case WAV_SAMPLE_I24: {
+            __m128 scale = _mm_set1_ps(1.0f / 8388608.0f);
+            for (; i + 4 <= n; i += 4) {
+                WavI32 x[4];
+                wav_load_i24x4(src + 3 * i, x);
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((WAV_CONST __m128i*)x)), scale));
+            }
+            break;
+        }
+        case WAV_SAMPLE_I32: {
+            __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+            for (; i + 4 <= n; i += 4) {
+                __m128i v = _mm_loadu_si128((WAV_CONST __m128i*)(src + 4 * i));
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+            }
+            break;
+        }
+        case WAV_SAMPLE_F64:
+            for (; i + 4 <= n; i += 4) {
+                __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd((WAV_CONST double*)(src + 8 * i)));
+                __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd((WAV_CONST double*)(src + 8 * i + 16)));
+                _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+            }
+            break;
+        case WAV_SAMPLE_ALAW:
+        case WAV_SAMPLE_MULAW: {
+            /* SSE2 has no gather, the lookups are scalar and only the conversion is vectorized */
+            WAV_CONST WavI16* table = type == WAV_SAMPLE_ALAW ? wav_alaw_table : wav_mulaw_table;
+            __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+            for (; i + 8 <= n; i += 8) {
+                WAV_CONST WavU8* s = src + i;
+                __m128i v = _mm_setr_epi16(table[s[0]], table[s[1]], table[s[2]], table[s[3]],
+                                           table[s[4]], table[s[5]], table[s[6]], table[s[7]]);
+                _mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale));
+                _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    return i;
+}
+
+WAV_TARGET_SSE2
+static size_t wav_to_i16_sse2(WavI16* WAV_RESTRICT dst, WAV_CONST WavU8* WAV_RESTRICT src, size_t n, WavSampleType type)
+{
+    size_t i = 0;
+
+    switch (type) {
+        case WAV_SAMPLE_U8: {
+            __m128i zero = _mm_setzero_si128();
+            __m128i bias = _mm_set1_epi16(128);
+            for (; i + 16 <= n; i += 16) {
+                __m128i v = _mm_loadu_si128((WAV_CONST __m128i*)(src + i));
+                _mm_storeu_si128((__m128i*)(dst + i + 0), _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(v, zero), bias), 8));
+                _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(v, zero), bias), 8));
+            }
+            break;
+        }
+        case WAV_SAMPLE_I32:
+            for (; i + 8 <= n; i += 8) {
+                __m128i a = _mm_srai_epi32(_mm_loadu_si128((WAV_CONST __m128i*)(src + 4 * i)), 16);
+                __m128i b = _mm_srai_epi32(_mm_loadu_si128((WAV_CONST __m128i*)(src + 4 * i + 16)), 16);
+                _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(a, b));
+            }
+            break;
+        case WAV_SAMPLE_F32: {
+            __m128 scale = _mm_set1_ps(32768.0f);
+            __m128 lo = _mm_set1_ps(-32768.0f);
+            __m128 hi = _mm_set1_ps(32767.0f);
+            for (; i + 8 <= n; i += 8) {
+                /* clamp before converting, out of range values would become INT_MIN; max() maps NaN to -32768 */
+                __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps((WAV_CONST float*)(src + 4 * i)), scale), lo), hi));
+                __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps((WAV_CONST float*)(src + 4 * i + 16)), scale), lo), hi));
+                _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(a, b));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    return i;
+}
+
+static WAV_CONST WavU8 wav_popcount4[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+/* Scale, dither, count and clamp 4 samples. max() maps NaN to the lower limit
+ * like the portable kernel does. */
+WAV_TARGET_SSE2
+static __m128i wav_quantize_sse2(__m128 x, __m128 noise, __m128 scale, __m128 lo, __m128 hi, size_t* clipped)
+{
+    __m128 v = _mm_add_ps(_mm_mul_ps(x, scale), noise);
+    *clipped += wav_popcount4[_mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(v, lo), _mm_cmpgt_ps(v, hi)))];
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+}
+
+static WAV_CONST WavI16 wav_alaw_thresholds[7] = {0x1f, 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff};
+static WAV_CONST WavI16 wav_mulaw_thresholds[7] = {0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff};
+
+/* Encode 8 16-bit samples to A-law or mu-law codes in 16-bit lanes like the
+ * portable encoders. The variable right shift of the magnitude is a high
+ * multiply by 2^(16 - shift), halved for every threshold it exceeds. */
+WAV_TARGET_SSE2
+static __m128i wav_g711_encode_sse2(__m128i x, WavSampleType type)
+{
+    __m128i seg = _mm_setzero_si128();
+    __m128i mul = _mm_set1_epi16(-32768);
+    __m128i p, sign, m, code;
+
+    if (type == WAV_SAMPLE_ALAW) {
+        p = _mm_srai_epi16(x, 3);
+        sign = _mm_srai_epi16(p, 15);
+        m = _mm_xor_si128(p, sign);
+        for (int k = 0; k < 7; ++k) {
+            __m128i gt = _mm_cmpgt_epi16(m, _mm_set1_epi16(wav_alaw_thresholds[k]));
+            seg = _mm_sub_epi16(seg, gt);
+            /* the first two segments share a shift of 1 */
+            if (k > 0)
+                mul = _mm_sub_epi16(mul, _mm_and_si128(_mm_srli_epi16(mul, 1), gt));
+        }
+    } else {
+        p = _mm_srai_epi16(x, 2);
+        sign = _mm_srai_epi16(p, 15);
+        m = _mm_min_epi16(_mm_add_epi16(_mm_sub_epi16(_mm_xor_si128(p, sign), sign), _mm_set1_epi16(33)), _mm_set1_epi16(0x1fff));
+        for (int k = 0; k < 7; ++k) {
+            __m128i gt = _mm_cmpgt_epi16(m, _mm_set1_epi16(wav_mulaw_thresholds[k]));
+            seg = _mm_sub_epi16(seg, gt);
+            mul = _mm_sub_epi16(mul, _mm_and_si128(_mm_srli_epi16(mul, 1), gt));
+        }
+    }
+
+    code = _mm_or_si128(_mm_slli_epi16(seg, 4), _mm_and_si128(_mm_mulhi_epu16(m, mul), _mm_set1_epi16(0xf)));
+    return _mm_xor_si128(code, _mm_or_si128(_mm_set1_epi16(type == WAV_SAMPLE_ALAW ? 0x55 : 0x7f),
+                                            _mm_andnot_si128(sign, _mm_set1_epi16(0x80))));
+}
+
+WAV_TARGET_SSE2
+static size_t wav_from_f32_sse2(WavU8* WAV_RESTRICT dst, WAV_CONST float* WAV_RESTRICT src, WAV_CONST float* WAV_RESTRICT noise, size_t n, WavSampleType type, size_t* clipped)
+{
+    WavQuantizer q;
+    __m128       scale, lo, hi;
+    size_t       i = 0;
+
+    if (!wav_quantizer(type, &q)) {
+        return 0;
+    }
+    scale = _mm_set1_ps(q.scale);
+    lo = _mm_set1_ps(q.lo);
+    hi = _mm_set1_ps(q.hi);
+
+    for (; i + 8 <= n; i += 8) {
+        __m128 na = noise != NULL ? _mm_loadu_ps(noise + i) : _mm_setzero_ps();
+        __m128 nb = noise != NULL ? _mm_loadu_ps(noise + i + 4) : _mm_setzero_ps();
+        __m128i a = wav_quantize_sse2(_mm_loadu_ps(src + i), na, scale, lo, hi, clipped);
+        __m128i b = wav_quantize_sse2(_mm_loadu_ps(src + i + 4), nb, scale, lo, hi, clipped);
+
+        switch (type) {
+            case WAV_SAMPLE_U8: {
+                __m128i bias = _mm_set1_epi16(128);
+                __m128i v = _mm_add_epi16(_mm_packs_epi32(a, b), bias);
+                _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(v, v));
+                break;
+            }
+            case WAV_SAMPLE_I16:
+                _mm_storeu_si128((__m128i*)(dst + 2 * i), _mm_packs_epi32(a, b));
+                break;
+            case WAV_SAMPLE_ALAW:
+            case WAV_SAMPLE_MULAW: {
+                __m128i v = wav_g711_encode_sse2(_mm_packs_epi32(a, b), type);
+                _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(v, v));
+                break;
+            }
+            case WAV_SAMPLE_I24: {
+                WavI32 x[8];
+                _mm_storeu_si128((__m128i*)x, a);
+                _mm_storeu_si128((__m128i*)(x + 4), b);
+                for (int k = 0; k < 8; ++k)
+                    wav_store_i24(dst + 3 * (i + (size_t)k), x[k]);
+                break;
+            }
+            default:
+                _mm_storeu_si128((__m128i*)(dst + 4 * i), a);
+                _mm_storeu_si128((__m128i*)(dst + 4 * i + 16), b);
+                break;
+        }
+    }
+
+    return i;
+}
+
+/* Transpose 8 vectors of 8 16-bit lanes, used in both directions */
+WAV_TARGET_SSE2
+static void wav_transpose8x8_epi16(__m128i* r)
+{
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+    __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+    __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+    __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+    __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/* The kernels below handle 16-bit and 32-bit samples with 2, 4, 6 or 8
+ * channels and return the number of frames processed. */
+
+WAV_TARGET_SSE2
+static size_t wav_deinterleave_sse2(void* WAV_CONST* dst, size_t offset, WAV_CONST WavU8* src, size_t n_channels, size_t sample_size, size_t count)
+{
+    size_t i = 0;
+
+    if (sample_size == 4) {
+        float* WAV_CONST* d = (float* WAV_CONST*)dst;
+        WAV_CONST float*  s = (WAV_CONST float*)src;
+
+        switch (n_channels) {
+            case 2:
+                for (; i + 4 <= count; i += 4) {
+                    __m128 a = _mm_loadu_ps(s + 2 * i);
+                    __m128 b = _mm_loadu_ps(s + 2 * i + 4);
+                    _mm_storeu_ps(d[0] + offset + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+                    _mm_storeu_ps(d[1] + offset + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+                }
+                break;
+            case 4:
+                for (; i + 4 <= count; i += 4) {
+                    __m128 r0 = _mm_loadu_ps(s + 4 * i);
+                    __m128 r1 = _mm_loadu_ps(s + 4 * i + 4);
+                    __m128 r2 = _mm_loadu_ps(s + 4 * i + 8);
+                    __m128 r3 = _mm_loadu_ps(s + 4 * i + 12);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(d[0] + offset + i, r0);
+                    _mm_storeu_ps(d[1] + offset + i, r1);
+                    _mm_storeu_ps(d[2] + offset + i, r2);
+                    _mm_storeu_ps(d[3] + offset + i, r3);
+                }
+                break;
+            case 6:
+                for (; i + 4 <= count; i += 4) {
+                    WAV_CONST float* f = s + 6 * i;
+                    __m128 r0 = _mm_loadu_ps(f);
+                    __m128 r1 = _mm_loadu_ps(f + 6);
+                    __m128 r2 = _mm_loadu_ps(f + 12);
+                    __m128 r3 = _mm_loadu_ps(f + 18);
+                    /* channels 4 and 5 of frames 0-1 and 2-3 */
+                    __m128 a = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (WAV_CONST __m64*)(f + 4)), (WAV_CONST __m64*)(f + 10));
+                    __m128 b = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (WAV_CONST __m64*)(f + 16)), (WAV_CONST __m64*)(f + 22));
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(d[0] + offset + i, r0);
+                    _mm_storeu_ps(d[1] + offset + i, r1);
+                    _mm_storeu_ps(d[2] + offset + i, r2);
+                    _mm_storeu_ps(d[3] + offset + i, r3);
+                    _mm_storeu_ps(d[4] + offset + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+                    _mm_storeu_ps(d[5] + offset + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+                }
+                break;
+            case 8:
+                for (; i + 4 <= count; i += 4) {
+                    WAV_CONST float* f = s + 8 * i;
+                    __m128 r0 = _mm_loadu_ps(f);
+                    __m128 r1 = _mm_loadu_ps(f + 8);
+                    __m128 r2 = _mm_loadu_ps(f + 16);
+                    __m128 r3 = _mm_loadu_ps(f + 24);
+                    __m128 r4 = _mm_loadu_ps(f + 4);
+                    __m128 r5 = _mm_loadu_ps(f + 12);
+                    __m128 r6 = _mm_loadu_ps(f + 20);
+                    __m128 r7 = _mm_loadu_ps(f + 28);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _MM_TRANSPOSE4_PS(r4, r5, r6, r7);
+                    _mm_storeu_ps(d[0] + offset + i, r0);
+                    _mm_storeu_ps(d[1] + offset + i, r1);
+                    _mm_storeu_ps(d[2] + offset + i, r2);
+                    _mm_storeu_ps(d[3] + offset + i, r3);
+                    _mm_storeu_ps(d[4] + offset + i, r4);
+                    _mm_storeu_ps(d[5] + offset + i, r5);
+                    _mm_storeu_ps(d[6] + offset + i, r6);
+                    _mm_storeu_ps(d[7] + offset + i, r7);
+                }
+                break;
+            default:
+                break;
+        }
+    } else if (sample_size == 2) {
+        WavI16* WAV_CONST* d = (WavI16* WAV_CONST*)dst;
+        WAV_CONST WavI16*  s = (WAV_CONST WavI16*)src;
+
+        switch (n_channels) {
+            case 2:
+                for (; i + 8 <= count; i += 8) {
+                    __m128i a = _mm_loadu_si128((WAV_CONST __m128i*)(s + 2 * i));
+                    __m128i b = _mm_loadu_si128((WAV_CONST __m128i*)(s + 2 * i + 8));
+                    __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+                    __m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+                    _mm_storeu_si128((__m128i*)(d[0] + offset + i), l);
+                    _mm_storeu_si128((__m128i*)(d[1] + offset + i), r);
+                }
+                break;
+            case 4:
+                for (; i + 8 <= count; i += 8) {
+                    __m128i v0 = _mm_loadu_si128((WAV_CONST __m128i*)(s + 4 * i));
+                    __m128i v1 = _mm_loadu_si128((WAV_CONST __m128i*)(s + 4 * i + 8));
+                    __m128i v2 = _mm_loadu_si128((WAV_CONST __m128i*)(s + 4 * i + 16));
+                    __m128i v3 = _mm_loadu_si128((WAV_CONST __m128i*)(s + 4 * i + 24));
+                    __m128i a = _mm_unpacklo_epi16(v0, v1);
+                    __m128i b = _mm_unpackhi_epi16(v0, v1);
+                    __m128i c = _mm_unpacklo_epi16(v2, v3);
+                    __m128i e = _mm_unpackhi_epi16(v2, v3);
+                    __m128i lo01 = _mm_unpacklo_epi16(a, b);
+                    __m128i lo23 = _mm_unpackhi_epi16(a, b);
+                    __m128i hi01 = _mm_unpacklo_epi16(c, e);
+                    __m128i hi23 = _mm_unpackhi_epi16(c, e);
+                    _mm_storeu_si128((__m128i*)(d[0] + offset + i), _mm_unpacklo_epi64(lo01, hi01));
+                    _mm_storeu_si128((__m128i*)(d[1] + offset + i), _mm_unpackhi_epi64(lo01, hi01));
+                    _mm_storeu_si128((__m128i*)(d[2] + offset + i), _mm_unpacklo_epi64(lo23, hi23));
+                    _mm_storeu_si128((__m128i*)(d[3] + offset + i), _mm_unpackhi_epi64(lo23, hi23));
+                }
+                break;
+            case 8:
+                for (; i + 8 <= count; i += 8) {
+                    __m128i r[8];
+                    for (int k = 0; k < 8; ++k)
+                        r[k] = _mm_loadu_si128((WAV_CONST __m128i*)(s + 8 * (i + (size_t)k)));
+                    wav_transpose8x8_epi16(r);
+                    for (int k = 0; k < 8; ++k)
+                        _mm_storeu_si128((__m128i*)(d[k] + offset + i), r[k]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return i;
+}
+
+WAV_TARGET_SSE2
+static size_t wav_interleave_sse2(WavU8* dst, WAV_CONST void* WAV_CONST* src, size_t offset, size_t n_channels, size_t sample_size, size_t count)
+{
+    size_t i = 0;
+
+    if (sample_size == 4) {
+        WAV_CONST float* WAV_CONST* s = (WAV_CONST float* WAV_CONST*)src;
+        float*                      d = (float*)dst;
+
+        switch (n_channels) {
+            case 2:
+                for (; i + 4 <= count; i += 4) {
+                    __m128 l = _mm_loadu_ps(s[0] + offset + i);
+                    __m128 r = _mm_loadu_ps(s[1] + offset + i);
+                    _mm_storeu_ps(d + 2 * i, _mm_unpacklo_ps(l, r));
+                    _mm_storeu_ps(d + 2 * i + 4, _mm_unpackhi_ps(l, r));
+                }
+                break;
+            case 4:
+                for (; i + 4 <= count; i += 4) {
+                    __m128 r0 = _mm_loadu_ps(s[0] + offset + i);
+                    __m128 r1 = _mm_loadu_ps(s[1] + offset + i);
+                    __m128 r2 = _mm_loadu_ps(s[2] + offset + i);
+                    __m128 r3 = _mm_loadu_ps(s[3] + offset + i);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(d + 4 * i, r0);
+                    _mm_storeu_ps(d + 4 * i + 4, r1);
+                    _mm_storeu_ps(d + 4 * i + 8, r2);
+                    _mm_storeu_ps(d + 4 * i + 12, r3);
+                }
+                break;
+            case 6:
+                for (; i + 4 <= count; i += 4) {
+                    float* f = d + 6 * i;
+                    __m128 r0 = _mm_loadu_ps(s[0] + offset + i);
+                    __m128 r1 = _mm_loadu_ps(s[1] + offset + i);
+                    __m128 r2 = _mm_loadu_ps(s[2] + offset + i);
+                    __m128 r3 = _mm_loadu_ps(s[3] + offset + i);
+                    __m128 c4 = _mm_loadu_ps(s[4] + offset + i);
+                    __m128 c5 = _mm_loadu_ps(s[5] + offset + i);
+                    __m128 a = _mm_unpacklo_ps(c4, c5);
+                    __m128 b = _mm_unpackhi_ps(c4, c5);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(f, r0);
+                    _mm_storel_pi((__m64*)(f + 4), a);
+                    _mm_storeu_ps(f + 6, r1);
+                    _mm_storeh_pi((__m64*)(f + 10), a);
+                    _mm_storeu_ps(f + 12, r2);
+                    _mm_storel_pi((__m64*)(f + 16), b);
+                    _mm_storeu_ps(f + 18, r3);
+                    _mm_storeh_pi((__m64*)(f + 22), b);
+                }
+                break;
+            case 8:
+                for (; i + 4 <= count; i += 4) {
+                    float* f = d + 8 * i;
+                    __m128 r0 = _mm_loadu_ps(s[0] + offset + i);
+                    __m128 r1 = _mm_loadu_ps(s[1] + offset + i);
+                    __m128 r2 = _mm_loadu_ps(s[2] + offset + i);
+                    __m128 r3 = _mm_loadu_ps(s[3] + offset + i);
+                    __m128 r4 = _mm_loadu_ps(s[4] + offset + i);
+                    __m128 r5 = _mm_loadu_ps(s[5] + offset + i);
+                    __m128 r6 = _mm_loadu_ps(s[6] + offset + i);
+                    __m128 r7 = _mm_loadu_ps(s[7] + offset + i);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _MM_TRANSPOSE4_PS(r4, r5, r6, r7);
+                    _mm_storeu_ps(f, r0);
+                    _mm_storeu_ps(f + 4, r4);
+                    _mm_storeu_ps(f + 8, r1);
+                    _mm_storeu_ps(f + 12, r5);
+                    _mm_storeu_ps(f + 16, r2);
+                    _mm_storeu_ps(f + 20, r6);
+                    _mm_storeu_ps(f + 24, r3);
+                    _mm_storeu_ps(f + 28, r7);
+                }
+                break;
+            default:
+                break;
+        }
+    } else if (sample_size == 2) {
+        WAV_CONST WavI16* WAV_CONST* s = (WAV_CONST WavI16* WAV_CONST*)src;
+        WavI16*                      d = (WavI16*)dst;
+
+        switch (n_channels) {
+            case 2:
+                for (; i + 8 <= count; i += 8) {
+                    __m128i l = _mm_loadu_si128((WAV_CONST __m128i*)(s[0] + offset + i));
+                    __m128i r = _mm_loadu_si128((WAV_CONST __m128i*)(s[1] + offset + i));
+                    _mm_storeu_si128((__m128i*)(d + 2 * i), _mm_unpacklo_epi16(l, r));
+                    _mm_storeu_si128((__m128i*)(d + 2 * i + 8), _mm_unpackhi_epi16(l, r));
+                }
+                break;
+            case 4:
+                for (; i + 8 <= count; i += 8) {
+                    __m128i c0 = _mm_loadu_si128((WAV_CONST __m128i*)(s[0] + offset + i));
+                    __m128i c1 = _mm_loadu_si128((WAV_CONST __m128i*)(s[1] + offset + i));
+                    __m128i c2 = _mm_loadu_si128((WAV_CONST __m128i*)(s[2] + offset + i));
+                    __m128i c3 = _mm_loadu_si128((WAV_CONST __m128i*)(s[3] + offset + i));
+                    __m128i a = _mm_unpacklo_epi16(c0, c1);
+                    __m128i b = _mm_unpacklo_epi16(c2, c3);
+                    __m128i c = _mm_unpackhi_epi16(c0, c1);
+                    __m128i e = _mm_unpackhi_epi16(c2, c3);
+                    _mm_storeu_si128((__m128i*)(d + 4 * i), _mm_unpacklo_epi32(a, b));
+                    _mm_storeu_si128((__m128i*)(d + 4 * i + 8), _mm_unpackhi_epi32(a, b));
+                    _mm_storeu_si128((__m128i*)(d + 4 * i + 16), _mm_unpacklo_epi32(c, e));
+                    _mm_storeu_si128((__m128i*)(d + 4 * i + 24), _mm_unpackhi_epi32(c, e));
+                }
+                break;
+            case 8:
+                for (; i + 8 <= count; i += 8) {
+                    __m128i r[8];
+                    for (int k = 0; k < 8; ++k)
+                        r[k] = _mm_loadu_si128((WAV_CONST __m128i*)(s[k] + offset + i));
+                    wav_transpose8x8_epi16(r);
+                    for (int k = 0; k < 8; ++k)
+                        _mm_storeu_si128((__m128i*)(d + 8 * (i + (size_t)k)), r[k]);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return i;
+}
+
+/* AVX2 kernels */
+
+/* Sign-extend 8 packed 24-bit samples into 32-bit lanes. Reads 28 bytes. */
+WAV_TARGET_AVX2
+static __m256i wav_load_i24x8_avx2(WAV_CONST WavU8* p)
+{
+    WAV_CONST __m256i shuffle = _mm256_setr_epi8(
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+        -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    __m256i v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((WAV_CONST __m128i*)p)),
+        _mm_loadu_si128((WAV_CONST __m128i*)(p + 12)), 1);
+    return _mm256_srai_epi32(_mm256_shuffle_epi8(v, shuffle), 8);
+}
+
+/* Look up 8 G.711 codes with a gather of 32-bit words from the 16-bit table
+ * and sign-extend the low halves */
+WAV_TARGET_AVX2
+static __m256i wav_g711_decode_avx2(WAV_CONST WavI16* table, WAV_CONST WavU8* src)
+{
+    __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((WAV_CONST __m128i*)src));
+    __m256i v = _mm256_i32gather_epi32((WAV_CONST int*)table, idx, 2);
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+WAV_TARGET_AVX2
+static size_t wav_to_f32_avx2(float* WAV_RESTRICT dst, WAV_CONST WavU8* WAV_RESTRICT src, size_t n, WavSampleType type)
+{
+    size_t i = 0;
+
+    switch (type) {
+        case WAV_SAMPLE_U8: {
+            __m256 scale = _mm256_set1_ps(1.0f / 128.0f);
+            __m256i bias = _mm256_set1_epi32(128);
+            for (; i + 8 <= n; i += 8) {
+                __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((WAV_CONST __m128i*)(src + i)));
+                _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(v, bias)), scale));
+            }
+            break;
+        }
+        case WAV_SAMPLE_I16: {
+            __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+            for (; i + 16 <= n; i += 16) {
+                __m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((WAV_CONST __m128i*)(src + 2 * i)));
+                __m256i b = _mm256_cvtepi16_epi32(_mm_loadu_si128((WAV_CONST __m128i*)(src + 2 * i + 16)));
+                _mm256_storeu_ps(dst + i + 0, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+                _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+            }
+            break;
+        }
+        case WAV_SAMPLE_I24: {
+            __m256 scale = _mm256_set1_ps(1.0f / 8388608.0f);
+            /* each iteration reads 28 bytes, i.e. 4 bytes beyond the 8 samples */
+            for (; i + 10 <= n; i += 8) {
+                __m256i v = wav_load_i24x8_avx2(src + 3 * i);
+                _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+            }
+            break;
+        }
+        case WAV_SAMPLE_I32: {
+            __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+            for (; i + 8 <= n; i += 8) {
+                __m256i v = _mm256_loadu_si256((WAV_CONST __m256i*)(src + 4 * i));
+                _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+            }
+            break;
+        }
+        case WAV_SAMPLE_F64:
+            for (; i + 8 <= n; i += 8) {
+                __m128 lo = _mm256_cvtpd_ps(_mm256_loadu_pd((WAV_CONST double*)(src + 8 * i)));
+                __m128 hi = _mm256_cvtpd_ps(_mm256_loadu_pd((WAV_CONST double*)(src + 8 * i + 32)));
+                _mm256_storeu_ps(dst + i, _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1));
+            }
+            break;
+        case WAV_SAMPLE_ALAW:
+        case WAV_SAMPLE_MULAW: {
+            WAV_CONST WavI16* table = type == WAV_SAMPLE_ALAW ? wav_alaw_table : wav_mulaw_table;
+            __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+            for (; i + 8 <= n; i += 8) {
+                __m256i v = wav_g711_decode_avx2(table, src + i);
+                _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    return i;
+}
+
+WAV_TARGET_AVX2
+static size_t wav_to_i16_avx2(WavI16* WAV_RESTRICT dst, WAV_CONST WavU8* WAV_RESTRICT src, size_t n, WavSampleType type)
+{
+    size_t i = 0;
+
+    switch (type) {
+        case WAV_SAMPLE_I24:
+            for (; i + 10 <= n; i += 8) {
+                __m256i v = _mm256_srai_epi32(wav_load_i24x8_avx2(src + 3 * i), 8);
+                _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+            }
+            break;
+        case WAV_SAMPLE_I32:
+            for (; i + 16 <= n; i += 16) {
+                __m256i a = _mm256_srai_epi32(_mm256_loadu_si256((WAV_CONST __m256i*)(src + 4 * i)), 16);
+                __m256i b = _mm256_srai_epi32(_mm256_loadu_si256((WAV_CONST __m256i*)(src + 4 * i + 32)), 16);
+                /* packs works per 128-bit lane, restore the sample order afterwards */
+                _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+            }
+            break;
+        case WAV_SAMPLE_F32: {
+            __m256 scale = _mm256_set1_ps(32768.0f);
+            __m256 lo = _mm256_set1_ps(-32768.0f);
+            __m256 hi = _mm256_set1_ps(32767.0f);
+            for (; i + 16 <= n; i += 16) {
+                __m256i a = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps((WAV_CONST float*)(src + 4 * i)), scale), lo), hi));
+                __m256i b = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps((WAV_CONST float*)(src + 4 * i + 32)), scale), lo), hi));
+                _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+            }
+            break;
+        }
+        case WAV_SAMPLE_ALAW:
+        case WAV_SAMPLE_MULAW: {
+            WAV_CONST WavI16* table = type == WAV_SAMPLE_ALAW ? wav_alaw_table : wav_mulaw_table;
+            for (; i + 16 <= n; i += 16) {
+                __m256i a = wav_g711_decode_avx2(table, src + i);
+                __m256i b = wav_g711_decode_avx2(table, src + i + 8);
+                _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+            }
+            break;
+        }
+        default:
+            /* the SSE2 kernels are as fast for the remaining types */
+            i = wav_to_i16_sse2(dst, src, n, type);
+            break;
+    }
+
+    return i;
+}
+
+WAV_TARGET_AVX2
+static __m256i wav_quantize_avx2(__m256 x, __m256 noise, __m256 scale, __m256 lo, __m256 hi, size_t* clipped)
+{
+    __m256 v = _mm256_add_ps(_mm256_mul_ps(x, scale), noise);
+    int    mask = _mm256_movemask_ps(_mm256_or_ps(_mm256_cmp_ps(v, lo, _CMP_LT_OQ), _mm256_cmp_ps(v, hi, _CMP_GT_OQ)));
+    *clipped += (size_t)wav_popcount4[mask & 15] + wav_popcount4[mask >> 4];
+    return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi));
+}
+
+/* The AVX2 version of {wav_g711_encode_sse2} for 16 samples */
+WAV_TARGET_AVX2
+static __m256i wav_g711_encode_avx2(__m256i x, WavSampleType type)
+{
+    __m256i seg = _mm256_setzero_si256();
+    __m256i mul = _mm256_set1_epi16(-32768);
+    __m256i p, sign, m, code;
+
+    if (type == WAV_SAMPLE_ALAW) {
+        p = _mm256_srai_epi16(x, 3);
+        sign = _mm256_srai_epi16(p, 15);
+        m = _mm256_xor_si256(p, sign);
+        for (int k = 0; k < 7; ++k) {
+            __m256i gt = _mm256_cmpgt_epi16(m, _mm256_set1_epi16(wav_alaw_thresholds[k]));
+            seg = _mm256_sub_epi16(seg, gt);
+            if (k > 0)
+                mul = _mm256_sub_epi16(mul, _mm256_and_si256(_mm256_srli_epi16(mul, 1), gt));
+        }
+    } else {
+        p = _mm256_srai_epi16(x, 2);
+        sign = _mm256_srai_epi16(p, 15);
+        m = _mm256_min_epi16(_mm256_add_epi16(_mm256_sub_epi16(_mm256_xor_si256(p, sign), sign), _mm256_set1_epi16(33)), _mm256_set1_epi16(0x1fff));
+        for (int k = 0; k < 7; ++k) {
+            __m256i gt = _mm256_cmpgt_epi16(m, _mm256_set1_epi16(wav_mulaw_thresholds[k]));
+            seg = _mm256_sub_epi16(seg, gt);
+            mul = _mm256_sub_epi16(mul, _mm256_and_si256(_mm256_srli_epi16(mul, 1), gt));
+        }
+    }
+
+    code = _mm256_or_si256(_mm256_slli_epi16(seg, 4), _mm256_and_si256(_mm256_mulhi_epu16(m, mul), _mm256_set1_epi16(0xf)));
+    return _mm256_xor_si256(code, _mm256_or_si256(_mm256_set1_epi16(type == WAV_SAMPLE_ALAW ? 0x55 : 0x7f),
+                                                  _mm256_andnot_si256(sign, _mm256_set1_epi16(0x80))));
+}
+
+WAV_TARGET_AVX2
+static size_t wav_from_f32_avx2(WavU8* WAV_RESTRICT dst, WAV_CONST float* WAV_RESTRICT src, WAV_CONST float* WAV_RESTRICT noise, size_t n, WavSampleType type, size_t* clipped)
+{
+    WAV_CONST __m256i pack24 = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    WavQuantizer q;
+    __m256       scale, lo, hi;
+    size_t       i = 0;
+
+    if (!wav_quantizer(type, &q)) {
+        return 0;
+    }
+    scale = _mm256_set1_ps(q.scale);
+    lo = _mm256_set1_ps(q.lo);
+    hi = _mm256_set1_ps(q.hi);
+
+    /* 24-bit stores write 4 bytes past the 8 samples, which the next
+     * iteration overwrites, so stop while at least 2 samples remain */
+    for (; i + (type == WAV_SAMPLE_I24 ? 18 : 16) <= n; i += 16) {
+        __m256 na = noise != NULL ? _mm256_loadu_ps(noise + i) : _mm256_setzero_ps();
+        __m256 nb = noise != NULL ? _mm256_loadu_ps(noise + i + 8) : _mm256_setzero_ps();
+        __m256i a = wav_quantize_avx2(_mm256_loadu_ps(src + i), na, scale, lo, hi, clipped);
+        __m256i b = wav_quantize_avx2(_mm256_loadu_ps(src + i + 8), nb, scale, lo, hi, clipped);
+
+        switch (type) {
+            case WAV_SAMPLE_U8: {
+                __m256i v = _mm256_add_epi16(_mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8), _mm256_set1_epi16(128));
+                _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+                break;
+            }
+            case WAV_SAMPLE_I16:
+                _mm256_storeu_si256((__m256i*)(dst + 2 * i), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+                break;
+            case WAV_SAMPLE_ALAW:
+            case WAV_SAMPLE_MULAW: {
+                __m256i v = wav_g711_encode_avx2(_mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8), type);
+                _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+                break;
+            }
+            case WAV_SAMPLE_I24: {
+                __m256i pa = _mm256_shuffle_epi8(a, pack24);
+                __m256i pb = _mm256_shuffle_epi8(b, pack24);
+                _mm_storeu_si128((__m128i*)(dst + 3 * i), _mm256_castsi256_si128(pa));
+                _mm_storeu_si128((__m128i*)(dst + 3 * i + 12), _mm256_extracti128_si256(pa, 1));
+                _mm_storeu_si128((__m128i*)(dst + 3 * i + 24), _mm256_castsi256_si128(pb));
+                _mm_storeu_si128((__m128i*)(dst + 3 * i + 36), _mm256_extracti128_si256(pb, 1));
+                break;
+            }
+            default:
+                _mm256_storeu_si256((__m256i*)(dst + 4 * i), a);
+                _mm256_storeu_si256((__m256i*)(dst + 4 * i + 32), b);
+                break;
+        }
+    }
+
+    return i;
+}
+
+/* Transpose 8 vectors of 8 32-bit lanes, used in both directions */
+WAV_TARGET_AVX2
+static void wav_transpose8x8_ps(__m256* r)
+{
+    __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+    __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+    __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+    __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+    __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+    __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+    __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+    __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+    __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+    __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+    r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+WAV_TARGET_AVX2
+static size_t wav_deinterleave_avx2(void* WAV_CONST* dst, size_t offset, WAV_CONST WavU8* src, size_t n_channels, size_t sample_size, size_t count)
+{
+    size_t i = 0;
+
+    if (sample_size == 4 && n_channels == 8) {
+        float* WAV_CONST* d = (float* WAV_CONST*)dst;
+        WAV_CONST float*  s = (WAV_CONST float*)src;
+        for (; i + 8 <= count; i += 8) {
+            __m256 r[8];
+            for (int k = 0; k < 8; ++k)
+                r[k] = _mm256_loadu_ps(s + 8 * (i + (size_t)k));
+            wav_transpose8x8_ps(r);
+            for (int k = 0; k < 8; ++k)
+                _mm256_storeu_ps(d[k] + offset + i, r[k]);
+        }
+    }
+
+    return i + wav_deinterleave_sse2(dst, offset + i, src + i * n_channels * sample_size, n_channels, sample_size, count - i);
+}
+
+WAV_TARGET_AVX2
+static size_t wav_interleave_avx2(WavU8* dst, WAV_CONST void* WAV_CONST* src, size_t offset, size_t n_channels, size_t sample_size, size_t count)
+{
+    size_t i = 0;
+
+    if (sample_size == 4 && n_channels == 8) {
+        WAV_CONST float* WAV_CONST* s = (WAV_CONST float* WAV_CONST*)src;
+        float*                      d = (float*)dst;
+        for (; i + 8 <= count; i += 8) {
+            __m256 r[8];
+            for (int k = 0; k < 8; ++k)
+                r[k] = _mm256_loadu_ps(s[k] + offset + i);
+            wav_transpose8x8_ps(r);
+            for (int k = 0; k < 8; ++k)
+                _mm256_storeu_ps(d + 8 * (i + (size_t)k), r[k]);
+        }
+    }
+
+    return i + wav_interleave_sse2(dst + i * n_channels * sample_size, src, offset + i, n_channels, sample_size, count - i);
+}
+
+#endif
+
+void wav_convert_to_f32(float* WAV_RESTRICT dst, WAV_CONST void* WAV_RESTRICT src, size_t n, WavSampleType type)
+{
+    size_t done = 0;
+
+#if WAV_ARCH_X86
+    switch (wav_isa()) {
+        case WAV_ISA_AVX2:
+            done = wav_to_f32_avx2(dst, src, n, type);
+            break;
+        case WAV_ISA_SSE2:
+            done = wav_to_f32_sse2(dst, src, n, type);
+            break;
+        default:
+            break;
+    }
+#endif
+
+    wav_to_f32_scalar(dst + done, (WAV_CONST WavU8*)src + done * wav_sample_type_size(type), n - done, type);
+}
+
+void wav_convert_to_i16(WavI16* WAV_RESTRICT dst, WAV_CONST void* WAV_RESTRICT src, size_t n, WavSampleType type)
+{
+    size_t done = 0;
+
+#if WAV_ARCH_X86
+    switch (wav_isa()) {
+        case WAV_ISA_AVX2:
+            done = wav_to_i16_avx2(dst, src, n, type);
+            break;
+        case WAV_ISA_SSE2:
+            done = wav_to_i16_sse2(dst, src, n, type);
+            break;
+        default:
+            break;
+    }
+#endif
+
+    wav_to_i16_scalar(dst + done, (WAV_CONST WavU8*)src + done * wav_sample_type_size(type), n - done, type);
+}
+
+size_t wav_convert_from_f32(void* WAV_RESTRICT dst, WAV_CONST float* WAV_RESTRICT src, WAV_CONST float* WAV_RESTRICT noise, size_t n, WavSampleType type)
+{
+    size_t clipped = 0;
+    size_t done = 0;
+
+#if WAV_ARCH_X86
+    switch (wav_isa()) {
+        case WAV_ISA_AVX2:
+            done = wav_from_f32_avx2(dst, src, noise, n, type, &clipped);
+            break;
+        case WAV_ISA_SSE2:
+            done = wav_from_f32_sse2(dst, src, noise, n, type, &clipped);
+            break;
+        default:
+            break;
+    }
+#endif
+
+    return clipped + wav_from_f32_scalar((WavU8*)dst + done * wav_sample_type_size(type), src + done,
+                                         noise != NULL ? noise + done : NULL, n - done, type);
+}
+
+size_t wav_round_f32(float* dst, WAV_CONST float* src, WAV_CONST float* noise, size_t n, unsigned bits)
+{
+    float  scale = (float)(1u << (bits - 1));
+    float  inv = 1.0f / scale;
+    size_t clipped = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        float v = src[i] * scale + (noise != NULL ? noise[i] : 0.0f);
+        if (v < -scale) {
+            ++clipped;
+            v = -scale;
+        } else if (v > scale - 1.0f) {
+            ++clipped;
+            v = scale - 1.0f;
+        } else if (v != v) {
+            v = -scale;
+        }
+        dst[i] = rintf(v) * inv;
+    }
+
+    return clipped;
+}
+
+void wav_truncate_f32(float* x, size_t n, unsigned bits)
+{
+    float scale = (float)(1u << (bits - 1));
+    float inv = 1.0f / scale;
+
+    for (size_t i = 0; i < n; ++i) {
+        x[i] = floorf(x[i] * scale) * inv;
+    }
+}
+
+void wav_tpdf_noise(float* noise, size_t n, WavU32* state)
+{
+    WavU32 x = *state;
+
+    /* the difference of two uniform variables in [0, 1) has a triangular PDF on (-1, 1) */
+    for (size_t i = 0; i < n; ++i) {
+        WavU32 a, b;
+        x = x * 1664525u + 1013904223u;
+        a = x >> 8;
+        x = x * 1664525u + 1013904223u;
+        b = x >> 8;
+        noise[i] = ((float)a - (float)b) * (1.0f / 16777216.0f);
+    }
+
+    *state = x;
+}
+
+void wav_deinterleave(void* WAV_CONST* dst, size_t offset, WAV_CONST void* src, size_t n_channels, size_t sample_size, size_t count)
+{
+    size_t done = 0;
+
+#if WAV_ARCH_X86
+    switch (wav_isa()) {
+        case WAV_ISA_AVX2:
+            done = wav_deinterleave_avx2(dst, offset, src, n_channels, sample_size, count);
+            break;
+        case WAV_ISA_SSE2:
+            done = wav_deinterleave_sse2(dst, offset, src, n_channels, sample_size, count);
+            break;
+        default:
+            break;
+    }
+#endif
+
+    wav_deinterleave_scalar(dst, offset + done, (WAV_CONST WavU8*)src + done * n_channels * sample_size, n_channels, sample_size, count - done);
+}
+
+void wav_interleave(void* dst, WAV_CONST void* WAV_CONST* src, size_t offset, size_t n_channels, size_t sample_size, size_t count)
+{
+    size_t done = 0;
+
+#if WAV_ARCH_X86
+    switch (wav_isa()) {
+        case WAV_ISA_AVX2:
+            done = wav_interleave_avx2(dst, src, offset, n_channels, sample_size, count);
+            break;
+        case WAV_ISA_SSE2:
+            done = wav_interleave_sse2(dst, src, offset, n_channels, sample_size, count);
+            break;
+        default:
+            break;
+    }
+#endif
+
+    wav_interleave_scalar((WavU8*)dst + done * n_channels * sample_size, src, offset + done, n_channels, sample_size, count - done);
+}
@@ -0,0 +1,61 @@
+/** Sample format conversion kernels
+ *
+ * Internal to libwav. Every kernel has a portable implementation and, on x86,
+ * SSE2 and AVX2 implementations that are selected at runtime.
+ */
+
+#ifndef __WAV_CONVERT_H__
+#define __WAV_CONVERT_H__
+
+#include "wav.h"
+
+typedef enum {
+    WAV_SAMPLE_UNKNOWN,
+    WAV_SAMPLE_U8,      /** unsigned 8-bit PCM */
+    WAV_SAMPLE_I16,     /** signed 16-bit PCM */
+    WAV_SAMPLE_I24,     /** signed 24-bit PCM, packed in 3 bytes */
+    WAV_SAMPLE_I32,     /** signed 32-bit PCM */
+    WAV_SAMPLE_F32,     /** IEEE float */
+    WAV_SAMPLE_F64,     /** IEEE double */
+    WAV_SAMPLE_ALAW,    /** G.711 A-law */
+    WAV_SAMPLE_MULAW,   /** G.711 mu-law */
+} WavSampleType;
+
+/** Get the sample type for a format tag and a container size in bytes */
+WavSampleType wav_sample_type(WavU16 format_tag, size_t sample_size);
+
+/** Convert {n} samples of {type} to float in [-1, 1) */
+void wav_convert_to_f32(float* WAV_RESTRICT dst, WAV_CONST void* WAV_RESTRICT src, size_t n, WavSampleType type);
+
+/** Convert {n} samples of {type} to 16-bit PCM, truncating wider integers and saturating floats */
+void wav_convert_to_i16(WavI16* WAV_RESTRICT dst, WAV_CONST void* WAV_RESTRICT src, size_t n, WavSampleType type);
+
+/** Convert {n} floats in [-1, 1) to {type}, saturating at full scale
+ *
+ *  A-law and mu-law samples are first quantized to 16-bit PCM.
+ *  @param noise    NULL, or {n} dither values in units of the target LSB that are added before rounding
+ *  @return         The number of samples that were clipped
+ */
+size_t wav_convert_from_f32(void* WAV_RESTRICT dst, WAV_CONST float* WAV_RESTRICT src, WAV_CONST float* WAV_RESTRICT noise, size_t n, WavSampleType type);
+
+/** Round {n} floats to the steps of {bits}-bit PCM and saturate them, for containers with fewer valid bits than they hold
+ *
+ *  @param noise    NULL, or {n} dither values in units of the {bits}-bit LSB
+ *  @return         The number of samples that were clipped
+ *  @remarks        {dst} may be {src} or {noise}. The result converts to any wider integer type with {wav_convert_from_f32} exactly.
+ */
+size_t wav_round_f32(float* dst, WAV_CONST float* src, WAV_CONST float* noise, size_t n, unsigned bits);
+
+/** Truncate {n} floats in place to the steps of {bits}-bit PCM, which drops the padding bits below the valid ones */
+void wav_truncate_f32(float* x, size_t n, unsigned bits);
+
+/** Fill {noise} with {n} values of triangular PDF dither in (-1, 1) LSB, advancing the generator {state} */
+void wav_tpdf_noise(float* noise, size_t n, WavU32* state);
+
+/** Split {count} interleaved frames of {n_channels} samples into the channel buffers {dst}, starting at frame {offset} of each channel */
+void wav_deinterleave(void* WAV_CONST* dst, size_t offset, WAV_CONST void* src, size_t n_channels, size_t sample_size, size_t count);
+
+/** Interleave {count} frames from the channel buffers {src}, starting at frame {offset} of each channel, into {dst} */
+void wav_interleave(void* dst, WAV_CONST void* WAV_CONST* src, size_t offset, size_t n_channels, size_t sample_size, size_t count);
+
+#endif /* __WAV_CONVERT_H__ */
@@ -0,0 +1,607 @@
+#include <errno.h>
+#include <string.h>
+
+#include "wav_internal.h"
+#include "wav_thread.h"
+
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#define WAV_HAVE_POSIX 1
+#endif
+
+/* the raw system calls are used, liburing is not needed */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define WAV_HAVE_IO_URING 1
+#endif
+#endif
+
+/* registered buffers are aligned to pages, as O_DIRECT wants them */
+#define WAV_ENGINE_ALIGN        ((size_t)4096)
+
+/* the most bytes moved by one read or write, longer requests are split */
+#define WAV_ENGINE_MAX_TRANSFER ((size_t)1 << 30)
+
+typedef struct {
+    WavFile*            file;
+    int                 fd;
+    WavBool             is_write;
+    WavU8*              buffer;
+    WavU64              offset;         /* in bytes */
+    size_t              size;           /* in bytes */
+    size_t              done;           /* bytes transferred so far */
+    size_t              block_align;
+    int                 buffer_index;   /* the registered buffer holding {buffer}, or -1 */
+    int                 error;          /* errno of a failed transfer */
+    WavCompletionFunc   func;
+    void*               context;
+} WavRequest;
+
+struct _WavEngine {
+    WavRequest*     requests;
+    size_t          queue_depth;
+    size_t*         free_list;
+    size_t          num_free;
+    size_t          in_flight;
+
+    void*           buffer_memory;
+    WavU8*          buffers;            /* n_buffers * buffer_size bytes, aligned */
+    size_t          n_buffers;
+    size_t          buffer_size;
+
+#if WAV_HAVE_IO_URING
+    int                     ring_fd;    /* -1 if the thread pool is used */
+    void*                   ring;
+    size_t                  ring_size;
+    struct io_uring_sqe*    sqes;
+    size_t                  sqes_size;
+    unsigned*               sq_tail;
+    unsigned*               sq_mask;
+    unsigned*               sq_array;
+    unsigned*               cq_head;
+    unsigned*               cq_tail;
+    unsigned*               cq_mask;
+    struct io_uring_cqe*    cqes;
+    unsigned                to_submit;
+    WavBool                 registered;
+#endif
+
+    /* thread pool, used where io_uring is not available */
+    WavThread*      threads;
+    size_t          n_threads;
+    WavMutex        mutex;
+    WavCond         work;               /* a request is queued or the pool stops */
+    WavCond         done;               /* a request completed */
+    size_t*         queue;              /* ring of queued request indices */
+    size_t          queue_head;
+    size_t          queue_len;
+    size_t*         completed;          /* completed request indices */
+    size_t          num_completed;
+    size_t*         reaped;             /* completed requests taken by wav_engine_poll() */
+    WavBool         stop;
+};
+
+/* Move the rest of a request with blocking calls */
+static void wav_engine_transfer(WavRequest* req)
+{
+#if WAV_HAVE_POSIX
+    while (req->done < req->size) {
+        size_t  len = req->size - req->done < WAV_ENGINE_MAX_TRANSFER ? req->size - req->done : WAV_ENGINE_MAX_TRANSFER;
+        ssize_t n = req->is_write ? pwrite(req->fd, req->buffer + req->done, len, (off_t)(req->offset + req->done))
+                                  : pread(req->fd, req->buffer + req->done, len, (off_t)(req->offset + req->done));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            req->error = errno;
+            return;
+        }
+        if (n == 0) {
+            if (req->is_write)
+                req->error = EIO;
+            return;
+        }
+        req->done += (size_t)n;
+    }
+#else
+    req->error = ENOSYS;
+#endif
+}
+
+static WavThreadResult WAV_THREAD_CALL wav_engine_worker(void *arg)
+{
+    WavEngine* self = arg;
+
+    wav_mutex_lock(&self->mutex);
+    for (;;) {
+        size_t index;
+
+        while (self->queue_len == 0 && !self->stop) {
+            wav_cond_wait(&self->work, &self->mutex);
+        }
+        if (self->queue_len == 0) {
+            break;
+        }
+
+        index = self->queue[self->queue_head];
+        self->queue_head = (self->queue_head + 1) % self->queue_depth;
+        self->queue_len--;
+        wav_mutex_unlock(&self->mutex);
+
+        wav_engine_transfer(&self->requests[index]);
+
+        wav_mutex_lock(&self->mutex);
+        self->completed[self->num_completed++] = index;
+        wav_cond_signal(&self->done);
+    }
+    wav_mutex_unlock(&self->mutex);
+
+    return (WavThreadResult)0;
+}
+
+#if WAV_HAVE_IO_URING
+
+static int wav_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int wav_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int wav_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Set up the ring. Fails on kernels without io_uring, or too old for
+ * IORING_OP_READ/WRITE, and where it is blocked by seccomp. */
+static WavBool wav_uring_open(WavEngine* self)
+{
+    struct io_uring_params params;
+    size_t                 sq_size;
+    size_t                 cq_size;
+    WavU8*                 ring;
+
+    memset(&params, 0, sizeof(params));
+    self->ring_fd = wav_uring_setup((unsigned)self->queue_depth, &params);
+    if (self->ring_fd < 0) {
+        return WAV_FALSE;
+    }
+
+    /* IORING_FEAT_FAST_POLL came with 5.7, after IORING_OP_READ and IORING_OP_WRITE */
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_FAST_POLL)) {
+        close(self->ring_fd);
+        self->ring_fd = -1;
+        return WAV_FALSE;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    self->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    self->ring = mmap(NULL, self->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->ring_fd, IORING_OFF_SQ_RING);
+    self->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    self->sqes = mmap(NULL, self->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->ring_fd, IORING_OFF_SQES);
+    if (self->ring == MAP_FAILED || self->sqes == MAP_FAILED) {
+        if (self->ring != MAP_FAILED)
+            munmap(self->ring, self->ring_size);
+        if (self->sqes != MAP_FAILED)
+            munmap(self->sqes, self->sqes_size);
+        close(self->ring_fd);
+        self->ring_fd = -1;
+        return WAV_FALSE;
+    }
+
+    ring = self->ring;
+    self->sq_tail = (unsigned*)(ring + params.sq_off.tail);
+    self->sq_mask = (unsigned*)(ring + params.sq_off.ring_mask);
+    self->sq_array = (unsigned*)(ring + params.sq_off.array);
+    self->cq_head = (unsigned*)(ring + params.cq_off.head);
+    self->cq_tail = (unsigned*)(ring + params.cq_off.tail);
+    self->cq_mask = (unsigned*)(ring + params.cq_off.ring_mask);
+    self->cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+
+    /* without registered buffers, which RLIMIT_MEMLOCK can prevent, plain reads and writes are used */
+    if (self->n_buffers > 0) {
+        struct iovec* iov = wav_malloc(self->n_buffers * sizeof(struct iovec));
+        if (iov != NULL) {
+            for (size_t i = 0; i < self->n_buffers; ++i) {
+                iov[i].iov_base = self->buffers + i * self->buffer_size;
+                iov[i].iov_len = self->buffer_size;
+            }
+            self->registered = wav_uring_register(self->ring_fd, IORING_REGISTER_BUFFERS, iov, (unsigned)self->n_buffers) == 0;
+            wav_free(iov);
+        }
+    }
+
+    return WAV_TRUE;
+}
+
+static void wav_uring_close(WavEngine* self)
+{
+    munmap(self->sqes, self->sqes_size);
+    munmap(self->ring, self->ring_size);
+    close(self->ring_fd);
+}
+
+/* Queue the rest of a request. The ring has an entry for every request, so it
+ * is never full. */
+static void wav_uring_queue(WavEngine* self, size_t index)
+{
+    WavRequest*          req = &self->requests[index];
+    unsigned             tail = *self->sq_tail;
+    unsigned             slot = tail & *self->sq_mask;
+    struct io_uring_sqe* sqe = &self->sqes[slot];
+    size_t               len = req->size - req->done;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = req->fd;
+    sqe->off = req->offset + req->done;
+    sqe->addr = (WavU64)(WavUIntPtr)(req->buffer + req->done);
+    sqe->len = (unsigned)(len < WAV_ENGINE_MAX_TRANSFER ? len : WAV_ENGINE_MAX_TRANSFER);
+    sqe->user_data = index;
+    if (req->buffer_index >= 0 && self->registered) {
+        sqe->opcode = req->is_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (WavU16)req->buffer_index;
+    } else {
+        sqe->opcode = req->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+
+    self->sq_array[slot] = slot;
+    __atomic_store_n(self->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    self->to_submit++;
+}
+
+#endif
+
+/* Hand a finished request to its callback. The slot is free again by then, so
+ * the callback can submit the next request. */
+static void wav_engine_complete(WavEngine* self, size_t index)
+{
+    WavRequest req = self->requests[index];
+
+    self->free_list[self->num_free++] = index;
+    self->in_flight--;
+
+    if (req.error != 0) {
+        WavErr err;
+        err.code = WAV_ERR_OS;
+        err.message = NULL;
+        err._is_literal = 0;
+        wav_asprintf(&err.message, "Asynchronous %s failed [errno %d: %s]", req.is_write ? "write" : "read", req.error, strerror(req.error));
+        req.func(req.context, req.file, req.done / req.block_align, &err);
+        wav_free(err.message);
+    } else {
+        req.func(req.context, req.file, req.done / req.block_align, NULL);
+    }
+}
+
+WavEngine* wav_engine_open(size_t queue_depth, size_t n_buffers, size_t buffer_size, WavU32 flags)
+{
+    WavEngine* self;
+
+    if (queue_depth < 1 || queue_depth > 4096) {
+        wav_err_set(WAV_ERR_PARAM, "Invalid queue depth: %zu", queue_depth);
+        return NULL;
+    }
+    if (n_buffers > 0 && (buffer_size == 0 || buffer_size > ((size_t)-1 - WAV_ENGINE_ALIGN) / n_buffers)) {
+        wav_err_set(WAV_ERR_PARAM, "Invalid buffer size: %zu", buffer_size);
+        return NULL;
+    }
+
+    self = wav_malloc(sizeof(WavEngine));
+    if (self == NULL) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the engine");
+        return NULL;
+    }
+    memset(self, 0, sizeof(WavEngine));
+    self->queue_depth = queue_depth;
+    self->n_buffers = n_buffers;
+    self->buffer_size = (buffer_size + WAV_ENGINE_ALIGN - 1) & ~(WAV_ENGINE_ALIGN - 1);
+
+    self->requests = wav_malloc(queue_depth * sizeof(WavRequest));
+    self->free_list = wav_malloc(queue_depth * sizeof(size_t));
+    self->queue = wav_malloc(queue_depth * sizeof(size_t));
+    self->completed = wav_malloc(queue_depth * sizeof(size_t));
+    self->reaped = wav_malloc(queue_depth * sizeof(size_t));
+    if (n_buffers > 0) {
+        self->buffer_memory = wav_malloc(n_buffers * self->buffer_size + WAV_ENGINE_ALIGN);
+        self->buffers = (WavU8*)(((WavUIntPtr)self->buffer_memory + WAV_ENGINE_ALIGN - 1) & ~(WavUIntPtr)(WAV_ENGINE_ALIGN - 1));
+    }
+    if (self->requests == NULL || self->free_list == NULL || self->queue == NULL || self->completed == NULL ||
+        self->reaped == NULL || (n_buffers > 0 && self->buffer_memory == NULL))
+    {
+        wav_free(self->buffer_memory);
+        wav_free(self->reaped);
+        wav_free(self->completed);
+        wav_free(self->queue);
+        wav_free(self->free_list);
+        wav_free(self->requests);
+        wav_free(self);
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the engine");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < queue_depth; ++i) {
+        self->free_list[i] = queue_depth - 1 - i;
+    }
+    self->num_free = queue_depth;
+
+#if WAV_HAVE_IO_URING
+    self->ring_fd = -1;
+    if (!(flags & WAV_ENGINE_THREADS) && wav_uring_open(self)) {
+        return self;
+    }
+#else
+    (void)flags;
+#endif
+
+    /* blocking I/O needs a thread per request in flight, up to a point */
+    self->n_threads = wav_cpu_count() * 4;
+    if (self->n_threads < 16) {
+        self->n_threads = 16;
+    }
+    if (self->n_threads > queue_depth) {
+        self->n_threads = queue_depth;
+    }
+
+    wav_mutex_init(&self->mutex);
+    wav_cond_init(&self->work);
+    wav_cond_init(&self->done);
+    self->threads = wav_malloc(self->n_threads * sizeof(WavThread));
+    for (size_t i = 0; self->threads != NULL && i < self->n_threads; ++i) {
+        if (wav_thread_create(&self->threads[i], &wav_engine_worker, self) != 0) {
+            self->n_threads = i;
+            break;
+        }
+    }
+    if (self->threads == NULL || self->n_threads == 0) {
+        self->n_threads = 0;
+        wav_engine_close(self);
+        wav_err_set_literal(WAV_ERR_OS, "Failed to start the I/O threads");
+        return NULL;
+    }
+
+    return self;
+}
+
+void wav_engine_close(WavEngine* self)
+{
+    while (self->in_flight > 0 && wav_engine_poll(self, self->in_flight) > 0) {
+    }
+
+#if WAV_HAVE_IO_URING
+    if (self->ring_fd >= 0) {
+        wav_uring_close(self);
+    } else
+#endif
+    {
+        wav_mutex_lock(&self->mutex);
+        self->stop = WAV_TRUE;
+        wav_cond_broadcast(&self->work);
+        wav_mutex_unlock(&self->mutex);
+        for (size_t i = 0; i < self->n_threads; ++i) {
+            wav_thread_join(self->threads[i]);
+        }
+        wav_free(self->threads);
+        wav_cond_destroy(&self->done);
+        wav_cond_destroy(&self->work);
+        wav_mutex_destroy(&self->mutex);
+    }
+
+    wav_free(self->buffer_memory);
+    wav_free(self->reaped);
+    wav_free(self->completed);
+    wav_free(self->queue);
+    wav_free(self->free_list);
+    wav_free(self->requests);
+    wav_free(self);
+}
+
+void* wav_engine_get_buffer(WavEngine* self, size_t index)
+{
+    if (index >= self->n_buffers) {
+        wav_err_set(WAV_ERR_PARAM, "Invalid buffer index: %zu", index);
+        return NULL;
+    }
+    return self->buffers + index * self->buffer_size;
+}
+
+WavBool wav_engine_uses_io_uring(WAV_CONST WavEngine* self)
+{
+#if WAV_HAVE_IO_URING
+    return self->ring_fd >= 0;
+#else
+    (void)self;
+    return WAV_FALSE;
+#endif
+}
+
+size_t wav_engine_get_in_flight(WAV_CONST WavEngine* self)
+{
+    return self->in_flight;
+}
+
+static int wav_engine_submit(WavEngine* self, WavFile* file, WavBool is_write, void* buffer, WavU64 frame_offset, size_t count,
+                             WavCompletionFunc func, void* context)
+{
+    WavRequest* req;
+    size_t      index;
+    int         fd = wav_native_fd(file);
+
+    if (fd < 0) {
+        wav_err_set_literal(WAV_ERR_MODE, "Asynchronous I/O needs a WavFile backed by a file descriptor");
+        return (int)g_err.code;
+    }
+
+    if (self->num_free == 0) {
+        wav_err_set_literal(WAV_ERR_BUSY, "Every request is in flight, call wav_engine_poll() first");
+        return (int)g_err.code;
+    }
+
+    index = self->free_list[--self->num_free];
+    req = &self->requests[index];
+    req->file = file;
+    req->fd = fd;
+    req->is_write = is_write;
+    req->buffer = buffer;
+    req->block_align = wav_get_sample_size(file) * wav_get_num_channels(file);
+    req->offset = wav_data_offset(file) + frame_offset * req->block_align;
+    req->size = count * req->block_align;
+    req->done = 0;
+    req->error = 0;
+    req->func = func;
+    req->context = context;
+
+    req->buffer_index = -1;
+    if (self->n_buffers > 0 && req->buffer >= self->buffers && req->buffer < self->buffers + self->n_buffers * self->buffer_size) {
+        size_t first = (size_t)(req->buffer - self->buffers);
+        if (first / self->buffer_size == (first + req->size - (req->size > 0)) / self->buffer_size) {
+            req->buffer_index = (int)(first / self->buffer_size);
+        }
+    }
+
+    self->in_flight++;
+
+#if WAV_HAVE_IO_URING
+    if (self->ring_fd >= 0) {
+        wav_uring_queue(self, index);
+        return 0;
+    }
+#endif
+
+    wav_mutex_lock(&self->mutex);
+    self->queue[(self->queue_head + self->queue_len) % self->queue_depth] = index;
+    self->queue_len++;
+    wav_cond_signal(&self->work);
+    wav_mutex_unlock(&self->mutex);
+
+    return 0;
+}
+
+int wav_read_async(WavEngine* self, WavFile* file, void *buffer, WavU64 frame_offset, size_t count,
+                   WavCompletionFunc func, void *context)
+{
+    WavU64 length = wav_get_length(file);
+
+    if (!wav_is_readable(file)) {
+        wav_err_set_literal(WAV_ERR_MODE, "This WavFile is not readable");
+        return (int)g_err.code;
+    }
+
+    if (frame_offset > length) {
+        frame_offset = length;
+    }
+    count = (count <= length - frame_offset) ? count : (size_t)(length - frame_offset);
+
+    return wav_engine_submit(self, file, WAV_FALSE, buffer, frame_offset, count, func, context);
+}
+
+int wav_write_async(WavEngine* self, WavFile* file, WAV_CONST void *buffer, size_t count,
+                    WavCompletionFunc func, void *context)
+{
+    WavU64 frame_offset;
+
+    if (wav_native_fd(file) < 0) {
+        wav_err_set_literal(WAV_ERR_MODE, "Asynchronous I/O needs a WavFile backed by a file descriptor");
+        return (int)g_err.code;
+    }
+    if (self->num_free == 0) {
+        wav_err_set_literal(WAV_ERR_BUSY, "Every request is in flight, call wav_engine_poll() first");
+        return (int)g_err.code;
+    }
+
+    if (wav_claim_frames(file, count, &frame_offset) != 0) {
+        return (int)g_err.code;
+    }
+
+    return wav_engine_submit(self, file, WAV_TRUE, (void*)buffer, frame_offset, count, func, context);
+}
+
+size_t wav_engine_poll(WavEngine* self, size_t min_complete)
+{
+    size_t n = 0;
+
+    if (min_complete > self->in_flight) {
+        min_complete = self->in_flight;
+    }
+
+#if WAV_HAVE_IO_URING
+    if (self->ring_fd >= 0) {
+        for (;;) {
+            unsigned head;
+            unsigned tail;
+            unsigned wait = n < min_complete ? (unsigned)(min_complete - n) : 0;
+
+            if (self->to_submit > 0 || wait > 0) {
+                int ret = wav_uring_enter(self->ring_fd, self->to_submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+                if (ret < 0) {
+                    if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                        continue;
+                    wav_err_set(WAV_ERR_OS, "io_uring_enter() failed [errno %d: %s]", errno, strerror(errno));
+                    return n;
+                }
+                self->to_submit -= (unsigned)ret;
+            }
+
+            head = *self->cq_head;
+            tail = __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE);
+            while (head != tail) {
+                struct io_uring_cqe* cqe = &self->cqes[head & *self->cq_mask];
+                size_t               index = (size_t)cqe->user_data;
+                WavRequest*          req = &self->requests[index];
+                int                  res = cqe->res;
+
+                __atomic_store_n(self->cq_head, ++head, __ATOMIC_RELEASE);
+
+                if (res < 0) {
+                    req->error = -res;
+                } else if (res == 0) {
+                    if (req->is_write && req->done < req->size)
+                        req->error = EIO;
+                } else {
+                    req->done += (size_t)res;
+                    if (req->done < req->size) {
+                        wav_uring_queue(self, index);
+                        continue;
+                    }
+                }
+
+                wav_engine_complete(self, index);
+                ++n;
+            }
+
+            if (n >= min_complete && self->to_submit == 0) {
+                return n;
+            }
+        }
+    }
+#endif
+
+    for (;;) {
+        size_t num_reaped;
+
+        wav_mutex_lock(&self->mutex);
+        while (self->num_completed + n < min_complete) {
+            wav_cond_wait(&self->done, &self->mutex);
+        }
+        num_reaped = self->num_completed;
+        memcpy(self->reaped, self->completed, num_reaped * sizeof(size_t));
+        self->num_completed = 0;
+        wav_mutex_unlock(&self->mutex);
+
+        for (size_t i = 0; i < num_reaped; ++i) {
+            wav_engine_complete(self, self->reaped[i]);
+        }
+        n += num_reaped;
+
+        if (n >= min_complete) {
+            return n;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/** Helpers shared by the libwav translation units
+ *
+ * Internal to libwav.
+ */
+
+#ifndef __WAV_INTERNAL_H__
+#define __WAV_INTERNAL_H__
+
+#include <assert.h>
+#include <stdarg.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "wav.h"
+
+extern WAV_THREAD_LOCAL WavErr g_err;
+
+WAV_INLINE void wav_err_set(WavErrCode code, WAV_CONST char *format, ...)
+{
+    assert(g_err.code == WAV_OK);
+    va_list args;
+    va_start(args, format);
+    g_err.code = code;
+    wav_vasprintf(&g_err.message, format, args);
+    g_err._is_literal = 0;
+    va_end(args);
+}
+
+WAV_INLINE void wav_err_set_literal(WavErrCode code, WAV_CONST char *message)
+{
+    assert(g_err.code == WAV_OK);
+    g_err.code = code;
+    g_err.message = (char *)message;
+    g_err._is_literal = 1;
+}
+
+/* A monotonic clock in milliseconds */
+WAV_INLINE WavU64 wav_now_ms(void)
+{
+#if defined(_WIN32)
+    return (WavU64)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (WavU64)ts.tv_sec * 1000 + (WavU64)ts.tv_nsec / 1000000;
+#endif
+}
+
+/* The format tag of the samples, which is the sub-format of extensible files */
+WavU16 wav_sample_format(WAV_CONST WavFile* self);
+
+/* The number of valid bits of integer samples that do not fill their
+ * container, 0 if they do */
+unsigned wav_valid_bits(WAV_CONST WavFile* self);
+
+WavBool wav_is_readable(WAV_CONST WavFile* self);
+WavBool wav_is_writable(WAV_CONST WavFile* self);
+
+/* Grow the data chunk to {frames} frames and update the header, promoting the
+ * file to RF64 if needed. The new frames are zeros. The data chunk must be the
+ * last chunk of the file. */
+int wav_extend(WavFile* self, WavU64 frames);
+
+/* Overwrite {count} frames at {frame_offset} of the data chunk without moving
+ * the current position. Several threads may write disjoint ranges at once if
+ * the I/O callbacks provide pwrite and nothing else touches the file. */
+int wav_pwrite(WavFile* self, WAV_CONST void *buffer, WavU64 frame_offset, size_t count);
+
+/* Grow the data chunk by {count} frames that the caller writes itself at
+ * {frame_offset}. The size fields are patched by the next flush. */
+int wav_claim_frames(WavFile* self, size_t count, WavU64* frame_offset);
+
+/* The byte offset of the first frame */
+WavU64 wav_data_offset(WAV_CONST WavFile* self);
+
+/* The descriptor behind the stdio and file descriptor backends, -1 for other backends */
+int wav_native_fd(WAV_CONST WavFile* self);
+
+#endif /* __WAV_INTERNAL_H__ */
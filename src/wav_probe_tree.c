@@ -0,0 +1,397 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "wav_internal.h"
+#include "wav_thread.h"
+
+#if defined(_WIN32)
+#define WAV_PATH_SEPARATOR '\\'
+#else
+#define WAV_PATH_SEPARATOR '/'
+#endif
+
+/* the longest time an idle worker sleeps before it looks for work again */
+#define WAV_PROBE_IDLE_MS   ((WavU64)1)
+
+typedef struct {
+    char*   path;
+    WavBool is_dir;
+} WavProbeTask;
+
+/* The owner pushes and pops at the bottom, other workers steal from the top.
+ * Directories are split into one task per file, so a worker that scans a big
+ * directory quickly has work for everyone else. */
+typedef struct {
+    WavMutex        mutex;
+    WavProbeTask*   tasks;
+    size_t          capacity;
+    size_t          top;
+    size_t          bottom;
+} WavProbeDeque;
+
+typedef struct {
+    WavProbeFunc    func;
+    void*           context;
+    size_t          n_workers;
+    WavProbeDeque*  deques;
+    volatile size_t pending;            /* tasks queued or running */
+    WavMutex        idle_mutex;
+    WavCond         idle;
+} WavProbePool;
+
+typedef struct {
+    WavProbePool*   pool;
+    size_t          index;
+} WavProbeWorker;
+
+static WavBool wav_probe_deque_push(WavProbeDeque* deque, WavProbeTask task)
+{
+    WavBool ok = WAV_TRUE;
+
+    wav_mutex_lock(&deque->mutex);
+    if (deque->bottom == deque->capacity) {
+        if (deque->top > 0) {
+            memmove(deque->tasks, deque->tasks + deque->top, (deque->bottom - deque->top) * sizeof(WavProbeTask));
+            deque->bottom -= deque->top;
+            deque->top = 0;
+        } else {
+            size_t        capacity = deque->capacity > 0 ? deque->capacity * 2 : 256;
+            WavProbeTask* tasks = wav_realloc(deque->tasks, capacity * sizeof(WavProbeTask));
+            if (tasks != NULL) {
+                deque->tasks = tasks;
+                deque->capacity = capacity;
+            } else {
+                ok = WAV_FALSE;
+            }
+        }
+    }
+    if (ok) {
+        deque->tasks[deque->bottom++] = task;
+    }
+    wav_mutex_unlock(&deque->mutex);
+
+    return ok;
+}
+
+static WavBool wav_probe_deque_pop(WavProbeDeque* deque, WavProbeTask* task)
+{
+    WavBool ok = WAV_FALSE;
+
+    wav_mutex_lock(&deque->mutex);
+    if (deque->bottom > deque->top) {
+        *task = deque->tasks[--deque->bottom];
+        ok = WAV_TRUE;
+    }
+    wav_mutex_unlock(&deque->mutex);
+
+    return ok;
+}
+
+static WavBool wav_probe_deque_steal(WavProbeDeque* deque, WavProbeTask* task)
+{
+    WavBool ok = WAV_FALSE;
+
+    wav_mutex_lock(&deque->mutex);
+    if (deque->bottom > deque->top) {
+        *task = deque->tasks[deque->top++];
+        ok = WAV_TRUE;
+    }
+    wav_mutex_unlock(&deque->mutex);
+
+    return ok;
+}
+
+/* Report the error in g_err to the callback and clear it */
+static void wav_probe_report(WavProbePool* pool, WAV_CONST char* path)
+{
+    pool->func(pool->context, path, NULL, &g_err);
+    wav_err_clear();
+}
+
+static void wav_probe_push(WavProbeWorker* worker, WAV_CONST char* dir, WAV_CONST char* name, WavBool is_dir)
+{
+    WavProbePool* pool = worker->pool;
+    size_t        dir_len = strlen(dir);
+    size_t        name_len = strlen(name);
+    WavProbeTask  task;
+
+    task.is_dir = is_dir;
+    task.path = wav_malloc(dir_len + name_len + 2);
+    if (task.path == NULL) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate a path");
+        wav_probe_report(pool, name);
+        return;
+    }
+    memcpy(task.path, dir, dir_len);
+    task.path[dir_len] = WAV_PATH_SEPARATOR;
+    memcpy(task.path + dir_len + 1, name, name_len + 1);
+
+    wav_atomic_add(&pool->pending, 1);
+    if (!wav_probe_deque_push(&pool->deques[worker->index], task)) {
+        wav_atomic_add(&pool->pending, (size_t)-1);
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the task queue");
+        wav_probe_report(pool, task.path);
+        wav_free(task.path);
+    }
+}
+
+static WavBool wav_is_wav_name(WAV_CONST char* name)
+{
+    static WAV_CONST char* WAV_CONST extensions[] = {".wav", ".wave", ".bwf", ".rf64"};
+    size_t len = strlen(name);
+
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i) {
+        size_t ext_len = strlen(extensions[i]);
+        size_t j;
+
+        if (len <= ext_len)
+            continue;
+        for (j = 0; j < ext_len; ++j) {
+            char c = name[len - ext_len + j];
+            if (c >= 'A' && c <= 'Z')
+                c = (char)(c - 'A' + 'a');
+            if (c != extensions[i][j])
+                break;
+        }
+        if (j == ext_len)
+            return WAV_TRUE;
+    }
+
+    return WAV_FALSE;
+}
+
+/* Queue the wav files and subdirectories of {dir} */
+static void wav_probe_scan(WavProbeWorker* worker, WAV_CONST char* dir)
+{
+#if defined(_WIN32)
+    WIN32_FIND_DATAA entry;
+    HANDLE           find;
+    char*            pattern = NULL;
+
+    if (wav_asprintf(&pattern, "%s\\*", dir) < 0) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate a path");
+        wav_probe_report(worker->pool, dir);
+        return;
+    }
+    find = FindFirstFileA(pattern, &entry);
+    wav_free(pattern);
+    if (find == INVALID_HANDLE_VALUE) {
+        wav_err_set(WAV_ERR_OS, "Error when opening directory %s [error %lu]", dir, (unsigned long)GetLastError());
+        wav_probe_report(worker->pool, dir);
+        return;
+    }
+
+    do {
+        if (strcmp(entry.cFileName, ".") == 0 || strcmp(entry.cFileName, "..") == 0)
+            continue;
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+            continue;
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            wav_probe_push(worker, dir, entry.cFileName, WAV_TRUE);
+        } else if (wav_is_wav_name(entry.cFileName)) {
+            wav_probe_push(worker, dir, entry.cFileName, WAV_FALSE);
+        }
+    } while (FindNextFileA(find, &entry));
+
+    FindClose(find);
+#else
+    DIR*           d = opendir(dir);
+    struct dirent* entry;
+
+    if (d == NULL) {
+        wav_err_set(WAV_ERR_OS, "Error when opening directory %s [errno %d: %s]", dir, errno, strerror(errno));
+        wav_probe_report(worker->pool, dir);
+        return;
+    }
+
+    while ((entry = readdir(d)) != NULL) {
+        WavBool is_dir;
+        WavBool is_file;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__)
+        is_dir = entry->d_type == DT_DIR;
+        is_file = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+#endif
+        {
+            /* follow links to files, but not to directories, which could form cycles */
+            struct stat st;
+            char*       path = NULL;
+
+            is_dir = WAV_FALSE;
+            is_file = WAV_FALSE;
+            if (wav_asprintf(&path, "%s/%s", dir, entry->d_name) >= 0) {
+                if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+                    is_dir = WAV_TRUE;
+                } else if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+                    is_file = WAV_TRUE;
+                }
+                wav_free(path);
+            }
+        }
+
+        if (is_dir) {
+            wav_probe_push(worker, dir, entry->d_name, WAV_TRUE);
+        } else if (is_file && wav_is_wav_name(entry->d_name)) {
+            wav_probe_push(worker, dir, entry->d_name, WAV_FALSE);
+        }
+    }
+
+    closedir(d);
+#endif
+
+    /* wake the idle workers, there is something to steal now */
+    wav_cond_broadcast(&worker->pool->idle);
+}
+
+static void wav_probe_run(WavProbeWorker* worker, WavProbeTask* task)
+{
+    WavProbePool* pool = worker->pool;
+
+    if (task->is_dir) {
+        wav_probe_scan(worker, task->path);
+    } else {
+        WavInfo info;
+        if (wav_probe(task->path, &info) == 0) {
+            pool->func(pool->context, task->path, &info, NULL);
+        } else {
+            wav_probe_report(pool, task->path);
+        }
+    }
+
+    wav_free(task->path);
+}
+
+static WavThreadResult WAV_THREAD_CALL wav_probe_worker_main(void *arg)
+{
+    WavProbeWorker* worker = arg;
+    WavProbePool*   pool = worker->pool;
+
+    for (;;) {
+        WavProbeTask task;
+        WavBool      found = wav_probe_deque_pop(&pool->deques[worker->index], &task);
+
+        for (size_t i = 1; !found && i < pool->n_workers; ++i) {
+            found = wav_probe_deque_steal(&pool->deques[(worker->index + i) % pool->n_workers], &task);
+        }
+
+        if (found) {
+            wav_probe_run(worker, &task);
+            if (wav_atomic_add(&pool->pending, (size_t)-1) == 0) {
+                wav_mutex_lock(&pool->idle_mutex);
+                wav_cond_broadcast(&pool->idle);
+                wav_mutex_unlock(&pool->idle_mutex);
+            }
+            continue;
+        }
+
+        wav_mutex_lock(&pool->idle_mutex);
+        if (wav_atomic_load(&pool->pending) == 0) {
+            wav_mutex_unlock(&pool->idle_mutex);
+            break;
+        }
+        wav_cond_timedwait(&pool->idle, &pool->idle_mutex, WAV_PROBE_IDLE_MS);
+        wav_mutex_unlock(&pool->idle_mutex);
+    }
+
+    return (WavThreadResult)0;
+}
+
+int wav_probe_tree(WAV_CONST char *root, WavProbeFunc func, void *context, size_t n_threads)
+{
+    WavProbePool    pool;
+    WavProbeWorker* workers;
+    WavThread*      threads;
+    WavProbeTask    task;
+    struct stat     st;
+    size_t          n_started = 0;
+    int             ret = 0;
+
+    if (stat(root, &st) != 0) {
+        wav_err_set(WAV_ERR_OS, "Error when opening %s [errno %d: %s]", root, errno, strerror(errno));
+        return (int)g_err.code;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        WavInfo info;
+        if (wav_probe(root, &info) != 0) {
+            return (int)g_err.code;
+        }
+        func(context, root, &info, NULL);
+        return 0;
+    }
+
+    if (n_threads == 0) {
+        n_threads = wav_cpu_count();
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pool.func = func;
+    pool.context = context;
+    pool.n_workers = n_threads;
+    pool.deques = wav_malloc(n_threads * sizeof(WavProbeDeque));
+    workers = wav_malloc(n_threads * sizeof(WavProbeWorker));
+    threads = wav_malloc(n_threads * sizeof(WavThread));
+    task.path = wav_strdup(root);
+    task.is_dir = WAV_TRUE;
+    if (pool.deques == NULL || workers == NULL || threads == NULL || task.path == NULL) {
+        wav_free(pool.deques);
+        wav_free(workers);
+        wav_free(threads);
+        wav_free(task.path);
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the thread pool");
+        return (int)g_err.code;
+    }
+
+    wav_mutex_init(&pool.idle_mutex);
+    wav_cond_init(&pool.idle);
+    for (size_t i = 0; i < n_threads; ++i) {
+        memset(&pool.deques[i], 0, sizeof(WavProbeDeque));
+        wav_mutex_init(&pool.deques[i].mutex);
+        workers[i].pool = &pool;
+        workers[i].index = i;
+    }
+
+    /* the root is scanned by the calling thread, which works as worker 0 */
+    pool.pending = 1;
+    if (wav_probe_deque_push(&pool.deques[0], task)) {
+        for (size_t i = 1; i < n_threads; ++i) {
+            if (wav_thread_create(&threads[i], &wav_probe_worker_main, &workers[i]) != 0)
+                break;
+            n_started = i;
+        }
+        wav_probe_worker_main(&workers[0]);
+        for (size_t i = 1; i <= n_started; ++i) {
+            wav_thread_join(threads[i]);
+        }
+    } else {
+        wav_free(task.path);
+        ret = WAV_ERR_OS;
+    }
+
+    for (size_t i = 0; i < n_threads; ++i) {
+        wav_free(pool.deques[i].tasks);
+        wav_mutex_destroy(&pool.deques[i].mutex);
+    }
+    wav_cond_destroy(&pool.idle);
+    wav_mutex_destroy(&pool.idle_mutex);
+    wav_free(pool.deques);
+    wav_free(workers);
+    wav_free(threads);
+
+    if (ret != 0) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the task queue");
+    }
+    return ret;
+}
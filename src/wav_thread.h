@@ -0,0 +1,203 @@
+/** Threads, locks and atomics
+ *
+ * Internal to libwav. A thin layer over pthreads and the Win32 API.
+ */
+
+#ifndef __WAV_THREAD_H__
+#define __WAV_THREAD_H__
+
+#include "wav.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+typedef HANDLE              WavThread;
+typedef SRWLOCK             WavMutex;
+typedef CONDITION_VARIABLE  WavCond;
+typedef DWORD               WavThreadResult;
+#define WAV_THREAD_CALL     WINAPI
+#else
+typedef pthread_t           WavThread;
+typedef pthread_mutex_t     WavMutex;
+typedef pthread_cond_t      WavCond;
+typedef void*               WavThreadResult;
+#define WAV_THREAD_CALL
+#endif
+
+typedef WavThreadResult (WAV_THREAD_CALL *WavThreadFunc)(void *arg);
+
+/* Returns 0 on success */
+WAV_INLINE int wav_thread_create(WavThread *thread, WavThreadFunc func, void *arg)
+{
+#if defined(_WIN32)
+    *thread = CreateThread(NULL, 0, func, arg, 0, NULL);
+    return *thread == NULL ? -1 : 0;
+#else
+    return pthread_create(thread, NULL, func, arg);
+#endif
+}
+
+WAV_INLINE void wav_thread_join(WavThread thread)
+{
+#if defined(_WIN32)
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
+
+WAV_INLINE void wav_mutex_init(WavMutex *mutex)
+{
+#if defined(_WIN32)
+    InitializeSRWLock(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+WAV_INLINE void wav_mutex_destroy(WavMutex *mutex)
+{
+#if defined(_WIN32)
+    (void)mutex;
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+WAV_INLINE void wav_mutex_lock(WavMutex *mutex)
+{
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+WAV_INLINE void wav_mutex_unlock(WavMutex *mutex)
+{
+#if defined(_WIN32)
+    ReleaseSRWLockExclusive(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+WAV_INLINE void wav_cond_init(WavCond *cond)
+{
+#if defined(_WIN32)
+    InitializeConditionVariable(cond);
+#else
+    pthread_cond_init(cond, NULL);
+#endif
+}
+
+WAV_INLINE void wav_cond_destroy(WavCond *cond)
+{
+#if defined(_WIN32)
+    (void)cond;
+#else
+    pthread_cond_destroy(cond);
+#endif
+}
+
+WAV_INLINE void wav_cond_signal(WavCond *cond)
+{
+#if defined(_WIN32)
+    WakeConditionVariable(cond);
+#else
+    pthread_cond_signal(cond);
+#endif
+}
+
+WAV_INLINE void wav_cond_broadcast(WavCond *cond)
+{
+#if defined(_WIN32)
+    WakeAllConditionVariable(cond);
+#else
+    pthread_cond_broadcast(cond);
+#endif
+}
+
+WAV_INLINE void wav_cond_wait(WavCond *cond, WavMutex *mutex)
+{
+#if defined(_WIN32)
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+#else
+    pthread_cond_wait(cond, mutex);
+#endif
+}
+
+/* Wait at most {ms} milliseconds. Returns non-zero on timeout. */
+WAV_INLINE int wav_cond_timedwait(WavCond *cond, WavMutex *mutex, WavU64 ms)
+{
+#if defined(_WIN32)
+    return !SleepConditionVariableSRW(cond, mutex, (DWORD)ms, 0);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += (time_t)(ms / 1000);
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(cond, mutex, &ts) == ETIMEDOUT;
+#endif
+}
+
+/* The number of processors online, at least 1 */
+WAV_INLINE size_t wav_cpu_count(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (size_t)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+/* Counters shared between threads. Loads acquire and stores release, which is
+ * enough to hand buffer contents from one thread to another. */
+WAV_INLINE size_t wav_atomic_load(WAV_CONST volatile size_t *p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+    size_t value = *p;
+    _ReadWriteBarrier();
+    return value;
+#endif
+}
+
+WAV_INLINE void wav_atomic_store(volatile size_t *p, size_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+#else
+    _ReadWriteBarrier();
+    *p = value;
+#endif
+}
+
+WAV_INLINE size_t wav_atomic_add(volatile size_t *p, size_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_add_fetch(p, value, __ATOMIC_ACQ_REL);
+#elif defined(_WIN64)
+    return (size_t)InterlockedAdd64((volatile LONG64*)p, (LONG64)value);
+#else
+    return (size_t)InterlockedAdd((volatile LONG*)p, (LONG)value);
+#endif
+}
+
+#endif /* __WAV_THREAD_H__ */
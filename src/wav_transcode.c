@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "wav_convert.h"
+#include "wav_internal.h"
+#include "wav_thread.h"
+
+/* positioned reads and writes that threads can issue at once */
+#if defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+#define WAV_TRANSCODE_MODE  WAV_OPEN_FD
+#else
+#define WAV_TRANSCODE_MODE  0
+#endif
+
+/* bytes of the source file converted at once by a worker */
+#define WAV_TRANSCODE_TILE_SIZE ((size_t)1 << 20)
+
+typedef struct {
+    WavFile*        src;
+    WavFile*        dst;
+    WavSampleType   src_type;
+    WavSampleType   dst_type;
+    unsigned        src_bits;           /* valid bits, 0 if the samples fill their container */
+    unsigned        dst_bits;
+    size_t          n_channels;
+    WavU64          length;             /* in frames */
+    size_t          tile_frames;
+    size_t          num_tiles;
+
+    volatile size_t next_tile;
+    volatile size_t failed;
+
+    WavMutex        mutex;              /* protects the error */
+    WavErrCode      error_code;
+    char*           error_message;
+} WavTranscode;
+
+/* Remember the first error of any worker and stop the others */
+static void wav_transcode_fail(WavTranscode* self)
+{
+    wav_mutex_lock(&self->mutex);
+    if (self->error_code == WAV_OK) {
+        self->error_code = g_err.code != WAV_OK ? g_err.code : WAV_ERR_FORMAT;
+        self->error_message = wav_strdup(g_err.code != WAV_OK ? g_err.message : "Unexpected EOF");
+    }
+    wav_mutex_unlock(&self->mutex);
+    wav_atomic_store(&self->failed, 1);
+    wav_err_clear();
+}
+
+static WavThreadResult WAV_THREAD_CALL wav_transcode_main(void *arg)
+{
+    WavTranscode* self = arg;
+    WavBool       copy = self->src_type == self->dst_type &&
+                         (self->dst_bits == 0 || (self->src_bits != 0 && self->src_bits <= self->dst_bits));
+    size_t        n_samples = self->tile_frames * self->n_channels;
+    WavU8*        src_buffer = wav_malloc(self->tile_frames * wav_get_sample_size(self->src) * self->n_channels);
+    float*        f32_buffer = copy ? NULL : wav_malloc(n_samples * sizeof(float));
+    WavU8*        dst_buffer = copy ? src_buffer : wav_malloc(self->tile_frames * wav_get_sample_size(self->dst) * self->n_channels);
+
+    if (src_buffer == NULL || dst_buffer == NULL || (!copy && f32_buffer == NULL)) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the conversion buffers");
+        wav_transcode_fail(self);
+    }
+
+    while (!wav_atomic_load(&self->failed)) {
+        size_t tile = wav_atomic_add(&self->next_tile, 1) - 1;
+        WavU64 start = (WavU64)tile * self->tile_frames;
+        size_t count;
+
+        if (tile >= self->num_tiles) {
+            break;
+        }
+        count = self->length - start < self->tile_frames ? (size_t)(self->length - start) : self->tile_frames;
+
+#if WAV_TRANSCODE_MODE
+        if (wav_pread(self->src, src_buffer, start, count) != count) {
+#else
+        if (wav_seek(self->src, (WavI64)start, SEEK_SET) != 0 || wav_read(self->src, src_buffer, count) != count) {
+#endif
+            wav_transcode_fail(self);
+            break;
+        }
+
+        if (!copy) {
+            wav_convert_to_f32(f32_buffer, src_buffer, count * self->n_channels, self->src_type);
+            if (self->src_bits != 0) {
+                wav_truncate_f32(f32_buffer, count * self->n_channels, self->src_bits);
+            }
+            if (self->dst_bits != 0) {
+                wav_round_f32(f32_buffer, f32_buffer, NULL, count * self->n_channels, self->dst_bits);
+            }
+            wav_convert_from_f32(dst_buffer, f32_buffer, NULL, count * self->n_channels, self->dst_type);
+        }
+
+        if (wav_pwrite(self->dst, dst_buffer, start, count) != 0) {
+            wav_transcode_fail(self);
+            break;
+        }
+    }
+
+    if (dst_buffer != src_buffer) {
+        wav_free(dst_buffer);
+    }
+    wav_free(f32_buffer);
+    wav_free(src_buffer);
+
+    return (WavThreadResult)0;
+}
+
+/* Give {dst} the format of {src} with the non-zero fields of {format} */
+static void wav_transcode_set_format(WavFile* dst, WavFile* src, WAV_CONST WavFormatSpec* format)
+{
+    WavU16 tag = format->format != 0 ? format->format : wav_get_format(src);
+    size_t sample_size = format->sample_size;
+
+    if ((format->num_channels != 0 && format->num_channels != wav_get_num_channels(src)) ||
+        (format->sample_rate != 0 && format->sample_rate != wav_get_sample_rate(src)))
+    {
+        wav_err_set_literal(WAV_ERR_PARAM, "The number of channels and the sample rate cannot be changed");
+        return;
+    }
+
+    /* keep the sample size of the source unless the format changes */
+    if (sample_size == 0 && tag == wav_get_format(src)) {
+        sample_size = wav_get_sample_size(src);
+    }
+
+    wav_set_num_channels(dst, wav_get_num_channels(src));
+    if (g_err.code == WAV_OK) {
+        wav_set_sample_rate(dst, wav_get_sample_rate(src));
+    }
+    if (g_err.code == WAV_OK && sample_size != 0) {
+        wav_set_sample_size(dst, sample_size);
+    }
+    if (g_err.code == WAV_OK) {
+        wav_set_format(dst, tag);
+    }
+    if (g_err.code == WAV_OK && tag == WAV_FORMAT_EXTENSIBLE) {
+        WavU16 sub_format = format->sub_format != 0 ? format->sub_format : wav_sample_format(src);
+        WavU32 channel_mask = format->channel_mask;
+
+        if (channel_mask == 0 && wav_get_format(src) == WAV_FORMAT_EXTENSIBLE) {
+            channel_mask = wav_get_channel_mask(src);
+        }
+        wav_set_sub_format(dst, sub_format);
+        if (g_err.code == WAV_OK) {
+            wav_set_channel_mask(dst, channel_mask);
+        }
+    }
+    if (g_err.code == WAV_OK && format->valid_bits_per_sample != 0) {
+        wav_set_valid_bits_per_sample(dst, format->valid_bits_per_sample);
+    } else if (g_err.code == WAV_OK && tag == WAV_FORMAT_EXTENSIBLE && wav_get_format(src) == WAV_FORMAT_EXTENSIBLE &&
+               wav_get_sample_size(dst) == wav_get_sample_size(src)) {
+        wav_set_valid_bits_per_sample(dst, wav_get_valid_bits_per_sample(src));
+    }
+}
+
+int wav_transcode_parallel(WAV_CONST char* src, WAV_CONST char* dst, WAV_CONST WavFormatSpec* format, size_t n_threads)
+{
+    WavTranscode self;
+    WavThread*   threads = NULL;
+    size_t       n_started = 0;
+
+    memset(&self, 0, sizeof(self));
+    wav_mutex_init(&self.mutex);
+
+    self.src = wav_open(src, WAV_OPEN_READ | WAV_TRANSCODE_MODE);
+    if (self.src == NULL) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the WavFile");
+        goto done;
+    }
+    if (g_err.code != WAV_OK) {
+        goto done;
+    }
+
+    self.dst = wav_open(dst, WAV_OPEN_WRITE | WAV_TRANSCODE_MODE);
+    if (self.dst == NULL) {
+        wav_err_set_literal(WAV_ERR_OS, "Failed to allocate the WavFile");
+        goto done;
+    }
+    if (g_err.code != WAV_OK) {
+        goto done;
+    }
+
+    wav_transcode_set_format(self.dst, self.src, format);
+    if (g_err.code != WAV_OK) {
+        goto done;
+    }
+
+    self.src_type = wav_sample_type(wav_sample_format(self.src), wav_get_sample_size(self.src));
+    self.dst_type = wav_sample_type(wav_sample_format(self.dst), wav_get_sample_size(self.dst));
+    if (self.src_type == WAV_SAMPLE_UNKNOWN || self.dst_type == WAV_SAMPLE_UNKNOWN) {
+        wav_err_set(WAV_ERR_FORMAT, "Cannot convert format %#06x with %zu-byte samples to format %#06x with %zu-byte samples",
+                    wav_sample_format(self.src), wav_get_sample_size(self.src),
+                    wav_sample_format(self.dst), wav_get_sample_size(self.dst));
+        goto done;
+    }
+    self.src_bits = wav_valid_bits(self.src);
+    self.dst_bits = wav_valid_bits(self.dst);
+
+    /* the header is final once the file has its full length */
+    self.length = wav_get_length(self.src);
+    if (wav_extend(self.dst, self.length) != 0) {
+        goto done;
+    }
+
+    self.n_channels = wav_get_num_channels(self.src);
+    self.tile_frames = WAV_TRANSCODE_TILE_SIZE / (wav_get_sample_size(self.src) * self.n_channels);
+    if (self.tile_frames == 0) {
+        self.tile_frames = 1;
+    }
+    self.num_tiles = (size_t)((self.length + self.tile_frames - 1) / self.tile_frames);
+
+#if WAV_TRANSCODE_MODE
+    if (n_threads == 0) {
+        n_threads = wav_cpu_count();
+    }
+    if (n_threads > self.num_tiles) {
+        n_threads = self.num_tiles;
+    }
+#else
+    n_threads = 1;
+#endif
+
+    if (n_threads > 1) {
+        threads = wav_malloc(n_threads * sizeof(WavThread));
+        for (size_t i = 1; threads != NULL && i < n_threads; ++i) {
+            if (wav_thread_create(&threads[i], &wav_transcode_main, &self) != 0)
+                break;
+            n_started = i;
+        }
+    }
+    wav_transcode_main(&self);
+    for (size_t i = 1; i <= n_started; ++i) {
+        wav_thread_join(threads[i]);
+    }
+    wav_free(threads);
+
+    if (self.error_code != WAV_OK) {
+        wav_err_set(self.error_code, "%s", self.error_message != NULL ? self.error_message : "");
+    }
+
+done:
+    if (self.src != NULL) {
+        wav_close(self.src);
+    }
+    if (self.dst != NULL) {
+        wav_close(self.dst);
+        if (g_err.code != WAV_OK) {
+            remove(dst);
+        }
+    }
+    wav_free(self.error_message);
+    wav_mutex_destroy(&self.mutex);
+
+    return (int)g_err.code;
+}
@@ -0,0 +1,1166 @@
+/* Micro benchmarks for libwav
+ *
+ * Usage: wav-bench [name [scale]]
+ *
+ * Without arguments every benchmark is run with scale 1. {scale} multiplies
+ * the amount of data each benchmark processes.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "wav.h"
+
+#define BENCH_FILE "bench.wav"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, const char *variant, double seconds, double bytes, double ops)
+{
+    printf("%-16s %-24s %8.3f s %10.1f MB/s %12.0f ops/s\n",
+           name, variant, seconds, bytes / seconds / 1e6, ops / seconds);
+}
+
+static void check_err(const char *what)
+{
+    if (wav_err()->code != WAV_OK) {
+        fprintf(stderr, "%s: %s\n", what, wav_err()->message);
+        exit(1);
+    }
+}
+
+/* 10 ms blocks of 16-bit stereo at 44.1 kHz, as written by a capture callback */
+static void bench_write_small(int scale)
+{
+    static const struct {
+        const char*     name;
+        WavU32          mode;
+        WavHeaderUpdate policy;
+        WavU64          interval;
+    } variants[] = {
+        {"stdio always",        WAV_OPEN_WRITE,                 WAV_HEADER_UPDATE_ALWAYS,   0},
+        {"stdio every 1 MiB",   WAV_OPEN_WRITE,                 WAV_HEADER_UPDATE_BYTES,    1 << 20},
+        {"stdio every 1000 ms", WAV_OPEN_WRITE,                 WAV_HEADER_UPDATE_MS,       1000},
+        {"stdio on flush",      WAV_OPEN_WRITE,                 WAV_HEADER_UPDATE_ON_FLUSH, 0},
+        {"fd always",           WAV_OPEN_WRITE | WAV_OPEN_FD,   WAV_HEADER_UPDATE_ALWAYS,   0},
+        {"fd on flush",         WAV_OPEN_WRITE | WAV_OPEN_FD,   WAV_HEADER_UPDATE_ON_FLUSH, 0},
+        {"direct on flush",     WAV_OPEN_WRITE | WAV_OPEN_DIRECT, WAV_HEADER_UPDATE_ON_FLUSH, 0},
+    };
+    size_t frames_per_block = 441;
+    size_t num_blocks = 6000 * (size_t)scale;
+    WavI16 *block = calloc(frames_per_block * 2, sizeof(WavI16));
+
+    for (size_t i = 0; i < frames_per_block * 2; ++i) {
+        block[i] = (WavI16)(i * 37);
+    }
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        WavFile *fp = wav_open(BENCH_FILE, variants[v].mode);
+        check_err("wav_open");
+        wav_set_header_update(fp, variants[v].policy, variants[v].interval);
+
+        double t0 = now_sec();
+        for (size_t i = 0; i < num_blocks; ++i) {
+            wav_write(fp, block, frames_per_block);
+        }
+        wav_close(fp);
+        double t1 = now_sec();
+        check_err("wav_write");
+
+        report("write-small", variants[v].name, t1 - t0, (double)(num_blocks * frames_per_block * 4), (double)num_blocks);
+    }
+
+    free(block);
+    remove(BENCH_FILE);
+}
+
+static WavU64 checksum(const WavI16 *x, size_t n)
+{
+    WavU64 sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += (WavU16)x[i];
+    }
+    return sum;
+}
+
+/* 10 ms blocks of 16-bit stereo at 44.1 kHz made of a pre-roll fragment and 8
+ * bus fragments, written one by one and with wav_writev */
+static void bench_writev(int scale)
+{
+    static const struct {
+        const char* name;
+        WavU32      mode;
+        int         vectored;
+    } variants[] = {
+        {"stdio wav_write",     WAV_OPEN_WRITE,                 0},
+        {"stdio wav_writev",    WAV_OPEN_WRITE,                 1},
+        {"fd wav_write",        WAV_OPEN_WRITE | WAV_OPEN_FD,   0},
+        {"fd wav_writev",       WAV_OPEN_WRITE | WAV_OPEN_FD,   1},
+    };
+    WavFrameSpan spans[9];
+    size_t num_blocks = 6000 * (size_t)scale;
+    WavI16 *block = calloc(441 * 2, sizeof(WavI16));
+
+    for (size_t i = 0; i < 441 * 2; ++i) {
+        block[i] = (WavI16)(i * 37);
+    }
+    spans[0].data = block;
+    spans[0].count = 9;
+    for (size_t i = 1; i < 9; ++i) {
+        spans[i].data = block + (9 + (i - 1) * 54) * 2;
+        spans[i].count = 54;
+    }
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        WavFile *fp = wav_open(BENCH_FILE, variants[v].mode);
+        check_err("wav_open");
+
+        double t0 = now_sec();
+        for (size_t i = 0; i < num_blocks; ++i) {
+            if (variants[v].vectored) {
+                wav_writev(fp, spans, 9);
+            } else {
+                for (size_t j = 0; j < 9; ++j) {
+                    wav_write(fp, spans[j].data, spans[j].count);
+                }
+            }
+        }
+        wav_close(fp);
+        double seconds = now_sec() - t0;
+        check_err("wav_write");
+
+        report("writev", variants[v].name, seconds, (double)(num_blocks * 441 * 4), (double)num_blocks);
+    }
+
+    free(block);
+    remove(BENCH_FILE);
+}
+
+/* 256 MiB of 16-bit stereo per unit of scale, read in 64 Ki frame blocks */
+static void bench_read(int scale)
+{
+    static const struct {
+        const char* name;
+        WavU32      mode;
+        int         view;
+    } variants[] = {
+        {"stdio wav_read",  WAV_OPEN_READ,                  0},
+        {"fd wav_read",     WAV_OPEN_READ | WAV_OPEN_FD,    0},
+        {"direct wav_read", WAV_OPEN_READ | WAV_OPEN_DIRECT, 0},
+        {"mmap wav_read",   WAV_OPEN_READ | WAV_OPEN_MMAP,  0},
+        {"mmap view",       WAV_OPEN_READ | WAV_OPEN_MMAP,  1},
+    };
+    size_t frames_per_block = 65536;
+    size_t num_blocks = 1024 * (size_t)scale;
+    size_t total_frames = frames_per_block * num_blocks;
+    WavI16 *block = calloc(frames_per_block * 2, sizeof(WavI16));
+    WavU64 expected = 0;
+    WavFile *fp;
+
+    fp = wav_open(BENCH_FILE, WAV_OPEN_WRITE | WAV_OPEN_FD);
+    check_err("wav_open");
+    wav_set_header_update(fp, WAV_HEADER_UPDATE_ON_FLUSH, 0);
+    for (size_t i = 0; i < num_blocks; ++i) {
+        for (size_t j = 0; j < frames_per_block * 2; ++j) {
+            block[j] = (WavI16)(i + j);
+        }
+        wav_write(fp, block, frames_per_block);
+    }
+    wav_close(fp);
+    check_err("wav_write");
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        WavU64 sum = 0;
+
+        fp = wav_open(BENCH_FILE, variants[v].mode);
+        check_err("wav_open");
+        if (variants[v].mode & WAV_OPEN_MMAP) {
+            wav_map_advise(fp, WAV_MAP_SEQUENTIAL);
+        }
+
+        double t0 = now_sec();
+        if (variants[v].view) {
+            for (size_t pos = 0; pos < total_frames; pos += frames_per_block) {
+                sum += checksum(wav_map_frames(fp, pos, frames_per_block), frames_per_block * 2);
+            }
+        } else {
+            size_t n;
+            while ((n = wav_read(fp, block, frames_per_block)) > 0) {
+                sum += checksum(block, n * 2);
+            }
+        }
+        double t1 = now_sec();
+        check_err("wav_read");
+        wav_close(fp);
+
+        report("read", variants[v].name, t1 - t0, (double)(total_frames * 4), (double)num_blocks);
+        if (v == 0) {
+            expected = sum;
+        } else if (sum != expected) {
+            fprintf(stderr, "read: %s checksum mismatch\n", variants[v].name);
+            exit(1);
+        }
+    }
+
+    free(block);
+    remove(BENCH_FILE);
+}
+
+/* Worst case time of a single call from a capture callback writing 10 ms blocks
+ * of 16-bit stereo at 44.1 kHz, directly and through a WavAsyncWriter. The
+ * producer runs much faster than real time, so it retries whatever overran
+ * the ring buffer. */
+static void bench_async(int scale)
+{
+    size_t frames_per_block = 441;
+    size_t num_blocks = 6000 * (size_t)scale;
+    WavI16 *block = calloc(frames_per_block * 2, sizeof(WavI16));
+
+    for (int async = 0; async < 2; ++async) {
+        WavFile *fp = wav_open(BENCH_FILE, WAV_OPEN_WRITE);
+        WavAsyncWriter *writer = NULL;
+        double worst = 0;
+        size_t overruns = 0;
+        check_err("wav_open");
+        if (async) {
+            writer = wav_async_open(fp, 1 << 16);
+            check_err("wav_async_open");
+        }
+
+        double t0 = now_sec();
+        for (size_t i = 0; i < num_blocks; ++i) {
+            size_t done = 0;
+            while (done < frames_per_block && wav_err()->code == WAV_OK) {
+                double t = now_sec();
+                if (async) {
+                    done += wav_async_write(writer, block + done * 2, frames_per_block - done);
+                } else {
+                    done = wav_write(fp, block, frames_per_block);
+                }
+                t = now_sec() - t;
+                worst = t > worst ? t : worst;
+            }
+        }
+        if (async) {
+            overruns = wav_async_get_overrun_count(writer);
+            wav_async_close(writer);
+        }
+        wav_close(fp);
+        double t1 = now_sec();
+        check_err("wav_write");
+
+        report("async", async ? "wav_async_write" : "wav_write", t1 - t0, (double)(num_blocks * frames_per_block * 4), (double)num_blocks);
+        printf("%-16s %-24s %8.3f ms worst call", "", "", worst * 1e3);
+        if (async) {
+            printf(", %zu overruns", overruns);
+        }
+        printf("\n");
+    }
+
+    free(block);
+    remove(BENCH_FILE);
+}
+
+/* The same small writes and reads through wav_open() and through each WavIO
+ * backend. The memory backend never touches the file system. */
+static void bench_io(int scale)
+{
+    enum { PATH, STDIO, FD, MEMORY };
+    static const struct {
+        const char* name;
+        int         backend;
+    } variants[] = {
+        {"wav_open",            PATH},
+        {"wav_io_stdio",        STDIO},
+#if defined(__unix__) || defined(__APPLE__)
+        {"wav_io_fd",           FD},
+#endif
+        {"wav_io_memory",       MEMORY},
+    };
+    size_t frames_per_block = 441;
+    size_t num_blocks = 6000 * (size_t)scale;
+    WavI16 *block = calloc(frames_per_block * 2, sizeof(WavI16));
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        WavMemoryBuffer mem = {NULL, 0, 0, 0, WAV_TRUE};
+        FILE *stream = NULL;
+        int fd = -1;
+        double seconds = 0;
+
+        for (int pass = 0; pass < 2; ++pass) {
+            WavU32 mode = pass == 0 ? WAV_OPEN_WRITE : WAV_OPEN_READ;
+            WavFile *fp = NULL;
+
+            mem.pos = 0;
+            switch (variants[v].backend) {
+                case PATH:
+                    fp = wav_open(BENCH_FILE, mode);
+                    break;
+                case STDIO:
+                    stream = fopen(BENCH_FILE, pass == 0 ? "wb+" : "rb");
+                    fp = wav_open_io(wav_io_stdio(), stream, mode);
+                    break;
+#if defined(__unix__) || defined(__APPLE__)
+                case FD:
+                    fd = open(BENCH_FILE, pass == 0 ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY, 0666);
+                    fp = wav_open_io(wav_io_fd(), (void*)(WavIntPtr)fd, mode);
+                    break;
+#endif
+                case MEMORY:
+                    fp = wav_open_io(wav_io_memory(), &mem, mode);
+                    break;
+            }
+            check_err("wav_open");
+
+            double t0 = now_sec();
+            for (size_t i = 0; i < num_blocks; ++i) {
+                if (pass == 0) {
+                    wav_write(fp, block, frames_per_block);
+                } else {
+                    wav_read(fp, block, frames_per_block);
+                }
+            }
+            wav_close(fp);
+            seconds += now_sec() - t0;
+            check_err(pass == 0 ? "wav_write" : "wav_read");
+
+            if (stream != NULL) {
+                fclose(stream);
+                stream = NULL;
+            }
+#if defined(__unix__) || defined(__APPLE__)
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+#endif
+        }
+
+        report("io", variants[v].name, seconds, (double)(2 * num_blocks * frames_per_block * 4), (double)(2 * num_blocks));
+        wav_free(mem.data);
+    }
+
+    free(block);
+    remove(BENCH_FILE);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BENCH_TREE "bench-tree"
+
+static void probe_count(void *context, const char *path, const WavInfo *info, const WavErr *err)
+{
+    (void)path;
+    (void)info;
+    if (err == NULL) {
+        __atomic_add_fetch((size_t*)context, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* 100 Ki tiny files in 100 directories, probed one by one and as a tree. The
+ * tree variants include the directory walk. */
+static void bench_probe(int scale)
+{
+    size_t num_dirs = 100;
+    size_t num_files = 100 * 1024 * (size_t)scale;
+    size_t n_threads[] = {1, 0};
+    WavI16 frames[64 * 2] = {0};
+    char path[64];
+    double t0;
+
+    mkdir(BENCH_TREE, 0777);
+    for (size_t d = 0; d < num_dirs; ++d) {
+        snprintf(path, sizeof(path), BENCH_TREE "/%03zu", d);
+        mkdir(path, 0777);
+    }
+    for (size_t i = 0; i < num_files; ++i) {
+        snprintf(path, sizeof(path), BENCH_TREE "/%03zu/%06zu.wav", i % num_dirs, i);
+        WavFile *fp = wav_open(path, WAV_OPEN_WRITE);
+        wav_write(fp, frames, 64);
+        wav_close(fp);
+        check_err("wav_write");
+    }
+
+    t0 = now_sec();
+    for (size_t i = 0; i < num_files; ++i) {
+        snprintf(path, sizeof(path), BENCH_TREE "/%03zu/%06zu.wav", i % num_dirs, i);
+        WavFile *fp = wav_open(path, WAV_OPEN_READ);
+        wav_get_length(fp);
+        wav_close(fp);
+    }
+    report("probe", "wav_open", now_sec() - t0, 0, (double)num_files);
+    check_err("wav_open");
+
+    t0 = now_sec();
+    for (size_t i = 0; i < num_files; ++i) {
+        WavInfo info;
+        snprintf(path, sizeof(path), BENCH_TREE "/%03zu/%06zu.wav", i % num_dirs, i);
+        wav_probe(path, &info);
+    }
+    report("probe", "wav_probe", now_sec() - t0, 0, (double)num_files);
+    check_err("wav_probe");
+
+    for (size_t v = 0; v < sizeof(n_threads) / sizeof(n_threads[0]); ++v) {
+        size_t count = 0;
+        char variant[32];
+
+        t0 = now_sec();
+        wav_probe_tree(BENCH_TREE, &probe_count, &count, n_threads[v]);
+        double seconds = now_sec() - t0;
+        check_err("wav_probe_tree");
+        if (count != num_files) {
+            fprintf(stderr, "wav_probe_tree: found %zu of %zu files\n", count, num_files);
+            exit(1);
+        }
+
+        if (n_threads[v] == 0) {
+            snprintf(variant, sizeof(variant), "wav_probe_tree all");
+        } else {
+            snprintf(variant, sizeof(variant), "wav_probe_tree %zu", n_threads[v]);
+        }
+        report("probe", variant, seconds, 0, (double)num_files);
+    }
+
+    for (size_t i = 0; i < num_files; ++i) {
+        snprintf(path, sizeof(path), BENCH_TREE "/%03zu/%06zu.wav", i % num_dirs, i);
+        remove(path);
+    }
+    for (size_t d = 0; d < num_dirs; ++d) {
+        snprintf(path, sizeof(path), BENCH_TREE "/%03zu", d);
+        rmdir(path);
+    }
+    rmdir(BENCH_TREE);
+}
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+typedef struct {
+    WavFile*    shared;         /* NULL to open a handle per thread */
+    size_t      num_reads;
+    size_t      frames_per_read;
+    WavU64      length;
+    unsigned    seed;
+    WavU64      sum;
+} PreadJob;
+
+static void *pread_main(void *arg)
+{
+    PreadJob *job = arg;
+    WavFile *fp = job->shared != NULL ? job->shared : wav_open(BENCH_FILE, WAV_OPEN_READ | WAV_OPEN_FD);
+    WavI16 *block = malloc(job->frames_per_read * 4);
+    WavU64 state = job->seed;
+
+    for (size_t i = 0; i < job->num_reads; ++i) {
+        WavU64 pos;
+        size_t n;
+
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        pos = (state >> 16) % (job->length - job->frames_per_read);
+        if (job->shared != NULL) {
+            n = wav_pread(fp, block, pos, job->frames_per_read);
+        } else {
+            wav_seek(fp, (WavI64)pos, SEEK_SET);
+            n = wav_read(fp, block, job->frames_per_read);
+        }
+        job->sum += checksum(block, n * 2);
+    }
+
+    if (job->shared == NULL) {
+        wav_close(fp);
+    }
+    free(block);
+    return NULL;
+}
+
+/* Random 16 KiB reads from 256 MiB of 16-bit stereo per unit of scale, by 1 to
+ * 8 threads sharing one handle through wav_pread, or with a handle each */
+static void bench_pread(int scale)
+{
+    size_t threads[] = {1, 2, 4, 8};
+    size_t frames_per_read = 4096;
+    size_t num_reads = 16384 * (size_t)scale;
+    size_t num_blocks = 1024 * (size_t)scale;
+    size_t frames_per_block = 65536;
+    WavI16 *block = calloc(frames_per_block * 2, sizeof(WavI16));
+    WavFile *fp;
+
+    fp = wav_open(BENCH_FILE, WAV_OPEN_WRITE | WAV_OPEN_FD);
+    check_err("wav_open");
+    wav_set_header_update(fp, WAV_HEADER_UPDATE_ON_FLUSH, 0);
+    for (size_t i = 0; i < num_blocks; ++i) {
+        for (size_t j = 0; j < frames_per_block * 2; ++j) {
+            block[j] = (WavI16)(i + j);
+        }
+        wav_write(fp, block, frames_per_block);
+    }
+    wav_close(fp);
+    check_err("wav_write");
+
+    fp = wav_open(BENCH_FILE, WAV_OPEN_READ | WAV_OPEN_FD);
+    check_err("wav_open");
+
+    for (int shared = 1; shared >= 0; --shared) {
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+            pthread_t tids[8];
+            PreadJob jobs[8];
+            WavU64 sum = 0;
+            char variant[32];
+
+            double t0 = now_sec();
+            for (size_t i = 0; i < threads[t]; ++i) {
+                jobs[i].shared = shared ? fp : NULL;
+                jobs[i].num_reads = num_reads / threads[t];
+                jobs[i].frames_per_read = frames_per_read;
+                jobs[i].length = wav_get_length(fp);
+                jobs[i].seed = (unsigned)i + 1;
+                jobs[i].sum = 0;
+                pthread_create(&tids[i], NULL, &pread_main, &jobs[i]);
+            }
+            for (size_t i = 0; i < threads[t]; ++i) {
+                pthread_join(tids[i], NULL);
+                sum += jobs[i].sum;
+            }
+            double seconds = now_sec() - t0;
+            check_err("wav_pread");
+            if (sum == 0) {
+                fprintf(stderr, "pread: nothing read\n");
+                exit(1);
+            }
+
+            snprintf(variant, sizeof(variant), "%s x%zu", shared ? "shared wav_pread" : "own wav_read", threads[t]);
+            report("pread", variant, seconds, (double)(num_reads * frames_per_read * 4), (double)num_reads);
+        }
+    }
+
+    wav_close(fp);
+    free(block);
+    remove(BENCH_FILE);
+}
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ENGINE_STREAMS 256
+
+typedef struct {
+    WavEngine*  engine;
+    WavFile*    fp;
+    void*       buffer;
+    size_t      frames_per_op;
+    size_t      remaining;
+    WavU64      state;
+    WavU64      sum;
+} EngineStream;
+
+static void engine_read_next(EngineStream *stream);
+
+static void engine_written(void *context, WavFile *file, size_t count, const WavErr *err)
+{
+    EngineStream *stream = context;
+    (void)file;
+
+    if (err != NULL || count != stream->frames_per_op) {
+        fprintf(stderr, "wav_write_async: %s\n", err != NULL ? err->message : "short write");
+        exit(1);
+    }
+    if (--stream->remaining > 0) {
+        wav_write_async(stream->engine, stream->fp, stream->buffer, stream->frames_per_op, &engine_written, stream);
+        check_err("wav_write_async");
+    }
+}
+
+static void engine_read(void *context, WavFile *file, size_t count, const WavErr *err)
+{
+    EngineStream *stream = context;
+    (void)file;
+
+    if (err != NULL) {
+        fprintf(stderr, "wav_read_async: %s\n", err->message);
+        exit(1);
+    }
+    stream->sum += checksum(stream->buffer, count * 2);
+    if (--stream->remaining > 0) {
+        engine_read_next(stream);
+    }
+}
+
+static void engine_read_next(EngineStream *stream)
+{
+    WavU64 pos;
+
+    stream->state = stream->state * 6364136223846793005ULL + 1442695040888963407ULL;
+    pos = (stream->state >> 16) % (wav_get_length(stream->fp) - stream->frames_per_op);
+    wav_read_async(stream->engine, stream->fp, stream->buffer, pos, stream->frames_per_op, &engine_read, stream);
+    check_err("wav_read_async");
+}
+
+/* 256 streams of 16-bit stereo with one request in flight each: 1 MiB appended
+ * to every stream per unit of scale in 64 KiB writes, then random 16 KiB reads,
+ * through io_uring, the thread pool and blocking wav_pread */
+static void bench_engine(int scale)
+{
+    static const struct {
+        const char* name;
+        WavU32      flags;
+    } variants[] = {
+        {"io_uring", 0},
+        {"threads",  WAV_ENGINE_THREADS},
+    };
+    size_t frames_per_write = 16384;
+    size_t num_writes = 16 * (size_t)scale;
+    size_t frames_per_read = 4096;
+    size_t num_reads = 256 * (size_t)scale;
+    EngineStream streams[ENGINE_STREAMS];
+    char path[64];
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        WavEngine *engine = wav_engine_open(ENGINE_STREAMS, ENGINE_STREAMS, frames_per_write * 4, variants[v].flags);
+        char variant[32];
+        WavU64 sum = 0;
+        double t0;
+
+        check_err("wav_engine_open");
+        if (variants[v].flags == 0 && !wav_engine_uses_io_uring(engine)) {
+            wav_engine_close(engine);
+            continue;
+        }
+
+        for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+            WavI16 *block = wav_engine_get_buffer(engine, i);
+            for (size_t j = 0; j < frames_per_write * 2; ++j) {
+                block[j] = (WavI16)(i + j);
+            }
+            snprintf(path, sizeof(path), "bench-%03zu.wav", i);
+            streams[i].engine = engine;
+            streams[i].fp = wav_open(path, WAV_OPEN_WRITE | WAV_OPEN_FD);
+            check_err("wav_open");
+            wav_set_header_update(streams[i].fp, WAV_HEADER_UPDATE_ON_FLUSH, 0);
+            streams[i].buffer = block;
+            streams[i].frames_per_op = frames_per_write;
+            streams[i].remaining = num_writes;
+        }
+
+        t0 = now_sec();
+        for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+            wav_write_async(engine, streams[i].fp, streams[i].buffer, frames_per_write, &engine_written, &streams[i]);
+            check_err("wav_write_async");
+        }
+        while (wav_engine_get_in_flight(engine) > 0) {
+            wav_engine_poll(engine, 1);
+        }
+        for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+            wav_close(streams[i].fp);
+        }
+        double seconds = now_sec() - t0;
+        check_err("wav_close");
+
+        snprintf(variant, sizeof(variant), "write %s", variants[v].name);
+        report("engine", variant, seconds, (double)(ENGINE_STREAMS * num_writes * frames_per_write * 4), (double)(ENGINE_STREAMS * num_writes));
+
+        for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+            snprintf(path, sizeof(path), "bench-%03zu.wav", i);
+            streams[i].fp = wav_open(path, WAV_OPEN_READ | WAV_OPEN_FD);
+            check_err("wav_open");
+            streams[i].frames_per_op = frames_per_read;
+            streams[i].remaining = num_reads;
+            streams[i].state = i + 1;
+            streams[i].sum = 0;
+        }
+
+        t0 = now_sec();
+        for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+            engine_read_next(&streams[i]);
+        }
+        while (wav_engine_get_in_flight(engine) > 0) {
+            wav_engine_poll(engine, 1);
+        }
+        seconds = now_sec() - t0;
+        check_err("wav_engine_poll");
+
+        for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+            sum += streams[i].sum;
+        }
+        if (sum == 0) {
+            fprintf(stderr, "engine: nothing read\n");
+            exit(1);
+        }
+
+        snprintf(variant, sizeof(variant), "read %s", variants[v].name);
+        report("engine", variant, seconds, (double)(ENGINE_STREAMS * num_reads * frames_per_read * 4), (double)(ENGINE_STREAMS * num_reads));
+
+        if (v == sizeof(variants) / sizeof(variants[0]) - 1) {
+            WavI16 *block = malloc(frames_per_read * 4);
+
+            t0 = now_sec();
+            for (size_t n = 0; n < num_reads; ++n) {
+                for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+                    WavU64 pos;
+                    streams[i].state = streams[i].state * 6364136223846793005ULL + 1442695040888963407ULL;
+                    pos = (streams[i].state >> 16) % (wav_get_length(streams[i].fp) - frames_per_read);
+                    sum += checksum(block, wav_pread(streams[i].fp, block, pos, frames_per_read) * 2);
+                }
+            }
+            seconds = now_sec() - t0;
+            check_err("wav_pread");
+            report("engine", "read blocking wav_pread", seconds, (double)(ENGINE_STREAMS * num_reads * frames_per_read * 4), (double)(ENGINE_STREAMS * num_reads));
+            free(block);
+        }
+
+        for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+            wav_close(streams[i].fp);
+        }
+        wav_engine_close(engine);
+    }
+
+    for (size_t i = 0; i < ENGINE_STREAMS; ++i) {
+        snprintf(path, sizeof(path), "bench-%03zu.wav", i);
+        remove(path);
+    }
+}
+#endif
+
+/* 256 MiB of 32-channel 24-bit PCM per unit of scale converted to 16-bit,
+ * sequentially through float and with wav_transcode_parallel */
+static void bench_transcode(int scale)
+{
+    size_t n_channels = 32;
+    size_t frames_per_block = 4096;
+    size_t num_blocks = 682 * (size_t)scale;
+    size_t total_frames = frames_per_block * num_blocks;
+    unsigned char *block = malloc(frames_per_block * n_channels * 3);
+    float *samples = malloc(frames_per_block * n_channels * sizeof(float));
+    size_t n_threads[] = {1, 0};
+    WavFormatSpec spec;
+    WavFile *fp;
+    WavFile *out;
+
+    fp = wav_open(BENCH_FILE, WAV_OPEN_WRITE);
+    check_err("wav_open");
+    wav_set_num_channels(fp, (WavU16)n_channels);
+    wav_set_sample_rate(fp, 48000);
+    wav_set_sample_size(fp, 3);
+    wav_set_header_update(fp, WAV_HEADER_UPDATE_ON_FLUSH, 0);
+    for (size_t i = 0; i < num_blocks; ++i) {
+        for (size_t j = 0; j < frames_per_block * n_channels * 3; ++j) {
+            block[j] = (unsigned char)(i * 7 + j);
+        }
+        wav_write(fp, block, frames_per_block);
+    }
+    wav_close(fp);
+    check_err("wav_write");
+
+    double t0 = now_sec();
+    fp = wav_open(BENCH_FILE, WAV_OPEN_READ);
+    out = wav_open("bench-out.wav", WAV_OPEN_WRITE);
+    wav_set_num_channels(out, (WavU16)n_channels);
+    wav_set_sample_rate(out, 48000);
+    wav_set_header_update(out, WAV_HEADER_UPDATE_ON_FLUSH, 0);
+    for (size_t n; (n = wav_read_f32(fp, samples, frames_per_block)) > 0; ) {
+        wav_write_f32(out, samples, n);
+    }
+    wav_close(out);
+    wav_close(fp);
+    report("transcode", "wav_read_f32 + write", now_sec() - t0, (double)(total_frames * n_channels * 3), (double)total_frames);
+    check_err("wav_write_f32");
+
+    memset(&spec, 0, sizeof(spec));
+    spec.sample_size = 2;
+    for (size_t v = 0; v < sizeof(n_threads) / sizeof(n_threads[0]); ++v) {
+        char variant[32];
+
+        t0 = now_sec();
+        wav_transcode_parallel(BENCH_FILE, "bench-out.wav", &spec, n_threads[v]);
+        double seconds = now_sec() - t0;
+        check_err("wav_transcode_parallel");
+
+        if (n_threads[v] == 0) {
+            snprintf(variant, sizeof(variant), "parallel all");
+        } else {
+            snprintf(variant, sizeof(variant), "parallel %zu", n_threads[v]);
+        }
+        report("transcode", variant, seconds, (double)(total_frames * n_channels * 3), (double)total_frames);
+    }
+
+    free(samples);
+    free(block);
+    remove("bench-out.wav");
+    remove(BENCH_FILE);
+}
+
+/* 64 MiB of 16-bit stereo per unit of scale written in 10 ms blocks under each
+ * durability policy */
+static void bench_durability(int scale)
+{
+    static const struct {
+        const char*     name;
+        WavDurability   policy;
+        WavU64          interval;
+        WavBool         data_only;
+    } variants[] = {
+        {"none",                WAV_DURABILITY_NONE,        0,          WAV_FALSE},
+        {"on close",            WAV_DURABILITY_ON_CLOSE,    0,          WAV_FALSE},
+        {"every 4 MiB",         WAV_DURABILITY_BYTES,       4 << 20,    WAV_FALSE},
+        {"every 4 MiB data",    WAV_DURABILITY_BYTES,       4 << 20,    WAV_TRUE},
+        {"every 256 KiB",       WAV_DURABILITY_BYTES,       256 << 10,  WAV_FALSE},
+        {"every 256 KiB data",  WAV_DURABILITY_BYTES,       256 << 10,  WAV_TRUE},
+        {"every 100 ms",        WAV_DURABILITY_MS,          100,        WAV_FALSE},
+        {"every 10 ms",         WAV_DURABILITY_MS,          10,         WAV_FALSE},
+    };
+    size_t frames_per_block = 441;
+    size_t num_blocks = 38000 * (size_t)scale;
+    WavI16 *block = calloc(frames_per_block * 2, sizeof(WavI16));
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        WavFile *fp = wav_open(BENCH_FILE, WAV_OPEN_WRITE);
+        check_err("wav_open");
+        wav_set_header_update(fp, WAV_HEADER_UPDATE_ON_FLUSH, 0);
+        wav_set_durability(fp, variants[v].policy, variants[v].interval, variants[v].data_only);
+
+        double t0 = now_sec();
+        for (size_t i = 0; i < num_blocks; ++i) {
+            wav_write(fp, block, frames_per_block);
+        }
+        wav_close(fp);
+        double seconds = now_sec() - t0;
+        check_err("wav_write");
+
+        report("durability", variants[v].name, seconds, (double)(num_blocks * frames_per_block * 4), (double)num_blocks);
+    }
+
+    free(block);
+    remove(BENCH_FILE);
+}
+
+/* The textbook per-sample G.711 codec, the baseline for the library kernels */
+static short ref_g711_decode(unsigned char code, WavU16 format)
+{
+    int t, seg;
+
+    if (format == WAV_FORMAT_ALAW) {
+        code ^= 0x55;
+        t = (code & 0xf) << 4;
+        seg = (code & 0x70) >> 4;
+        if (seg == 0) {
+            t += 8;
+        } else {
+            t = (t + 0x108) << (seg - 1);
+        }
+        return (short)((code & 0x80) ? t : -t);
+    }
+    code = (unsigned char)~code;
+    t = (((code & 0xf) << 3) + 0x84) << ((code & 0x70) >> 4);
+    return (short)((code & 0x80) ? 0x84 - t : t - 0x84);
+}
+
+static unsigned char ref_g711_encode(short x, WavU16 format)
+{
+    static const int alaw_end[8] = {0x1f, 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff};
+    static const int mulaw_end[8] = {0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff, 0x1fff};
+    int mask, seg;
+    int pcm;
+
+    if (format == WAV_FORMAT_ALAW) {
+        pcm = x >> 3;
+        if (pcm >= 0) {
+            mask = 0xd5;
+        } else {
+            mask = 0x55;
+            pcm = -pcm - 1;
+        }
+        for (seg = 0; seg < 8 && pcm > alaw_end[seg]; ++seg) {
+        }
+        if (seg >= 8) {
+            return (unsigned char)(0x7f ^ mask);
+        }
+        return (unsigned char)(((seg << 4) | ((pcm >> (seg < 2 ? 1 : seg)) & 0xf)) ^ mask);
+    }
+    pcm = x >> 2;
+    if (pcm < 0) {
+        pcm = -pcm;
+        mask = 0x7f;
+    } else {
+        mask = 0xff;
+    }
+    if (pcm > 8159) {
+        pcm = 8159;
+    }
+    pcm += 33;
+    for (seg = 0; seg < 8 && pcm > mulaw_end[seg]; ++seg) {
+    }
+    if (seg >= 8) {
+        return (unsigned char)(0x7f ^ mask);
+    }
+    return (unsigned char)(((seg << 4) | ((pcm >> (seg + 1)) & 0xf)) ^ mask);
+}
+
+/* 64 Mi samples of 8 kHz A-law and mu-law per unit of scale, coded by the
+ * library through wav_write_f32/wav_read_f32 and by the reference codec
+ * around wav_write/wav_read. Both must decode to the same samples. */
+static void bench_g711(int scale)
+{
+    size_t frames_per_block = 4096;
+    size_t num_blocks = 16384 * (size_t)scale;
+    size_t total_frames = frames_per_block * num_blocks;
+    float *samples = malloc(frames_per_block * sizeof(float));
+    unsigned char *codes = malloc(frames_per_block);
+    float *out = malloc(frames_per_block * sizeof(float));
+    static const struct {
+        const char* name;
+        WavU16      format;
+        int         reference;
+    } variants[] = {
+        {"alaw reference",  WAV_FORMAT_ALAW,    1},
+        {"alaw",            WAV_FORMAT_ALAW,    0},
+        {"mulaw reference", WAV_FORMAT_MULAW,   1},
+        {"mulaw",           WAV_FORMAT_MULAW,   0},
+    };
+
+    for (size_t j = 0; j < frames_per_block; ++j) {
+        samples[j] = (float)((double)((j * 2654435761u) & 0xffff) / 32768.0 - 1.0);
+    }
+
+    double expected = 0.0;
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        char variant[32];
+        double sum = 0.0;
+        WavFile *fp;
+
+        fp = wav_open(BENCH_FILE, WAV_OPEN_WRITE);
+        check_err("wav_open");
+        wav_set_num_channels(fp, 1);
+        wav_set_sample_rate(fp, 8000);
+        wav_set_format(fp, variants[v].format);
+        wav_set_header_update(fp, WAV_HEADER_UPDATE_ON_FLUSH, 0);
+        double t0 = now_sec();
+        for (size_t i = 0; i < num_blocks; ++i) {
+            if (variants[v].reference) {
+                for (size_t j = 0; j < frames_per_block; ++j) {
+                    float x = samples[j] * 32768.0f;
+                    x = x < -32768.0f ? -32768.0f : x > 32767.0f ? 32767.0f : x;
+                    codes[j] = ref_g711_encode((short)lrintf(x), variants[v].format);
+                }
+                wav_write(fp, codes, frames_per_block);
+            } else {
+                wav_write_f32(fp, samples, frames_per_block);
+            }
+        }
+        wav_close(fp);
+        double t1 = now_sec();
+        check_err("wav_write");
+        snprintf(variant, sizeof(variant), "%s encode", variants[v].name);
+        report("g711", variant, t1 - t0, (double)total_frames, (double)total_frames);
+
+        fp = wav_open(BENCH_FILE, WAV_OPEN_READ);
+        check_err("wav_open");
+        t0 = now_sec();
+        if (variants[v].reference) {
+            size_t n;
+            while ((n = wav_read(fp, codes, frames_per_block)) > 0) {
+                for (size_t j = 0; j < n; ++j) {
+                    out[j] = (float)ref_g711_decode(codes[j], variants[v].format) * (1.0f / 32768.0f);
+                }
+                sum += out[n - 1];
+            }
+        } else {
+            size_t n;
+            while ((n = wav_read_f32(fp, out, frames_per_block)) > 0) {
+                sum += out[n - 1];
+            }
+        }
+        t1 = now_sec();
+        check_err("wav_read");
+        wav_close(fp);
+        snprintf(variant, sizeof(variant), "%s decode", variants[v].name);
+        report("g711", variant, t1 - t0, (double)total_frames, (double)total_frames);
+
+        if (variants[v].reference) {
+            expected = sum;
+        } else if (sum != expected) {
+            fprintf(stderr, "g711: %s checksum mismatch\n", variants[v].name);
+            exit(1);
+        }
+    }
+
+    free(out);
+    free(codes);
+    free(samples);
+    remove(BENCH_FILE);
+}
+
+/* 16 MiB clips of 16-bit stereo, loaded and saved whole, 32 times per unit of
+ * scale */
+static void bench_load(int scale)
+{
+    size_t total_frames = 4 << 20;
+    size_t rounds = 32 * (size_t)scale;
+    WavI16 *clip = malloc(total_frames * 4);
+    WavInfo info;
+    void *data;
+    double t0;
+
+    for (size_t j = 0; j < total_frames * 2; ++j) {
+        clip[j] = (WavI16)(j * 31);
+    }
+    memset(&info, 0, sizeof(info));
+    info.format = WAV_FORMAT_PCM;
+    info.num_channels = 2;
+    info.sample_rate = 44100;
+    info.sample_size = 2;
+    info.length = total_frames;
+
+    t0 = now_sec();
+    for (size_t r = 0; r < rounds; ++r) {
+        WavFile *fp = wav_open(BENCH_FILE, WAV_OPEN_WRITE);
+        wav_set_num_channels(fp, 2);
+        wav_set_sample_rate(fp, 44100);
+        wav_set_sample_size(fp, 2);
+        wav_write(fp, clip, total_frames);
+        wav_close(fp);
+    }
+    report("load", "wav_open + wav_write", now_sec() - t0, (double)(total_frames * 4 * rounds), (double)rounds);
+    check_err("wav_write");
+
+    t0 = now_sec();
+    for (size_t r = 0; r < rounds; ++r) {
+        wav_save(BENCH_FILE, &info, clip);
+    }
+    report("load", "wav_save", now_sec() - t0, (double)(total_frames * 4 * rounds), (double)rounds);
+    check_err("wav_save");
+
+    t0 = now_sec();
+    for (size_t r = 0; r < rounds; ++r) {
+        WavFile *fp = wav_open(BENCH_FILE, WAV_OPEN_READ);
+        size_t length = (size_t)wav_get_length(fp);
+        data = wav_malloc(length * 4);
+        wav_read(fp, data, length);
+        wav_close(fp);
+        wav_free(data);
+    }
+    report("load", "wav_open + wav_read", now_sec() - t0, (double)(total_frames * 4 * rounds), (double)rounds);
+    check_err("wav_read");
+
+    t0 = now_sec();
+    for (size_t r = 0; r < rounds; ++r) {
+        wav_load(BENCH_FILE, &info, &data);
+        wav_free(data);
+    }
+    report("load", "wav_load", now_sec() - t0, (double)(total_frames * 4 * rounds), (double)rounds);
+    check_err("wav_load");
+
+    wav_load(BENCH_FILE, &info, &data);
+    if (info.length != total_frames || memcmp(data, clip, total_frames * 4) != 0) {
+        fprintf(stderr, "load: wav_load returned different samples\n");
+        exit(1);
+    }
+    wav_free(data);
+
+    free(clip);
+    remove(BENCH_FILE);
+}
+
+/* 2000 files per unit of scale of 100 ms of 16-bit mono at 16 kHz, the
+ * format set field by field after wav_open or all at once by wav_open_ex */
+static void bench_create(int scale)
+{
+    size_t num_files = 2000 * (size_t)scale;
+    size_t frames = 1600;
+    WavI16 *block = calloc(frames, sizeof(WavI16));
+    WavFormatSpec spec;
+    static const struct {
+        const char* name;
+        WavU32      mode;
+        int         ex;
+    } variants[] = {
+        {"stdio wav_set_*",     WAV_OPEN_WRITE,                 0},
+        {"stdio wav_open_ex",   WAV_OPEN_WRITE,                 1},
+        {"fd wav_set_*",        WAV_OPEN_WRITE | WAV_OPEN_FD,   0},
+        {"fd wav_open_ex",      WAV_OPEN_WRITE | WAV_OPEN_FD,   1},
+    };
+
+    memset(&spec, 0, sizeof(spec));
+    spec.format = WAV_FORMAT_PCM;
+    spec.num_channels = 1;
+    spec.sample_rate = 16000;
+    spec.sample_size = 2;
+
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); ++v) {
+        double t0 = now_sec();
+        for (size_t i = 0; i < num_files; ++i) {
+            WavFile *fp;
+            if (variants[v].ex) {
+                fp = wav_open_ex(BENCH_FILE, variants[v].mode, &spec);
+            } else {
+                fp = wav_open(BENCH_FILE, variants[v].mode);
+                wav_set_format(fp, WAV_FORMAT_PCM);
+                wav_set_num_channels(fp, 1);
+                wav_set_sample_rate(fp, 16000);
+                wav_set_sample_size(fp, 2);
+            }
+            wav_write(fp, block, frames);
+            wav_close(fp);
+        }
+        report("create", variants[v].name, now_sec() - t0, (double)(num_files * frames * 2), (double)num_files);
+        check_err("wav_write");
+    }
+
+    free(block);
+    remove(BENCH_FILE);
+}
+
+static const struct {
+    const char* name;
+    void        (*run)(int scale);
+} benchmarks[] = {
+    {"write-small", &bench_write_small},
+    {"writev",      &bench_writev},
+    {"read",        &bench_read},
+    {"async",       &bench_async},
+    {"io",          &bench_io},
+    {"load",        &bench_load},
+    {"create",      &bench_create},
+    {"transcode",   &bench_transcode},
+    {"g711",        &bench_g711},
+    {"durability",  &bench_durability},
+#if defined(__unix__) || defined(__APPLE__)
+    {"probe",       &bench_probe},
+    {"pread",       &bench_pread},
+    {"engine",      &bench_engine},
+#endif
+};
+
+int main(int argc, char **argv)
+{
+    const char *name = argc > 1 ? argv[1] : NULL;
+    int scale = argc > 2 ? atoi(argv[2]) : 1;
+    int found = 0;
+
+    if (scale < 1) {
+        scale = 1;
+    }
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i) {
+        if (name == NULL || strcmp(name, benchmarks[i].name) == 0) {
+            benchmarks[i].run(scale);
+            found = 1;
+        }
+    }
+
+    if (!found) {
+        fprintf(stderr, "unknown benchmark: %s\n", name);
+        return 1;
+    }
+
+    return 0;
+}
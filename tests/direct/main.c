@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wav.h"
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                       \
+        }                                                                   \
+    } while (0)
+
+/* the exit code that makes ctest report the test as skipped */
+#define SKIP            77
+
+#define FILENAME        "direct.wav"
+#define NUM_CHANNELS    2
+#define BLOCK_ALIGN     (NUM_CHANNELS * 2)
+/* the layout of a PCM file created by libwav: RIFF, JUNK, fmt, data */
+#define DATA_OFFSET     80
+/* the size of the buffer {WAV_OPEN_DIRECT} stages the frames in */
+#define BUFFER_SIZE     65536
+/* frames up to the end of the first and the second buffer */
+#define FIRST_BLOCK     ((BUFFER_SIZE - DATA_OFFSET) / BLOCK_ALIGN)
+#define SECOND_BLOCK    ((2 * BUFFER_SIZE - DATA_OFFSET) / BLOCK_ALIGN)
+#define NUM_FRAMES      100000
+
+static void fill(WavI16* x, size_t first, size_t count, int salt)
+{
+    for (size_t i = 0; i < count * NUM_CHANNELS; ++i) {
+        x[i] = (WavI16)((first * NUM_CHANNELS + i) * 31 + (size_t)salt);
+    }
+}
+
+/* Check the frames of the file against {expected} with buffered reads */
+static int check_file(WAV_CONST WavI16* expected, size_t count)
+{
+    WavI16*  x = malloc((count + 1) * BLOCK_ALIGN);
+    WavFile* fp = wav_open(FILENAME, WAV_OPEN_READ);
+
+    CHECK(x != NULL);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_length(fp) == count);
+    CHECK(wav_read(fp, x, count + 1) == count);
+    CHECK(memcmp(x, expected, count * BLOCK_ALIGN) == 0);
+    wav_close(fp);
+    free(x);
+    return 0;
+}
+
+int main(void)
+{
+    WavI16*  expected = malloc(NUM_FRAMES * BLOCK_ALIGN);
+    WavI16*  x = malloc(NUM_FRAMES * BLOCK_ALIGN);
+    WavFile* fp;
+
+    CHECK(expected != NULL && x != NULL);
+
+    fp = wav_open(FILENAME, WAV_OPEN_READ | WAV_OPEN_WRITE | WAV_OPEN_DIRECT);
+    CHECK(fp != NULL);
+    if (wav_err()->code == WAV_ERR_OS) {
+        fprintf(stderr, "no direct I/O: %s\n", wav_err()->message);
+        wav_close(fp);
+        remove(FILENAME);
+        return SKIP;
+    }
+    CHECK(wav_err()->code == WAV_OK);
+    wav_set_format(fp, WAV_FORMAT_PCM);
+    wav_set_num_channels(fp, NUM_CHANNELS);
+    wav_set_sample_rate(fp, 44100);
+    wav_set_sample_size(fp, 2);
+    fill(expected, 0, FIRST_BLOCK, 0);
+    CHECK(wav_write(fp, expected, FIRST_BLOCK) == FIRST_BLOCK);
+
+    /* a read that ends on a block boundary leaves a clean, full buffer, then
+     * the frames are written right after it */
+    CHECK(wav_seek(fp, 0, SEEK_SET) == 0);
+    CHECK(wav_read(fp, x, FIRST_BLOCK) == FIRST_BLOCK);
+    CHECK(memcmp(x, expected, FIRST_BLOCK * BLOCK_ALIGN) == 0);
+    fill(expected + FIRST_BLOCK * NUM_CHANNELS, FIRST_BLOCK, NUM_FRAMES - FIRST_BLOCK, 1);
+    CHECK(wav_write(fp, expected + FIRST_BLOCK * NUM_CHANNELS, 1) == 1);
+    CHECK(wav_write(fp, expected + (FIRST_BLOCK + 1) * NUM_CHANNELS, NUM_FRAMES - FIRST_BLOCK - 1) == NUM_FRAMES - FIRST_BLOCK - 1);
+    CHECK(wav_get_length(fp) == NUM_FRAMES);
+
+    CHECK(wav_seek(fp, 0, SEEK_SET) == 0);
+    CHECK(wav_read(fp, x, NUM_FRAMES) == NUM_FRAMES);
+    CHECK(memcmp(x, expected, NUM_FRAMES * BLOCK_ALIGN) == 0);
+    wav_close(fp);
+    CHECK(wav_err()->code == WAV_OK);
+    if (check_file(expected, NUM_FRAMES) != 0) {
+        return 1;
+    }
+
+    /* appending to data that ends on a block boundary, after reading up to it */
+    fp = wav_open(FILENAME, WAV_OPEN_WRITE);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    wav_set_format(fp, WAV_FORMAT_PCM);
+    wav_set_num_channels(fp, NUM_CHANNELS);
+    wav_set_sample_rate(fp, 44100);
+    wav_set_sample_size(fp, 2);
+    fill(expected, 0, SECOND_BLOCK, 3);
+    CHECK(wav_write(fp, expected, SECOND_BLOCK) == SECOND_BLOCK);
+    wav_close(fp);
+    CHECK(wav_err()->code == WAV_OK);
+
+    fp = wav_open(FILENAME, WAV_OPEN_READ | WAV_OPEN_APPEND | WAV_OPEN_DIRECT);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_length(fp) == SECOND_BLOCK);
+    CHECK(wav_seek(fp, 0, SEEK_SET) == 0);
+    CHECK(wav_read(fp, x, SECOND_BLOCK) == SECOND_BLOCK);
+    CHECK(memcmp(x, expected, SECOND_BLOCK * BLOCK_ALIGN) == 0);
+    fill(expected + SECOND_BLOCK * NUM_CHANNELS, SECOND_BLOCK, 1000, 4);
+    CHECK(wav_write(fp, expected + SECOND_BLOCK * NUM_CHANNELS, 1000) == 1000);
+    CHECK(wav_get_length(fp) == SECOND_BLOCK + 1000);
+    wav_close(fp);
+    CHECK(wav_err()->code == WAV_OK);
+    if (check_file(expected, SECOND_BLOCK + 1000) != 0) {
+        return 1;
+    }
+
+    remove(FILENAME);
+    free(expected);
+    free(x);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wav.h"
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                       \
+        }                                                                   \
+    } while (0)
+
+#define SRC_FILENAME    "extensible.wav"
+#define DST_FILENAME    "extensible-16.wav"
+/* a few tiles of wav_transcode_parallel */
+#define NUM_FRAMES      200000
+#define NUM_CHANNELS    6
+#define VALID_BITS      20
+
+/* the layout of an extensible file created by libwav: RIFF, JUNK, fmt (40 bytes), data */
+#define DATA_OFFSET     104
+
+static WavI32 load_i24(WAV_CONST WavU8* p)
+{
+    return (WavI32)((WavU32)p[0] << 8 | (WavU32)p[1] << 16 | (WavU32)p[2] << 24) >> 8;
+}
+
+static void store_i24(WavU8* p, WavI32 x)
+{
+    p[0] = (WavU8)x;
+    p[1] = (WavU8)(x >> 8);
+    p[2] = (WavU8)(x >> 16);
+}
+
+/* a 24-bit sample rounded to 16 bits, to nearest with ties to even as lrintf() does, and saturated */
+static WavI16 round_to_i16(WavI32 x)
+{
+    WavI32 q = x >> 8;
+    WavI32 r = x & 0xff;
+
+    if (r > 0x80 || (r == 0x80 && (q & 1))) {
+        ++q;
+    }
+    return (WavI16)(q > 32767 ? 32767 : q);
+}
+
+int main(void)
+{
+    size_t          n = (size_t)NUM_FRAMES * NUM_CHANNELS;
+    WavU8*          samples = malloc(n * 3);
+    WavU8*          readback = malloc(n * 3);
+    WavI16*         converted = malloc(n * sizeof(WavI16));
+    WavFormatSpec   spec;
+    WavInfo         info;
+    WavFile*        fp;
+
+    CHECK(samples != NULL && readback != NULL && converted != NULL);
+
+    /* 20-bit values in 24-bit containers, with both extremes in the first frames */
+    for (size_t i = 0; i < n; ++i) {
+        WavI32 x = (WavI32)((i * 40503u + 7919u) & 0xfffff) - 0x80000;
+        if (i < NUM_CHANNELS) {
+            x = -0x80000;
+        } else if (i < 2 * NUM_CHANNELS) {
+            x = 0x7ffff;
+        }
+        store_i24(samples + 3 * i, x * (1 << (24 - VALID_BITS)));
+    }
+
+    memset(&spec, 0, sizeof(spec));
+    spec.format = WAV_FORMAT_EXTENSIBLE;
+    spec.num_channels = NUM_CHANNELS;
+    spec.sample_rate = 48000;
+    spec.sample_size = 3;
+    spec.valid_bits_per_sample = VALID_BITS;
+    spec.channel_mask = 0x3f;
+    spec.sub_format = WAV_FORMAT_PCM;
+    fp = wav_open_ex(SRC_FILENAME, WAV_OPEN_WRITE, &spec);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_write(fp, samples, NUM_FRAMES) == NUM_FRAMES);
+    wav_close(fp);
+    CHECK(wav_err()->code == WAV_OK);
+
+    CHECK(wav_probe(SRC_FILENAME, &info) == 0);
+    CHECK(info.format == WAV_FORMAT_EXTENSIBLE);
+    CHECK(info.num_channels == NUM_CHANNELS);
+    CHECK(info.sample_rate == 48000);
+    CHECK(info.sample_size == 3);
+    CHECK(info.valid_bits_per_sample == VALID_BITS);
+    CHECK(info.channel_mask == 0x3f);
+    CHECK(info.sub_format == WAV_FORMAT_PCM);
+    CHECK(info.length == NUM_FRAMES);
+    CHECK(info.data_offset == DATA_OFFSET);
+    CHECK(!info.rf64);
+
+    fp = wav_open(SRC_FILENAME, WAV_OPEN_READ);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_length(fp) == NUM_FRAMES);
+    CHECK(wav_read(fp, readback, NUM_FRAMES) == NUM_FRAMES);
+    CHECK(memcmp(samples, readback, n * 3) == 0);
+    wav_close(fp);
+
+    /* down to plain 16-bit PCM, the other fields are kept */
+    memset(&spec, 0, sizeof(spec));
+    spec.format = WAV_FORMAT_PCM;
+    spec.sample_size = 2;
+    CHECK(wav_transcode_parallel(SRC_FILENAME, DST_FILENAME, &spec, 4) == 0);
+
+    CHECK(wav_probe(DST_FILENAME, &info) == 0);
+    CHECK(info.format == WAV_FORMAT_PCM);
+    CHECK(info.num_channels == NUM_CHANNELS);
+    CHECK(info.sample_rate == 48000);
+    CHECK(info.sample_size == 2);
+    CHECK(info.length == NUM_FRAMES);
+
+    fp = wav_open(DST_FILENAME, WAV_OPEN_READ);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_read(fp, converted, NUM_FRAMES) == NUM_FRAMES);
+    wav_close(fp);
+    CHECK(converted[0] == -32768);
+    CHECK(converted[NUM_CHANNELS] == 32767);
+    for (size_t i = 0; i < n; ++i) {
+        CHECK(converted[i] == round_to_i16(load_i24(samples + 3 * i)));
+    }
+
+    /* wav_open_ex() takes the formats wav_set_valid_bits_per_sample() takes */
+    memset(&spec, 0, sizeof(spec));
+    spec.format = WAV_FORMAT_ALAW;
+    spec.valid_bits_per_sample = 4;
+    CHECK(wav_open_ex(DST_FILENAME, WAV_OPEN_WRITE, &spec) == NULL);
+    CHECK(wav_err()->code == WAV_ERR_PARAM);
+    wav_err_clear();
+    spec.format = WAV_FORMAT_EXTENSIBLE;
+    spec.sub_format = WAV_FORMAT_MULAW;
+    spec.sample_size = 1;
+    CHECK(wav_open_ex(DST_FILENAME, WAV_OPEN_WRITE, &spec) == NULL);
+    CHECK(wav_err()->code == WAV_ERR_PARAM);
+    wav_err_clear();
+    spec.valid_bits_per_sample = 8;
+    fp = wav_open_ex(DST_FILENAME, WAV_OPEN_WRITE, &spec);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    wav_close(fp);
+
+    remove(SRC_FILENAME);
+    remove(DST_FILENAME);
+    free(samples);
+    free(readback);
+    free(converted);
+    return 0;
+}
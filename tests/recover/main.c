@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include "wav.h"
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                       \
+        }                                                                   \
+    } while (0)
+
+#define FILENAME        "recover.wav"
+#define NUM_FRAMES      1000
+#define NUM_CHANNELS    2
+
+/* the layout of a PCM file created by libwav: RIFF, JUNK, fmt, data */
+#define DATA_OFFSET     80
+#define BLOCK_ALIGN     (NUM_CHANNELS * 2)
+
+static WavU32 get_u32(WAV_CONST WavU8* p)
+{
+    return (WavU32)p[0] | (WavU32)p[1] << 8 | (WavU32)p[2] << 16 | (WavU32)p[3] << 24;
+}
+
+int main(void)
+{
+    static WavI16   samples[NUM_FRAMES * NUM_CHANNELS];
+    static WavI16   readback[NUM_FRAMES * NUM_CHANNELS];
+    WAV_CONST WavU8 zero[4] = {0, 0, 0, 0};
+    WAV_CONST WavU8 partial[BLOCK_ALIGN - 1] = {1, 2, 3};
+    WavU8           header[DATA_OFFSET];
+    WavFile*        fp;
+    FILE*           raw;
+
+    for (int i = 0; i < NUM_FRAMES * NUM_CHANNELS; ++i) {
+        samples[i] = (WavI16)(i % 100 - 50);
+    }
+
+    fp = wav_open(FILENAME, WAV_OPEN_WRITE);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    wav_set_format(fp, WAV_FORMAT_PCM);
+    wav_set_num_channels(fp, NUM_CHANNELS);
+    wav_set_sample_rate(fp, 44100);
+    wav_set_sample_size(fp, 2);
+    CHECK(wav_write(fp, samples, NUM_FRAMES) == NUM_FRAMES);
+    wav_close(fp);
+    CHECK(wav_err()->code == WAV_OK);
+
+    /* what a writer that died before its first header update leaves behind */
+    raw = fopen(FILENAME, "r+b");
+    CHECK(raw != NULL);
+    CHECK(fseek(raw, 4, SEEK_SET) == 0 && fwrite(zero, 1, 4, raw) == 4);
+    CHECK(fseek(raw, DATA_OFFSET - 4, SEEK_SET) == 0 && fwrite(zero, 1, 4, raw) == 4);
+    CHECK(fseek(raw, 0, SEEK_END) == 0 && fwrite(partial, 1, sizeof(partial), raw) == sizeof(partial));
+    fclose(raw);
+
+    fp = wav_open(FILENAME, WAV_OPEN_READ);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_length(fp) == 0);
+    wav_close(fp);
+
+    fp = wav_open(FILENAME, WAV_OPEN_READ | WAV_OPEN_RECOVER);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_recovered_frames(fp) == NUM_FRAMES);
+    CHECK(wav_get_length(fp) == NUM_FRAMES);
+    CHECK(wav_read(fp, readback, NUM_FRAMES) == NUM_FRAMES);
+    CHECK(memcmp(samples, readback, sizeof(samples)) == 0);
+    wav_close(fp);
+    CHECK(wav_err()->code == WAV_OK);
+
+    /* the header is patched and the partial frame is gone */
+    raw = fopen(FILENAME, "rb");
+    CHECK(raw != NULL);
+    CHECK(fread(header, 1, sizeof(header), raw) == sizeof(header));
+    CHECK(fseek(raw, 0, SEEK_END) == 0);
+    CHECK(ftell(raw) == DATA_OFFSET + NUM_FRAMES * BLOCK_ALIGN);
+    fclose(raw);
+    CHECK(memcmp(header, "RIFF", 4) == 0);
+    CHECK(get_u32(header + 4) == DATA_OFFSET - 8 + NUM_FRAMES * BLOCK_ALIGN);
+    CHECK(memcmp(header + DATA_OFFSET - 8, "data", 4) == 0);
+    CHECK(get_u32(header + DATA_OFFSET - 4) == NUM_FRAMES * BLOCK_ALIGN);
+
+    /* a file that is already consistent is left alone */
+    fp = wav_open(FILENAME, WAV_OPEN_READ | WAV_OPEN_RECOVER);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_recovered_frames(fp) == 0);
+    CHECK(wav_get_length(fp) == NUM_FRAMES);
+    wav_close(fp);
+
+    remove(FILENAME);
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wav.h"
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                       \
+        }                                                                   \
+    } while (0)
+
+/* A sink that keeps only the header, so a file can cross 4 GiB without the
+ * disk space or the time to write it. Reads past the header return zeros. */
+#define SINK_HEAD_SIZE  ((size_t)4096)
+
+typedef struct {
+    WavU8   head[SINK_HEAD_SIZE];
+    WavU64  pos;
+    WavU64  size;
+} Sink;
+
+static WavI64 sink_read(void *context, void *buffer, size_t size)
+{
+    Sink*  sink = context;
+    size_t n = 0;
+
+    if (sink->pos < sink->size) {
+        n = sink->size - sink->pos < size ? (size_t)(sink->size - sink->pos) : size;
+    }
+    memset(buffer, 0, n);
+    if (sink->pos < SINK_HEAD_SIZE) {
+        size_t head = SINK_HEAD_SIZE - (size_t)sink->pos < n ? SINK_HEAD_SIZE - (size_t)sink->pos : n;
+        memcpy(buffer, sink->head + sink->pos, head);
+    }
+    sink->pos += n;
+    return (WavI64)n;
+}
+
+static WavI64 sink_write(void *context, WAV_CONST void *buffer, size_t size)
+{
+    Sink* sink = context;
+
+    if (sink->pos < SINK_HEAD_SIZE) {
+        size_t head = SINK_HEAD_SIZE - (size_t)sink->pos < size ? SINK_HEAD_SIZE - (size_t)sink->pos : size;
+        memcpy(sink->head + sink->pos, buffer, head);
+    }
+    sink->pos += size;
+    if (sink->pos > sink->size) {
+        sink->size = sink->pos;
+    }
+    return (WavI64)size;
+}
+
+static int sink_seek(void *context, WavU64 offset)
+{
+    ((Sink*)context)->pos = offset;
+    return 0;
+}
+
+static WavI64 sink_tell(void *context)
+{
+    return (WavI64)((Sink*)context)->pos;
+}
+
+static WavU32 get_u32(WAV_CONST WavU8* p)
+{
+    return (WavU32)p[0] | (WavU32)p[1] << 8 | (WavU32)p[2] << 16 | (WavU32)p[3] << 24;
+}
+
+static WavU64 get_u64(WAV_CONST WavU8* p)
+{
+    return (WavU64)get_u32(p) | (WavU64)get_u32(p + 4) << 32;
+}
+
+/* the layout of a PCM file created by libwav: RIFF, JUNK/ds64, fmt, data */
+#define DS64_OFFSET     12
+#define DATA_OFFSET     80
+
+static int check_rf64(WAV_CONST Sink* sink, WavU64 data_size, WavU64 frames)
+{
+    CHECK(memcmp(sink->head, "RF64", 4) == 0);
+    CHECK(get_u32(sink->head + 4) == 0xffffffff);
+    CHECK(memcmp(sink->head + 8, "WAVE", 4) == 0);
+    CHECK(memcmp(sink->head + DS64_OFFSET, "ds64", 4) == 0);
+    CHECK(get_u32(sink->head + DS64_OFFSET + 4) == 28);
+    CHECK(get_u64(sink->head + DS64_OFFSET + 8) == DATA_OFFSET - 8 + data_size);
+    CHECK(get_u64(sink->head + DS64_OFFSET + 16) == data_size);
+    CHECK(get_u64(sink->head + DS64_OFFSET + 24) == frames);
+    CHECK(memcmp(sink->head + DATA_OFFSET - 8, "data", 4) == 0);
+    CHECK(get_u32(sink->head + DATA_OFFSET - 4) == 0xffffffff);
+    CHECK(sink->size == DATA_OFFSET + data_size);
+    return 0;
+}
+
+int main(void)
+{
+    static Sink    sink;
+    WavIO          io;
+    WavFile*       fp;
+    WavU64         frames = 0;
+    size_t         chunk = (size_t)1 << 22;
+    WavU64         block_align = 2 * 2;
+    WavU64         target = ((WavU64)1 << 32) / block_align + chunk;
+    WavI16*        buf = calloc(chunk, (size_t)block_align);
+
+    CHECK(buf != NULL);
+    memset(&io, 0, sizeof(io));
+    io.read = sink_read;
+    io.write = sink_write;
+    io.seek = sink_seek;
+    io.tell = sink_tell;
+
+    /* write just below 4 GiB, the file is still a plain RIFF */
+    fp = wav_open_io(&io, &sink, WAV_OPEN_WRITE);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    wav_set_format(fp, WAV_FORMAT_PCM);
+    wav_set_num_channels(fp, 2);
+    wav_set_sample_rate(fp, 48000);
+    wav_set_sample_size(fp, 2);
+    while (frames + chunk < ((WavU64)1 << 32) / block_align - chunk) {
+        CHECK(wav_write(fp, buf, chunk) == chunk);
+        frames += chunk;
+    }
+    wav_flush(fp);
+    CHECK(wav_err()->code == WAV_OK);
+    CHECK(memcmp(sink.head, "RIFF", 4) == 0);
+    CHECK(memcmp(sink.head + DS64_OFFSET, "JUNK", 4) == 0);
+    CHECK(get_u32(sink.head + 4) == DATA_OFFSET - 8 + frames * block_align);
+    CHECK(get_u32(sink.head + DATA_OFFSET - 4) == frames * block_align);
+
+    /* crossing 4 GiB promotes it to RF64 */
+    while (frames < target) {
+        CHECK(wav_write(fp, buf, chunk) == chunk);
+        frames += chunk;
+    }
+    CHECK(wav_get_length(fp) == frames);
+    wav_close(fp);
+    CHECK(wav_err()->code == WAV_OK);
+    if (check_rf64(&sink, frames * block_align, frames) != 0) {
+        return 1;
+    }
+
+    /* the sizes are read back from the ds64 chunk */
+    sink.pos = 0;
+    fp = wav_open_io(&io, &sink, WAV_OPEN_READ);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_length(fp) == frames);
+    wav_close(fp);
+
+    /* appending keeps the file RF64 and updates the ds64 sizes */
+    sink.pos = 0;
+    fp = wav_open_io(&io, &sink, WAV_OPEN_APPEND);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_length(fp) == frames);
+    CHECK(wav_write(fp, buf, 1000) == 1000);
+    frames += 1000;
+    CHECK(wav_get_length(fp) == frames);
+    wav_close(fp);
+    CHECK(wav_err()->code == WAV_OK);
+    if (check_rf64(&sink, frames * block_align, frames) != 0) {
+        return 1;
+    }
+
+    sink.pos = 0;
+    fp = wav_open_io(&io, &sink, WAV_OPEN_READ);
+    CHECK(fp != NULL && wav_err()->code == WAV_OK);
+    CHECK(wav_get_length(fp) == frames);
+    wav_close(fp);
+
+    free(buf);
+    return 0;
+}